@@ -8,22 +8,36 @@
 #define SCREEN_WIDTH 128
 #define OLED_RESET -1
 
+// Spectrum is drawn in the bottom 8 rows, under the scrolling file name.
+
+#define SPECTRUM_HEIGHT 8
+#define SPECTRUM_VU_WIDTH 8
+
 #include "mono_file.h"
 #include "sd_read_write.h"
 #include "i2s.h"
 #include "button.h"
+#include "spectrum.h"
+#include "edit_list.h"
+#include "power.h"
+#include "time_stretch.h"
+#include "track_cache.h"
+#include "audio_arena.h"
+#include "serial_transfer.h"
 
 Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
 
-// This vector is used to traverse files in given directory. Used for selecting audio.
+// Index of every WAV file on the card, sorted by path. Used for selecting audio.
 
-std::vector<String> filepaths;
+LibraryIndex library;
 int filepathsIndex;
 
 // Vector to store file size and duration for display.
 
 std::vector<int> fileDuration;
 
+// Written by loop() under readerMutex, read by audioTask under it. loop() reads its own writes without it.
+
 int isPaused = 1;
 
 // Seperate from filepathsIndex. When a file is played, this is set, then compared against filepathsIndex to check if selection has changed.
@@ -32,7 +46,46 @@ int isPaused = 1;
 
 int currentFileIndex = -1;
 
-File currentFile;
+// Edit list and player for the track being played. Tracks without a .edl file get a single segment covering the whole file.
+// readerMutex is held by audioTask while a view is in use, and by loop() while switching tracks.
+
+EditList currentEdits;
+EditPlayer currentTrack;
+
+// Sample rate of the current track, see trackRate(). Playback and elapsed time run at this rate.
+
+uint32_t trackSampleRate = SAMPLE_RATE;
+SemaphoreHandle_t readerMutex;
+uint8_t *readBuffer;
+
+// Time stretcher for variable speed playback, set with stretchSetSpeed(). Bypassed at 1.0x. stretch.active stays true
+// after a switch to 1.0x until held input is drained, and at the end of a track until its last frame is out.
+// Long press of button 1 steps through playbackSpeeds.
+
+TimeStretch stretch;
+int16_t stretched[STRETCH_HOP];
+
+static size_t readTrack(void *context, uint8_t **data, size_t maxBytes) {
+
+  return editPlayerNext(*(EditPlayer *)context, data, maxBytes);
+
+}
+
+const StretchReader trackReader = {readTrack, &currentTrack, CHUNK_SIZE};
+
+const float playbackSpeeds[] = {1.0f, 1.25f, 1.5f, 2.0f, 0.5f, 0.75f};
+const int playbackSpeedCount = sizeof(playbackSpeeds) / sizeof(playbackSpeeds[0]);
+int playbackSpeedIndex = 0;
+
+// A-B loop. Long press of button 2 marks A at the current position, the next one marks B and starts the loop, and a
+// third clears it. loopMarks counts points marked on the current track.
+
+uint32_t loopPointA = 0;
+int loopMarks = 0;
+
+// Playback output. Anything that implements the playback chain writes here instead of calling i2s_write().
+
+AudioSink output;
 
 int isFileSelection = 0;
 
@@ -50,13 +103,26 @@ int fileSeconds;
 // audioTask specific variables. Copy of variables in playMonoWAVFile() in mono_file.cpp.
 
 size_t bytes_read;
-size_t bytes_written;
-uint16_t buffer[512];
-int16_t *samples;
+const int16_t *samples;
 size_t sampleCount;
 
 double amplitude = 1.0;
 
+// Audio task is notified whenever playback state changes, so it can sleep while idle.
+// Stack size is checked against the high-water mark printed by arenaReport().
+
+TaskHandle_t audioTaskHandle;
+const int audioTaskStack = 6144;
+
+// Time audioTask sleeps between I2SUpdateLatency() calls while nothing is playing.
+
+const int idleLatencyUpdate = 1000;
+
+// Whether audioTask has something to play, read under readerMutex at the top of each pass. loop() uses this copy so
+// it does not read player state while audioTask changes it.
+
+volatile bool audioPlaying = false;
+
 // I2C screen-specific variables.
 
 int16_t textX;
@@ -64,6 +130,178 @@ int16_t textWidth;
 unsigned long lastFrame = 0;
 const int frameDelay = 30;
 
+// Serial rate for debug prints and file transfers. tools/send_wav.py can raise it for a transfer.
+
+const uint32_t serialBaud = 115200;
+
+// Time loop() sleeps between button polls while nothing is playing.
+
+const int idlePollDelay = 25;
+
+/*
+
+  drawSpectrum() - Draws spectrum bars along the bottom text row, with a VU bar on the right edge.
+  Levels come from spectrum.cpp, which is fed by audioTask().
+
+*/
+
+void drawSpectrum(unsigned long now) {
+
+  spectrumUpdate(now);
+
+  int bands = spectrumBandCount();
+  int barWidth = (SCREEN_WIDTH - SPECTRUM_VU_WIDTH) / bands;
+
+  for (int b = 0; b < bands; b++) {
+
+    int height = spectrumBand(b) * SPECTRUM_HEIGHT / 256;
+
+    if (height > 0) display.fillRect(b * barWidth, SCREEN_HEIGHT - height, barWidth - 1, height, WHITE);
+
+  }
+
+  int height = spectrumVU() * SPECTRUM_HEIGHT / 256;
+
+  if (height > 0) display.fillRect(SCREEN_WIDTH - SPECTRUM_VU_WIDTH + 2, SCREEN_HEIGHT - height, SPECTRUM_VU_WIDTH - 2, height, WHITE);
+
+}
+
+/*
+
+  loadTrackEdits() - Loads edit list stored next to a track, or a single segment covering the whole track if it has none.
+
+*/
+
+void loadTrackEdits(const char *path, EditList &edits) {
+
+  char editPath[128];
+
+  editListPath(path, editPath, sizeof(editPath));
+
+  if (editListLoad(SD_MMC, editPath, edits)) {
+
+    Serial.printf("Using edit list %s, %d segments.\n", editPath, edits.count);
+
+    return;
+
+  }
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  editListClear(edits);
+
+  if (readMonoWAVHeader(SD_MMC, path, header, dataOffset)) {
+
+    editListAdd(edits, path, 0, monoWAVSamples(header));
+
+  }
+
+}
+
+/*
+
+  trackRate() - Sample rate of an edit list, taken from the header of its first source. Segments from files at other
+  rates play at this one.
+
+*/
+
+uint32_t trackRate(const EditList &edits) {
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if (edits.count && readMonoWAVHeader(SD_MMC, editListSource(edits, 0), header, dataOffset) && header.sample_rate) return header.sample_rate;
+
+  return SAMPLE_RATE;
+
+}
+
+/*
+
+  cacheNearbyTracks() - Queues the start of a track and its neighbours in the library for the track cache, so
+  switching back and forth between them starts from RAM. Loaded a block at a time from loop().
+
+*/
+
+void cacheNearbyTracks(int index) {
+
+  for (int i = index - 1; i <= index + 1; i++) {
+
+    MonoWAVHeader header;
+    uint32_t dataOffset;
+
+    if (i < 0 || i >= (int)library.count || !readMonoWAVHeader(SD_MMC, libraryPath(library, i), header, dataOffset)) continue;
+
+    trackCacheRequest(libraryPath(library, i), 0, TRACK_CACHE_HEAD_SECONDS * header.sample_rate);
+
+  }
+
+}
+
+/*
+
+  setLoop() - Sets an A-B loop on the current track, or clears it if end is not greater than start.
+  Points are sample numbers in the edited track. Does nothing while no track is open.
+
+*/
+
+void setLoop(uint32_t start, uint32_t end) {
+
+  xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+  if (currentTrack.list) editPlayerSetLoop(currentTrack, start, end);
+
+  xSemaphoreGive(readerMutex);
+
+}
+
+/*
+
+  trackFileChange() - File change handler, see setFileChangeHandler(). Closes the current track while a file it plays
+  from is rewritten or replaced, and reopens it where it was once done. Writers run on the loop task, so no track
+  switch happens in between. A position past the end of the new file leaves the track closed.
+
+*/
+
+bool trackSuspended = false;
+uint32_t suspendedPosition = 0;
+
+void trackFileChange(const char *path, bool done) {
+
+  xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+  if (!done && currentTrack.list && editListUses(currentEdits, path)) {
+
+    suspendedPosition = currentTrack.position;
+
+    editPlayerClose(currentTrack);
+
+    stretch.active = false;
+    loopMarks = 0;
+    trackSuspended = true;
+
+  }
+
+  if (done && trackSuspended) {
+
+    trackSuspended = false;
+    trackSampleRate = trackRate(currentEdits);
+
+    I2SSetPlaybackRate(trackSampleRate);
+
+    if (!editPlayerOpen(currentTrack, SD_MMC, currentEdits, readBuffer, READ_BUFFER_BYTES(READ_BLOCK_SIZE)) || !editPlayerSeek(currentTrack, suspendedPosition)) {
+
+      editPlayerClose(currentTrack);
+
+    }
+
+  }
+
+  xSemaphoreGive(readerMutex);
+
+}
+
 // Attach audio playback to seperate core to eliminate audio loss when reading button events.
 
 void audioTask(void *parameters) {
@@ -74,19 +312,68 @@ void audioTask(void *parameters) {
 
   while (true) {
 
-    if (!isPaused && currentFile && currentFile.available()) {
+    powerCountWakeup();
+
+    // loop() changes track and pause state under readerMutex.
+
+    xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+    bool playing = !isPaused && (editPlayerAvailable(currentTrack) || stretch.active);
+
+    xSemaphoreGive(readerMutex);
+
+    audioPlaying = playing;
 
-      bytes_read = currentFile.read((uint8_t *)buffer, sizeof(buffer));
+    // Safe point for I2S driver reinstalls, nothing is mid-write here.
 
-      if (bytes_read > 0) {
+    I2SUpdateLatency(playing);
 
-        samples = (int16_t*)buffer;
+    // Nothing to play. Sleep until loop() starts playback instead of polling, waking now and then so latency profile
+    // changes and adaptive shrinking are applied, and DMA events drained, while idle.
 
-        sampleCount = bytes_read / 2;
+    if (!playing) {
 
-        totalSamples += sampleCount;
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idleLatencyUpdate));
 
-        elapsedSeconds = totalSamples / 44100;
+      continue;
+
+    }
+
+    powerBusyBegin();
+
+    bytes_read = 0;
+
+    xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+    if (!isPaused && (editPlayerAvailable(currentTrack) || stretch.active)) {
+
+      float speed = stretchGetSpeed(stretch);
+
+      // Volume is applied by the track's pipeline, in the same pass that decodes samples and applies segment gain.
+
+      editPlayerSetVolume(currentTrack, 0.4 * amplitude);
+
+      // Source samples this block covers. Differs from sampleCount when stretching.
+
+      uint32_t sourceCount = 0;
+      uint32_t positionBefore = currentTrack.position;
+
+      sampleCount = stretchNext(stretch, trackReader, stretched, &samples, sourceCount);
+
+      bytes_read = sampleCount * sizeof(int16_t);
+
+      if (sampleCount > 0) {
+
+        // A-B loop jumps move the player back, follow them.
+
+        if (currentTrack.position < positionBefore) totalSamples = currentTrack.position;
+        else totalSamples += sourceCount;
+
+        // Samples still sitting in DMA buffers have not been heard yet. At other speeds they cover more or less source time.
+
+        uint32_t latencySamples = I2SOutputLatencySamples() * speed;
+
+        elapsedSeconds = totalSamples > latencySamples ? (totalSamples - latencySamples) / trackSampleRate : 0;
 
         if(elapsedSeconds != seconds){
 
@@ -100,42 +387,65 @@ void audioTask(void *parameters) {
 
         }
 
-        for(int i=0;i<sampleCount;i++){
+        spectrumTapWrite(samples, sampleCount);
 
-          samples[i] *= (0.4 * amplitude);
+        // Time blocked on DMA is idle time.
 
-        }
+        powerBusyEnd();
 
-        i2s_write(I2S_NUM_1, buffer, bytes_read, &bytes_written, portMAX_DELAY);
+        sinkWrite(output, (const uint8_t*)samples, bytes_read);
 
       } 
 
     }
 
-    vTaskDelay(1);
+    xSemaphoreGive(readerMutex);
+
+    if (bytes_read == 0) {
+
+      powerBusyEnd();
+
+      vTaskDelay(1);
+
+    }
   }
 
 }
 
 // This is a helper function to normalize audio files to some level, i.e. 0.05. EXTREMELY SLOW.
 
-void normalizeAllFiles(std::vector<String> filepaths, double normalization) {
+void normalizeAllFiles(const LibraryIndex &library, double normalization) {
+
+  for (uint32_t i = 0; i < library.count; i++) {
 
-  for (const auto &filepath : filepaths) {
+    normalizeMonoWAVFile(SD_MMC, libraryPath(library, i), normalization);
+  }
+}
 
-    const char *path = filepath.c_str();
+// Moves sample data of every file in the library onto sector boundaries, each file through an aligned copy that
+// replaces it, see alignMonoWAVFile(). Aligned files are skipped, so only the first run over a library takes long,
+// later runs after a transfer only read headers. tools/wav_align.py does the same with the card in a reader.
 
-    char temp[64];
+void alignAllFiles(const LibraryIndex &library, uint32_t align) {
 
-    snprintf(temp, sizeof(temp), "/%s", path);
+  uint32_t failed = 0;
 
-    normalizeMonoWAVFile(SD_MMC, temp, normalization);
+  for (uint32_t i = 0; i < library.count; i++) {
+
+    if (!alignMonoWAVFile(SD_MMC, libraryPath(library, i), align)) failed++;
   }
+
+  Serial.printf("%u files aligned to %u bytes, %u failed.\n", library.count - failed, align, failed);
 }
 
 void setup() {
 
-  Serial.begin(115200);
+  // Serial also carries file transfers, which need a receive buffer that holds a full window of frames.
+
+  Serial.setRxBufferSize(XFER_RX_BUFFER);
+  Serial.begin(serialBaud);
+
+  transferInit(serialBaud);
 
   int isSDInit = SDInit();
 
@@ -147,9 +457,45 @@ void setup() {
 
   else {
 
-    xTaskCreatePinnedToCore(audioTask, "Audio", 4096, NULL, 1, NULL, 0);
-
     timeMutex = xSemaphoreCreateMutex();
+    readerMutex = xSemaphoreCreateMutex();
+
+    setFileChangeHandler(trackFileChange);
+
+    // Every audio and I/O buffer is taken here, and no sample buffer is allocated after setup(). Opening a track still
+    // goes through fs.open(), which allocates a file handle in the VFS and FATFS layers. That happens in loop() on a
+    // track switch, and in audioTask when an edit list moves on to another source file.
+
+    if (!arenaInit()) {
+
+      // Every read, cache and capture buffer comes from the arena, so nothing could play or record.
+
+      Serial.println("Halting, audio buffers could not be allocated.");
+
+      while (true) delay(1000);
+
+    }
+
+    readBuffer = (uint8_t*)arenaAlloc(READ_BUFFER_BYTES(READ_BLOCK_SIZE), "Playback read");
+
+    trackCacheInit();
+
+    recordInit();
+
+    arenaSeal();
+
+    // Recordings and other files written here start their samples on a sector.
+
+    setMonoWAVAlignment(WAV_DATA_ALIGN);
+
+    sinkInitI2S(output, I2S_NUM_1);
+
+    powerInit();
+
+    xTaskCreatePinnedToCore(audioTask, "Audio", audioTaskStack, NULL, 1, &audioTaskHandle, 0);
+
+    arenaWatchTask(audioTaskHandle, "Audio");
+    arenaWatchTask(xTaskGetCurrentTaskHandle(), "Loop");
 
     SDInfo();
 
@@ -157,9 +503,19 @@ void setup() {
 
     I2SInit();
 
+    I2SSetLatencyProfile(LATENCY_ADAPTIVE);
+
+    spectrumInit();
+
     listDir(SD_MMC, "/", 0);
 
-    filepaths = getDirFilePaths(SD_MMC, "/");
+    libraryInit(library);
+
+    scanLibrary(SD_MMC, "/", library);
+
+    alignAllFiles(library, WAV_DATA_ALIGN);
+
+    cacheNearbyTracks(filepathsIndex);
 
     Wire.begin(21, 22);
 
@@ -179,12 +535,14 @@ void setup() {
       display.setTextSize(1);
       display.setTextColor(WHITE);
       
-      textWidth = strlen(filepaths[filepathsIndex].c_str()) * 6;
+      const char *name = library.count ? libraryName(library, filepathsIndex) : "No files";
+
+      textWidth = strlen(name) * 6;
       textX = SCREEN_WIDTH;
 
       display.print("Now Playing");
       display.setCursor(0,16);
-      display.print(filepaths[filepathsIndex].c_str());
+      display.print(name);
 
     }
 
@@ -195,6 +553,8 @@ void setup() {
 
 void loop() {
 
+  powerCountWakeup();
+
   // Potentiometer on GPIO34. Divide by 400 to get values 0.0 - 10.0 for volume.
 
   amplitude = (analogRead(35) / 400);
@@ -203,15 +563,71 @@ void loop() {
 
   buttonReturn button = getButtonEvent();
 
+  // Long press of button 1 steps playback speed. The audio task picks it up at its next frame.
+
+  if (button.event == LONG_PRESS && button.type == BUTTON_1) {
+
+    playbackSpeedIndex = (playbackSpeedIndex + 1) % playbackSpeedCount;
+
+    stretchSetSpeed(stretch, playbackSpeeds[playbackSpeedIndex]);
+
+    Serial.printf("Speed %.2fx.\n", playbackSpeeds[playbackSpeedIndex]);
+
+  }
+
+  if (button.event == LONG_PRESS && button.type == BUTTON_2) {
+
+    xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+    uint32_t position = currentTrack.position;
+
+    xSemaphoreGive(readerMutex);
+
+    loopMarks = (loopMarks + 1) % 3;
+
+    if (loopMarks == 1) {
+
+      loopPointA = position;
+
+      Serial.printf("Loop A at %u.\n", loopPointA);
+
+    }
+
+    else if (loopMarks == 2 && position > loopPointA) {
+
+      setLoop(loopPointA, position);
+
+      Serial.printf("Looping %u - %u.\n", loopPointA, position);
+
+    }
+
+    else {
+
+      loopMarks = 0;
+
+      setLoop(0, 0);
+
+      Serial.println("Loop cleared.");
+
+    }
+
+  }
+
   if (button.event == SINGLE_PRESS) {
 
     if(button.type == BUTTON_1){
 
+      xSemaphoreTake(readerMutex, portMAX_DELAY);
+
       isPaused = !isPaused;
 
+      xSemaphoreGive(readerMutex);
+
+      if (audioTaskHandle) xTaskNotifyGive(audioTaskHandle);
+
     }
 
-    if(button.type == BUTTON_2 || button.type == BUTTON_3){
+    if((button.type == BUTTON_2 || button.type == BUTTON_3) && library.count){
 
       if(button.type == BUTTON_2){
 
@@ -221,17 +637,45 @@ void loop() {
 
       if(button.type == BUTTON_3){
 
-        if (filepathsIndex < filepaths.size() - 1) filepathsIndex++;
+        if (filepathsIndex < library.count - 1) filepathsIndex++;
 
       }
 
       display.clearDisplay();
 
-      char temp[64];
+      const char *path = libraryPath(library, filepathsIndex);
 
-      snprintf(temp, sizeof(temp), "/%s", filepaths[filepathsIndex].c_str());
+      textWidth = strlen(libraryName(library, filepathsIndex)) * 6;
 
-      fileDuration = printMonoWAVData(SD_MMC, temp);
+      printMonoWAVData(SD_MMC, path);
+
+      xSemaphoreTake(readerMutex, portMAX_DELAY);
+
+      editPlayerClose(currentTrack);
+      loadTrackEdits(path, currentEdits);
+
+      stretch.active = false;
+      loopMarks = 0;
+      trackSampleRate = trackRate(currentEdits);
+      editPlayerOpen(currentTrack, SD_MMC, currentEdits, readBuffer, READ_BUFFER_BYTES(READ_BLOCK_SIZE));
+
+      xSemaphoreGive(readerMutex);
+
+      // Applied by audioTask before the first block of the track is written.
+
+      I2SSetPlaybackRate(trackSampleRate);
+
+      cacheNearbyTracks(filepathsIndex);
+
+      trackCacheReport();
+
+      arenaReport();
+
+      uint32_t trackSamples = editListSamples(currentEdits);
+
+      fileDuration = {(int)(trackSamples / trackSampleRate), (int)trackSamples};
+
+      spectrumTapClear();
 
       totalSamples = 0;
 
@@ -251,16 +695,21 @@ void loop() {
 
       Serial.printf("%d %d\n%d:%d", fileDuration[0], fileDuration[1], fileMinutes, fileSeconds);
 
-      currentFile = SD_MMC.open(temp, "r");
       currentFileIndex = filepathsIndex;
 
+      xSemaphoreTake(readerMutex, portMAX_DELAY);
+
       isPaused = 0;
 
+      xSemaphoreGive(readerMutex);
+
+      if (audioTaskHandle) xTaskNotifyGive(audioTaskHandle);
+
     }
 
   }
 
-  if(!isPaused){
+  if(!isPaused && library.count){
 
     unsigned long now = millis();
     if (now - lastFrame >= frameDelay) {
@@ -286,7 +735,10 @@ void loop() {
       display.print(timeDisplay);
 
       display.setCursor(textX, 16);
-      display.print(filepaths[filepathsIndex].c_str());
+      display.print(libraryName(library, filepathsIndex));
+
+      drawSpectrum(now);
+
       display.display();
 
       textX--;
@@ -296,5 +748,29 @@ void loop() {
     }
   }
 
+  // New files from tools/send_wav.py show up in the library without a reboot.
+
+  if (transferService(SD_MMC)) {
+
+    scanLibrary(SD_MMC, "/", library);
+
+    alignAllFiles(library, WAV_DATA_ALIGN);
+
+    if (filepathsIndex >= (int)library.count) filepathsIndex = library.count ? library.count - 1 : 0;
+
+  }
+
+  // Fill track cache between frames, one block per pass so buttons and display stay responsive.
+
+  trackCacheService(SD_MMC);
+
+  bool playing = !isPaused && audioPlaying;
+
+  powerUpdate(millis(), playing);
+
+  // Sleep until next frame, or next button poll when nothing is playing. Transfers need serial drained quickly.
+
+  vTaskDelay(pdMS_TO_TICKS(transferActive() ? 1 : playing ? frameDelay : idlePollDelay));
+
 }
 
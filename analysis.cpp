@@ -0,0 +1,252 @@
+#include "analysis.h"
+#include "power.h"
+
+// Work for one range of samples, and its partial result.
+
+struct AnalysisRange {
+
+  fs::FS *fs;
+  const char *path;
+  uint32_t dataOffset;
+  SampleFormat format;
+
+  uint32_t first;
+  uint32_t last;
+  uint32_t totalSamples;
+
+  uint64_t sumSquares;
+  int32_t peak;
+  int16_t overviewMin[ANALYSIS_OVERVIEW_BINS];
+  int16_t overviewMax[ANALYSIS_OVERVIEW_BINS];
+
+  bool ok;
+  SemaphoreHandle_t done;
+
+};
+
+/*
+
+  analyzeRange() - Reads samples first to last of range, accumulating sum of squares, peak and overview.
+
+*/
+
+static void analyzeRange(AnalysisRange &range){
+
+  BlockReader reader;
+  uint8_t *data;
+  size_t n;
+  int16_t converted[CHUNK_SIZE / 2];
+
+  size_t bytesPerSample = range.format.bytesPerSample;
+  uint32_t index = range.first;
+
+  range.sumSquares = 0;
+  range.peak = 0;
+
+  for(int i = 0; i < ANALYSIS_OVERVIEW_BINS; i++){
+
+    range.overviewMin[i] = 0;
+    range.overviewMax[i] = 0;
+
+  }
+
+  range.ok = blockReaderOpen(reader, *range.fs, range.path, range.dataOffset + range.first * bytesPerSample);
+
+  if(!range.ok) return;
+
+  blockReaderSetEnd(reader, range.dataOffset + range.last * bytesPerSample);
+
+  while((n = blockReaderNext(reader, &data, CHUNK_SIZE / 2 * bytesPerSample, bytesPerSample)) > 0){
+
+    size_t sampleCount = n / bytesPerSample;
+    const int16_t *samples = (const int16_t *)data;
+
+    if(range.format.convert){
+
+      range.format.convert(data, converted, sampleCount);
+
+      samples = converted;
+
+    }
+
+    uint64_t sum = 0;
+
+    for(size_t i = 0; i < sampleCount; i++, index++){
+
+      int32_t s = samples[i];
+      int32_t a = s < 0 ? -s : s;
+
+      sum += (uint32_t)(s * s);
+
+      if(a > range.peak) range.peak = a;
+
+      int bin = (uint64_t)index * ANALYSIS_OVERVIEW_BINS / range.totalSamples;
+
+      if(s < range.overviewMin[bin]) range.overviewMin[bin] = s;
+      if(s > range.overviewMax[bin]) range.overviewMax[bin] = s;
+
+    }
+
+    range.sumSquares += sum;
+
+  }
+
+  blockReaderClose(reader);
+
+}
+
+static void analysisTask(void *parameters){
+
+  AnalysisRange *range = (AnalysisRange *)parameters;
+
+  analyzeRange(*range);
+
+  xSemaphoreGive(range->done);
+
+  vTaskDelete(NULL);
+
+}
+
+/*
+
+  analyzeTrack() - Computes RMS, peak and waveform overview of a track.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  TrackAnalysis &result - Filled with results. rms is 0.0 - 1.0 like rootMeanSquare(), rmsDB and peakDB are dBFS.
+  bool parallel - Use both cores if audio is not playing. Pass false to always use one.
+
+  Range state is static to keep it off the caller's stack, so only one analysis may run at a time.
+
+  return - false if file could not be read.
+
+*/
+
+bool analyzeTrack(fs::FS &fs, const char * path, TrackAnalysis &result, bool parallel){
+
+  static AnalysisRange ranges[ANALYSIS_MAX_RANGES];
+
+  MonoWAVHeader header;
+  SampleFormat format;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, path, header, dataOffset) || !selectSampleFormat(header, format)) return false;
+
+  uint32_t total = monoWAVSamples(header);
+
+  if(powerAudioPlaying()) parallel = false;
+
+  int count = parallel && total >= SECTOR_SIZE * ANALYSIS_MAX_RANGES ? ANALYSIS_MAX_RANGES : 1;
+
+  // Split point is moved to a sector boundary so each reader starts aligned.
+
+  uint32_t split = total / count;
+  uint32_t splitByte = (dataOffset + split * format.bytesPerSample) & ~(uint32_t)(SECTOR_SIZE - 1);
+
+  if(count > 1 && splitByte > dataOffset) split = (splitByte - dataOffset) / format.bytesPerSample;
+
+  for(int i = 0; i < count; i++){
+
+    AnalysisRange &range = ranges[i];
+
+    range.fs = &fs;
+    range.path = path;
+    range.dataOffset = dataOffset;
+    range.format = format;
+    range.totalSamples = total ? total : 1;
+    range.first = i == 0 ? 0 : split;
+    range.last = i == count - 1 ? total : split;
+
+  }
+
+  if(count > 1){
+
+    ranges[1].done = xSemaphoreCreateBinary();
+
+    if(!ranges[1].done || xTaskCreatePinnedToCore(analysisTask, "Analysis", 4096, &ranges[1], 1, NULL, 0) != pdPASS){
+
+      if(ranges[1].done) vSemaphoreDelete(ranges[1].done);
+
+      ranges[0].last = total;
+      count = 1;
+
+    }
+
+  }
+
+  analyzeRange(ranges[0]);
+
+  if(count > 1){
+
+    xSemaphoreTake(ranges[1].done, portMAX_DELAY);
+    vSemaphoreDelete(ranges[1].done);
+
+  }
+
+  // Combine in range order.
+
+  result.samples = total;
+  result.sumSquares = 0;
+  result.peak = 0;
+
+  for(int b = 0; b < ANALYSIS_OVERVIEW_BINS; b++){
+
+    result.overviewMin[b] = 0;
+    result.overviewMax[b] = 0;
+
+  }
+
+  for(int i = 0; i < count; i++){
+
+    if(!ranges[i].ok) return false;
+
+    result.sumSquares += ranges[i].sumSquares;
+
+    if(ranges[i].peak > result.peak) result.peak = ranges[i].peak;
+
+    for(int b = 0; b < ANALYSIS_OVERVIEW_BINS; b++){
+
+      if(ranges[i].overviewMin[b] < result.overviewMin[b]) result.overviewMin[b] = ranges[i].overviewMin[b];
+      if(ranges[i].overviewMax[b] > result.overviewMax[b]) result.overviewMax[b] = ranges[i].overviewMax[b];
+
+    }
+
+  }
+
+  result.rms = total ? sqrt((double)result.sumSquares / total) / 32768.0 : 0.0;
+  result.rmsDB = result.rms > 0 ? 20.0 * log10(result.rms) : -96.0;
+  result.peakDB = result.peak > 0 ? 20.0 * log10(result.peak / 32768.0) : -96.0;
+
+  return true;
+
+}
+
+/*
+
+  benchmarkAnalysis() - Times rootMeanSquare() against analyzeTrack() on one and two cores, and prints speedups to serial monitor.
+  Both analyzeTrack() runs use one core while audio is playing.
+
+*/
+
+void benchmarkAnalysis(fs::FS &fs, const char * path){
+
+  static TrackAnalysis result;
+
+  unsigned long start = micros();
+  double rms = rootMeanSquare(fs, path);
+  unsigned long baseline = micros() - start;
+
+  start = micros();
+  analyzeTrack(fs, path, result, false);
+  unsigned long single = micros() - start;
+
+  double singleRMS = result.rms;
+
+  start = micros();
+  analyzeTrack(fs, path, result, true);
+  unsigned long dual = micros() - start;
+
+  Serial.printf("%s: rms %.4f / %.4f / %.4f, peak %.1f dBFS.\n", path, rms, singleRMS, result.rms, result.peakDB);
+  Serial.printf("  rootMeanSquare(): %lu ms\n  analyzeTrack() 1 core: %lu ms (%.2fx)\n  analyzeTrack() 2 cores: %lu ms (%.2fx)\n", baseline / 1000, single / 1000, single ? (double)baseline / single : 0.0, dual / 1000, dual ? (double)baseline / dual : 0.0);
+
+}
@@ -0,0 +1,44 @@
+#ifndef _ANALYSIS_H
+#define _ANALYSIS_H
+
+/*
+
+  Track analysis: RMS, peak, loudness and a waveform overview.
+
+  analyzeTrack() splits a track's data chunk into one sector aligned range per core. The calling task handles
+  the first range and a worker task pinned to the other core handles the second, each with its own reader.
+  Sums of squares are kept as integers and partial results are combined in range order, so the result is
+  identical whether one or two cores are used.
+
+  Core 0 also runs the audio task, so analyzeTrack() stays on the calling core while powerAudioPlaying() is true,
+  whatever the caller asks for.
+
+  ANALYSIS_OVERVIEW_BINS - Number of min / max pairs in overview, one per display column.
+
+*/
+
+#include "mono_file.h"
+#include "sample_format.h"
+
+#define ANALYSIS_OVERVIEW_BINS 128
+#define ANALYSIS_MAX_RANGES 2
+
+struct TrackAnalysis {
+
+  uint32_t samples;
+  uint64_t sumSquares;
+  int32_t peak;
+
+  double rms;
+  double rmsDB;
+  double peakDB;
+
+  int16_t overviewMin[ANALYSIS_OVERVIEW_BINS];
+  int16_t overviewMax[ANALYSIS_OVERVIEW_BINS];
+
+};
+
+bool analyzeTrack(fs::FS &fs, const char * path, TrackAnalysis &result, bool parallel = true);
+void benchmarkAnalysis(fs::FS &fs, const char * path);
+
+#endif
@@ -0,0 +1,268 @@
+#include "audio_arena.h"
+#include "esp_heap_caps.h"
+#include <atomic>
+
+static uint8_t *arena = NULL;
+static size_t arenaSize = 0;
+static size_t arenaUsed = 0;
+static bool sealed = false;
+
+// Permanent buffers, kept for arenaReport().
+
+static const char *bufferNames[ARENA_MAX_BUFFERS];
+static size_t bufferSizes[ARENA_MAX_BUFFERS];
+static int bufferCount = 0;
+
+// Pool blocks. Taken from any task without locking.
+
+static uint8_t *blocks = NULL;
+static int blockCount = 0;
+static std::atomic<bool> blockUsed[ARENA_MAX_BLOCKS];
+static std::atomic<int> blocksInUse(0);
+static std::atomic<int> blocksMax(0);
+static std::atomic<uint32_t> takeFailures(0);
+
+static TaskHandle_t tasks[ARENA_MAX_TASKS];
+static const char *taskNames[ARENA_MAX_TASKS];
+static SemaphoreHandle_t taskMutex = NULL;
+
+/*
+
+  arenaInit() - Allocates the arena. Call once, first thing in setup().
+
+  size_t bytes - Arena size. Must cover all arenaAlloc() calls plus at least one pool block.
+
+  return - false if arena could not be allocated.
+
+*/
+
+bool arenaInit(size_t bytes){
+
+  arena = (uint8_t *)heap_caps_malloc(bytes, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+  taskMutex = xSemaphoreCreateMutex();
+
+  if(!arena || !taskMutex){
+
+    Serial.println("Audio arena could not be allocated.");
+
+    return false;
+
+  }
+
+  arenaSize = bytes;
+  arenaUsed = 0;
+  sealed = false;
+
+  return true;
+
+}
+
+/*
+
+  arenaAlloc() - Takes a permanent buffer from the arena. Only works before arenaSeal().
+
+  size_t bytes - Size of buffer. Rounded up to 4 bytes so every buffer stays word aligned for DMA.
+  const char * name - Name shown by arenaReport(). Must be a string literal.
+
+  return - Buffer, or NULL if arena is full or sealed.
+
+*/
+
+void *arenaAlloc(size_t bytes, const char * name){
+
+  bytes = (bytes + 3) & ~(size_t)3;
+
+  if(!arena || sealed || arenaUsed + bytes > arenaSize || bufferCount >= ARENA_MAX_BUFFERS){
+
+    Serial.printf("Audio arena: no room for %s (%u bytes).\n", name, bytes);
+
+    return NULL;
+
+  }
+
+  void *buffer = arena + arenaUsed;
+
+  arenaUsed += bytes;
+
+  bufferNames[bufferCount] = name;
+  bufferSizes[bufferCount++] = bytes;
+
+  return buffer;
+
+}
+
+// arenaSeal() - Ends permanent allocation and splits the rest of the arena into pool blocks.
+
+void arenaSeal(){
+
+  if(!arena || sealed) return;
+
+  sealed = true;
+  blocks = arena + arenaUsed;
+  blockCount = (arenaSize - arenaUsed) / ARENA_BLOCK_BYTES;
+
+  if(blockCount > ARENA_MAX_BLOCKS) blockCount = ARENA_MAX_BLOCKS;
+
+  for(int i = 0; i < blockCount; i++) blockUsed[i] = false;
+
+  if(blockCount == 0) Serial.println("Audio arena: no room left for pool blocks.");
+
+}
+
+// Returns a free pool block of ARENA_BLOCK_BYTES, or NULL if all are in use.
+
+uint8_t *arenaTakeBlock(){
+
+  for(int i = 0; i < blockCount; i++){
+
+    bool expected = false;
+
+    if(blockUsed[i].compare_exchange_strong(expected, true)){
+
+      int inUse = ++blocksInUse;
+      int max = blocksMax.load();
+
+      while(inUse > max && !blocksMax.compare_exchange_weak(max, inUse));
+
+      return blocks + i * ARENA_BLOCK_BYTES;
+
+    }
+
+  }
+
+  takeFailures++;
+
+  return NULL;
+
+}
+
+void arenaGiveBlock(uint8_t *block){
+
+  if(!block) return;
+
+  int i = (block - blocks) / ARENA_BLOCK_BYTES;
+
+  if(i < 0 || i >= blockCount || block != blocks + i * ARENA_BLOCK_BYTES){
+
+    Serial.println("Audio arena: block given back was not taken from the pool.");
+
+    return;
+
+  }
+
+  blockUsed[i] = false;
+  blocksInUse--;
+
+}
+
+/*
+
+  arenaTakeBuffer() - Takes a buffer for one recording or measurement, i.e. a ring that holds seconds of audio. Comes
+  from PSRAM when the board has it, otherwise from a pool block, so internal RAM is never taken from the heap while
+  running. Give back with arenaGiveBuffer().
+
+  size_t &bytes - Size wanted from PSRAM. Set to the size taken.
+  size_t fallbackBytes - Size to take from a pool block instead, at most ARENA_BLOCK_BYTES.
+
+  return - Buffer, or NULL if neither had room.
+
+*/
+
+void *arenaTakeBuffer(size_t &bytes, size_t fallbackBytes){
+
+  void *buffer = psramFound() ? heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : NULL;
+
+  if(!buffer && fallbackBytes <= ARENA_BLOCK_BYTES){
+
+    buffer = arenaTakeBlock();
+    bytes = fallbackBytes;
+
+  }
+
+  return buffer;
+
+}
+
+// Gives back a buffer from arenaTakeBuffer(), to the pool or to PSRAM.
+
+void arenaGiveBuffer(void *buffer){
+
+  uint8_t *p = (uint8_t *)buffer;
+
+  if(!p) return;
+
+  if(p >= blocks && p < blocks + blockCount * ARENA_BLOCK_BYTES) arenaGiveBlock(p);
+  else heap_caps_free(p);
+
+}
+
+// arenaWatchTask() - Adds a task to stack reports. Tasks that delete themselves must call arenaUnwatchTask() first.
+
+void arenaWatchTask(TaskHandle_t task, const char * name){
+
+  if(!task || !taskMutex) return;
+
+  xSemaphoreTake(taskMutex, portMAX_DELAY);
+
+  for(int i = 0; i < ARENA_MAX_TASKS; i++){
+
+    if(!tasks[i]){
+
+      tasks[i] = task;
+      taskNames[i] = name;
+
+      break;
+
+    }
+
+  }
+
+  xSemaphoreGive(taskMutex);
+
+}
+
+void arenaUnwatchTask(TaskHandle_t task){
+
+  if(!taskMutex) return;
+
+  xSemaphoreTake(taskMutex, portMAX_DELAY);
+
+  for(int i = 0; i < ARENA_MAX_TASKS; i++) if(tasks[i] == task) tasks[i] = NULL;
+
+  xSemaphoreGive(taskMutex);
+
+}
+
+// Prints arena use, pool high-water mark, stack headroom of watched tasks and internal heap state.
+
+void arenaReport(){
+
+  if(!arena){
+
+    Serial.println("Audio arena not allocated.");
+
+    return;
+
+  }
+
+  Serial.printf("Audio arena: %u/%u bytes permanent, %d pool blocks of %u bytes, %d in use, %d max, %u failed takes.\n",
+                arenaUsed, arenaSize, blockCount, ARENA_BLOCK_BYTES, blocksInUse.load(), blocksMax.load(), takeFailures.load());
+
+  for(int i = 0; i < bufferCount; i++) Serial.printf("  %s: %u bytes\n", bufferNames[i], bufferSizes[i]);
+
+  xSemaphoreTake(taskMutex, portMAX_DELAY);
+
+  // High-water mark is the least free stack the task has had, in bytes on ESP32.
+
+  for(int i = 0; i < ARENA_MAX_TASKS; i++){
+
+    if(tasks[i]) Serial.printf("  %s stack: %u bytes never used\n", taskNames[i], uxTaskGetStackHighWaterMark(tasks[i]));
+
+  }
+
+  xSemaphoreGive(taskMutex);
+
+  Serial.printf("Internal heap: %u free, %u lowest, %u largest block.\n", heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+
+}
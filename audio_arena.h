@@ -0,0 +1,51 @@
+#ifndef _AUDIO_ARENA_H
+#define _AUDIO_ARENA_H
+
+/*
+
+  Audio buffer arena.
+
+  Every audio and I/O buffer comes from one fixed size region of internal RAM, allocated once by arenaInit() at
+  startup. No sample buffer comes from the heap after that, so long runs can not fragment memory with them. File
+  handles are the exception: fs.open() allocates one whenever a track or segment source is opened.
+
+  The region has two parts:
+
+    Permanent buffers - Taken with arenaAlloc() during setup(), i.e. the playback read buffer or record() capture
+    buffers. Never freed.
+    Block pool - Whatever is left when arenaSeal() is called, split into ARENA_BLOCK_BYTES blocks. Taken and given
+    back with arenaTakeBlock() and arenaGiveBlock() by short lived users, i.e. BlockReaders opened without a buffer,
+    or file alignment and transfers. Taking a block never waits, it returns NULL if all blocks are in use.
+
+  Buffers for one recording or measurement, which want seconds of audio, come from arenaTakeBuffer(). That takes them
+  from PSRAM, or from a pool block on boards without it, where they hold less.
+
+  Tasks registered with arenaWatchTask() have their stack high-water marks printed by arenaReport(), next to
+  arena use, so stack sizes can be set from measurements.
+
+  ARENA_BYTES - Size of arena.
+  ARENA_BLOCK_BYTES - Size of a pool block. Holds a BlockReader buffer with READ_POOL_BLOCK_SIZE blocks.
+
+*/
+
+#include "sd_read_write.h"
+
+#define ARENA_BYTES (96 * 1024)
+#define READ_POOL_BLOCK_SIZE (16 * 1024)
+#define ARENA_BLOCK_BYTES READ_BUFFER_BYTES(READ_POOL_BLOCK_SIZE)
+#define ARENA_MAX_BLOCKS 8
+#define ARENA_MAX_BUFFERS 8
+#define ARENA_MAX_TASKS 8
+
+bool arenaInit(size_t bytes = ARENA_BYTES);
+void *arenaAlloc(size_t bytes, const char * name);
+void arenaSeal();
+uint8_t *arenaTakeBlock();
+void arenaGiveBlock(uint8_t *block);
+void *arenaTakeBuffer(size_t &bytes, size_t fallbackBytes);
+void arenaGiveBuffer(void *buffer);
+void arenaWatchTask(TaskHandle_t task, const char * name);
+void arenaUnwatchTask(TaskHandle_t task);
+void arenaReport();
+
+#endif
@@ -0,0 +1,196 @@
+#include "audio_sink.h"
+#include "mono_file.h"
+
+// sinkInitI2S() - Sink that writes to I2S port, blocking until DMA has room.
+
+void sinkInitI2S(AudioSink &sink, i2s_port_t port){
+
+  sink.type = SINK_I2S;
+  sink.port = port;
+  sink.bytesWritten = 0;
+
+}
+
+/*
+
+  sinkOpenWAVFile() - Sink that writes to a new mono 16 bit WAV file. Existing file at path is replaced.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  uint32_t sample_rate - Sample rate written to header.
+
+  return - true if file was created.
+
+*/
+
+bool sinkOpenWAVFile(AudioSink &sink, fs::FS &fs, const char * path, uint32_t sample_rate){
+
+  sink.type = SINK_WAV_FILE;
+  sink.fs = &fs;
+  sink.path = path;
+  sink.sampleRate = sample_rate;
+  sink.bytesWritten = 0;
+
+  createMonoWAVFile(fs, path, 0, sample_rate, 16);
+
+  sink.file = fs.open(path, FILE_APPEND);
+
+  if(!sink.file){
+
+    Serial.printf("%s could not be opened.\n", path);
+
+    return false;
+
+  }
+
+  return true;
+
+}
+
+// sinkInitMemory() - Sink that writes to memory. bytesWritten keeps counting past memorySize so overflow can be detected.
+
+void sinkInitMemory(AudioSink &sink, uint8_t *memory, size_t memorySize){
+
+  sink.type = SINK_MEMORY;
+  sink.memory = memory;
+  sink.memorySize = memorySize;
+  sink.bytesWritten = 0;
+
+}
+
+/*
+
+  sinkOpenCompare() - Sink that compares written samples against the data chunk of a golden WAV file.
+
+  Results are in mismatches and maxError. Golden data that is longer or shorter than what was written counts as mismatches.
+
+*/
+
+bool sinkOpenCompare(AudioSink &sink, fs::FS &fs, const char * goldenPath){
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  sink.type = SINK_COMPARE;
+  sink.bytesWritten = 0;
+  sink.mismatches = 0;
+  sink.maxError = 0;
+
+  if(!readMonoWAVHeader(fs, goldenPath, header, dataOffset)) return false;
+
+  if(!blockReaderOpen(sink.golden, fs, goldenPath, dataOffset)) return false;
+
+  blockReaderSetEnd(sink.golden, dataOffset + header.subchunk2_size);
+
+  return true;
+
+}
+
+/*
+
+  sinkWrite() - Writes 16 bit samples to sink.
+
+  return - Bytes accepted. Always equal to bytes unless an I2S or file write fails.
+
+*/
+
+size_t sinkWrite(AudioSink &sink, const uint8_t *data, size_t bytes){
+
+  size_t written = 0;
+
+  switch(sink.type){
+
+    case SINK_I2S:
+
+      i2s_write(sink.port, data, bytes, &written, portMAX_DELAY);
+
+      break;
+
+    case SINK_WAV_FILE:
+
+      written = sink.file.write(data, bytes);
+
+      break;
+
+    case SINK_MEMORY:
+
+      if(sink.bytesWritten < sink.memorySize){
+
+        size_t room = sink.memorySize - sink.bytesWritten;
+
+        memcpy(sink.memory + sink.bytesWritten, data, bytes < room ? bytes : room);
+
+      }
+
+      written = bytes;
+
+      break;
+
+    case SINK_COMPARE: {
+
+      const int16_t *samples = (const int16_t *)data;
+      size_t sampleCount = bytes / sizeof(int16_t);
+      size_t i = 0;
+      uint8_t *view;
+      size_t n;
+
+      while(i < sampleCount && (n = blockReaderNext(sink.golden, &view, (sampleCount - i) * sizeof(int16_t))) > 0){
+
+        const int16_t *expected = (const int16_t *)view;
+
+        for(size_t j = 0; j < n / sizeof(int16_t); j++, i++){
+
+          int32_t error = abs((int32_t)samples[i] - expected[j]);
+
+          if(error){
+
+            sink.mismatches++;
+
+            if(error > sink.maxError) sink.maxError = error;
+
+          }
+
+        }
+
+      }
+
+      sink.mismatches += sampleCount - i;
+
+      written = bytes;
+
+      break;
+
+    }
+
+  }
+
+  sink.bytesWritten += written;
+
+  return written;
+
+}
+
+// sinkClose() - Finalizes WAV header for file sinks, and counts leftover golden samples for compare sinks.
+
+void sinkClose(AudioSink &sink){
+
+  if(sink.type == SINK_WAV_FILE){
+
+    sink.file.close();
+
+    editMonoWAVHeader(*sink.fs, sink.path, sink.bytesWritten / sizeof(int16_t), sink.sampleRate, 16);
+
+  }
+
+  if(sink.type == SINK_COMPARE){
+
+    uint8_t *view;
+    size_t n;
+
+    while((n = blockReaderNext(sink.golden, &view, READ_BLOCK_SIZE)) > 0) sink.mismatches += n / sizeof(int16_t);
+
+    blockReaderClose(sink.golden);
+
+  }
+
+}
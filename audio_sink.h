@@ -0,0 +1,60 @@
+#ifndef _AUDIO_SINK_H
+#define _AUDIO_SINK_H
+
+/*
+
+  Output sinks for processed audio.
+
+  Playback code writes samples to an AudioSink instead of calling i2s_write() directly, so the same processing
+  chain can run without I2S hardware. SINK_I2S blocks on the DMA like before. The other sinks run as fast as
+  the CPU and card allow, which is used for offline renders, throughput numbers, and regression checks.
+
+    SINK_I2S - Writes to an I2S port.
+    SINK_WAV_FILE - Writes to a mono 16 bit WAV file. Header is finalized in sinkClose().
+    SINK_MEMORY - Writes to a caller supplied buffer. Data past the end of the buffer is counted but dropped.
+    SINK_COMPARE - Compares written data against a golden WAV file and counts mismatching samples.
+
+*/
+
+#include "sd_read_write.h"
+#include "driver/i2s.h"
+
+typedef enum{
+
+  SINK_I2S,
+  SINK_WAV_FILE,
+  SINK_MEMORY,
+  SINK_COMPARE
+
+} sinkType;
+
+struct AudioSink {
+
+  sinkType type;
+
+  i2s_port_t port;
+
+  fs::FS *fs;
+  const char *path;
+  File file;
+  uint32_t sampleRate;
+
+  uint8_t *memory;
+  size_t memorySize;
+
+  BlockReader golden;
+  uint32_t mismatches;
+  int32_t maxError;
+
+  uint32_t bytesWritten;
+
+};
+
+void sinkInitI2S(AudioSink &sink, i2s_port_t port);
+bool sinkOpenWAVFile(AudioSink &sink, fs::FS &fs, const char * path, uint32_t sample_rate);
+void sinkInitMemory(AudioSink &sink, uint8_t *memory, size_t memorySize);
+bool sinkOpenCompare(AudioSink &sink, fs::FS &fs, const char * goldenPath);
+size_t sinkWrite(AudioSink &sink, const uint8_t *data, size_t bytes);
+void sinkClose(AudioSink &sink);
+
+#endif
@@ -5,6 +5,7 @@ static uint32_t lastChangeTime = 0;
 static const uint32_t DEBOUNCE_MILLIS = 50;
 static bool waitingForRelease = false;
 static buttonType buttonDownType = NO_PRESS;
+static uint32_t buttonDownTime = 0;
 
 /*
 
@@ -78,6 +79,7 @@ buttonReturn getButtonEvent(){
         if(!waitingForRelease){
 
           buttonDownType = current;
+          buttonDownTime = now;
           waitingForRelease = true;
 
         }
@@ -88,7 +90,7 @@ buttonReturn getButtonEvent(){
 
         if(waitingForRelease){
 
-          returnButton.event = SINGLE_PRESS;
+          returnButton.event = now - buttonDownTime >= LONG_PRESS_MILLIS ? LONG_PRESS : SINGLE_PRESS;
           returnButton.type = buttonDownType;
 
           waitingForRelease = false;
@@ -15,7 +15,7 @@
 
   buttonReturn struct contains:
 
-    buttonEvent - Button state.
+    buttonEvent - Button state. A press held for LONG_PRESS_MILLIS or more is a LONG_PRESS, reported on release.
     buttonType - BUtton type.
 
 */
@@ -28,11 +28,13 @@
 #define MAX_VOLTAGE 4095
 #define VOLTAGE_RANGE 80
 #define ADC_SAMPLES 5
+#define LONG_PRESS_MILLIS 800
 
 typedef enum{
 
   NO_EVENT,
-  SINGLE_PRESS
+  SINGLE_PRESS,
+  LONG_PRESS
 
 } buttonEvent;
 
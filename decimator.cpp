@@ -0,0 +1,154 @@
+#include "decimator.h"
+
+/*
+
+  decimatorCaptureRate() - Returns capture rate to use for a recording rate, 44100 or 48000.
+
+  uint32_t sample_rate - Rate of the recorded file, i.e. 8000.
+
+  return - Capture rate, or 0 if sample_rate needs a factor above DECIMATE_MAX_FACTOR or does not divide either rate.
+
+*/
+
+uint32_t decimatorCaptureRate(uint32_t sample_rate){
+
+  if(sample_rate == 0) return 0;
+
+  if(44100 % sample_rate == 0 && 44100 / sample_rate <= DECIMATE_MAX_FACTOR) return 44100;
+  if(48000 % sample_rate == 0 && 48000 / sample_rate <= DECIMATE_MAX_FACTOR) return 48000;
+
+  return 0;
+
+}
+
+/*
+
+  decimatorInit() - Designs filter for a rate pair and clears its state.
+
+  Decimator &decimator - Filter to set up.
+  uint32_t captureRate - Input rate, from decimatorCaptureRate().
+  uint32_t sample_rate - Output rate.
+
+  return - false if captureRate is not a supported multiple of sample_rate.
+
+*/
+
+bool decimatorInit(Decimator &decimator, uint32_t captureRate, uint32_t sample_rate){
+
+  if(sample_rate == 0 || captureRate % sample_rate != 0 || captureRate / sample_rate > DECIMATE_MAX_FACTOR) return false;
+
+  decimator.factor = captureRate / sample_rate;
+  decimator.taps = decimator.factor == 1 ? 1 : DECIMATE_TAPS_PER_PHASE * decimator.factor;
+  decimator.pos = 0;
+  decimator.phase = 0;
+  decimator.inputSamples = 0;
+  decimator.cycles = 0;
+
+  memset(decimator.history, 0, sizeof(decimator.history));
+
+  // Blackman windowed sinc, cut off at 90% of output Nyquist.
+
+  int taps = decimator.taps;
+  double cutoff = 0.45 / decimator.factor;
+  double window[DECIMATE_MAX_TAPS];
+  double sum = 0;
+
+  for(int i = 0; i < taps; i++){
+
+    double x = i - (taps - 1) / 2.0;
+    double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+    double blackman = taps == 1 ? 1 : 0.42 - 0.5 * cos(2 * M_PI * i / (taps - 1)) + 0.08 * cos(4 * M_PI * i / (taps - 1));
+
+    window[i] = sinc * blackman;
+    sum += window[i];
+
+  }
+
+  // Rounding error goes into the middle tap so coefficients sum to exactly 32768.
+
+  int32_t total = 0;
+
+  for(int i = 0; i < taps; i++){
+
+    decimator.coeffs[i] = (int16_t)lround(window[i] / sum * 32767);
+    total += decimator.coeffs[i];
+
+  }
+
+  if(taps > 1) decimator.coeffs[taps / 2] += 32768 - total;
+  else decimator.coeffs[0] = 32767;
+
+  return true;
+
+}
+
+/*
+
+  decimatorProcess() - Filters and decimates a block. State carries over between blocks, so block sizes need not
+  be multiples of factor.
+
+  const int16_t *in - Samples at capture rate.
+  int16_t *out - Samples at output rate, at most sampleCount / factor + 1. May be the same buffer as in.
+  size_t sampleCount - Number of input samples.
+
+  return - Number of output samples.
+
+*/
+
+size_t decimatorProcess(Decimator &decimator, const int16_t *in, int16_t *out, size_t sampleCount){
+
+  uint32_t start = ESP.getCycleCount();
+  size_t n = 0;
+
+  if(decimator.factor == 1){
+
+    if(out != in) memcpy(out, in, sampleCount * sizeof(int16_t));
+
+    n = sampleCount;
+
+  }
+
+  else{
+
+    int taps = decimator.taps;
+
+    for(size_t i = 0; i < sampleCount; i++){
+
+      decimator.history[decimator.pos] = in[i];
+      decimator.history[decimator.pos + taps] = in[i];
+
+      if(++decimator.pos == taps) decimator.pos = 0;
+
+      if(++decimator.phase < decimator.factor) continue;
+
+      decimator.phase = 0;
+
+      // Window starts at oldest sample, which is where the next sample will be written.
+
+      const int16_t *x = decimator.history + decimator.pos;
+      int32_t acc = 1 << 14;
+
+      for(int k = 0; k < taps; k++) acc += (int32_t)decimator.coeffs[k] * x[k];
+
+      acc >>= 15;
+
+      out[n++] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+
+    }
+
+  }
+
+  decimator.cycles += ESP.getCycleCount() - start;
+  decimator.inputSamples += sampleCount;
+
+  return n;
+
+}
+
+// Returns average filter cost so far, in CPU cycles per input sample.
+
+double decimatorCyclesPerSample(const Decimator &decimator){
+
+  return decimator.inputSamples ? (double)decimator.cycles / decimator.inputSamples : 0;
+
+}
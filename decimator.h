@@ -0,0 +1,52 @@
+#ifndef _DECIMATOR_H
+#define _DECIMATOR_H
+
+/*
+
+  Decimating FIR filter for recording at reduced sample rates.
+
+  Lower rates are made by capturing at a multiple of the target rate and keeping every factor-th sample of a
+  low-pass filtered stream. Capture runs at 44.1kHz when that divides evenly, otherwise at 48kHz:
+
+    22.05kHz - 44.1kHz / 2
+    16kHz - 48kHz / 3
+    8kHz - 48kHz / 6
+
+  The filter is a windowed-sinc low pass with DECIMATE_TAPS_PER_PHASE * factor taps, cut off just below the new
+  Nyquist frequency. Coefficients are Q15 and sum to exactly 1.0, so DC gain is unity. Only kept samples are
+  computed, so the cost per input sample is DECIMATE_TAPS_PER_PHASE multiply-adds for every factor.
+
+  Taps per phase set the transition band, which is only 10% of the new Nyquist wide. At 24 taps, anything that would
+  alias below 90% of the new Nyquist is at least 53dB down, and the passband is within 1dB up to 80% of it. 8 taps
+  gave only 13dB there and 16 gave 28dB. 32 would give about 66dB for a third more cycles.
+
+  The delay line is stored twice back to back, so each output is one straight dot product with no wrap checks.
+
+*/
+
+#include <Arduino.h>
+
+#define DECIMATE_MAX_FACTOR 6
+#define DECIMATE_TAPS_PER_PHASE 24
+#define DECIMATE_MAX_TAPS (DECIMATE_MAX_FACTOR * DECIMATE_TAPS_PER_PHASE)
+
+struct Decimator {
+
+  uint8_t factor;
+  uint16_t taps;
+  int16_t coeffs[DECIMATE_MAX_TAPS];
+  int16_t history[2 * DECIMATE_MAX_TAPS];
+  uint16_t pos;
+  uint8_t phase;
+
+  uint32_t inputSamples;
+  uint64_t cycles;
+
+};
+
+uint32_t decimatorCaptureRate(uint32_t sample_rate);
+bool decimatorInit(Decimator &decimator, uint32_t captureRate, uint32_t sample_rate);
+size_t decimatorProcess(Decimator &decimator, const int16_t *in, int16_t *out, size_t sampleCount);
+double decimatorCyclesPerSample(const Decimator &decimator);
+
+#endif
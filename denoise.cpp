@@ -0,0 +1,320 @@
+#include "denoise.h"
+#include "fft.h"
+
+/*
+
+  denoiseInit() - Builds tables and clears state for a new recording.
+
+  NoiseReducer &reducer - Reducer to set up. About 5KB, so callers keep it static rather than on the stack.
+  uint32_t sample_rate - Rate of the audio passed in.
+  float strength - Over-subtraction factor. 0 leaves the spectrum alone.
+  bool gate - Enables the noise gate.
+  uint32_t learnMs - Length of noise profile taken from the start of the recording.
+
+*/
+
+void denoiseInit(NoiseReducer &reducer, uint32_t sample_rate, float strength, bool gate, uint32_t learnMs){
+
+  const int size = DENOISE_FFT_SIZE;
+
+  fftTables(reducer.cosTable, reducer.sinTable, size);
+
+  // Periodic Hann, so frames half a window apart add back up to exactly 1.
+
+  for(int i = 0; i < size; i++) reducer.window[i] = (int16_t)lround((0.5 - 0.5 * cos(2.0 * M_PI * i / size)) * 32767);
+
+  // Gain for a bin whose power is d / 8 octaves over the noise profile.
+
+  double floorGain = pow(10.0, DENOISE_FLOOR_DB / 20.0);
+
+  for(int d = 0; d < DENOISE_TABLE; d++){
+
+    double g = 1.0 - strength * pow(2.0, -d / 8.0);
+
+    reducer.gainTable[d] = (int16_t)lround((g > floorGain * floorGain ? sqrt(g) : floorGain) * 32767);
+
+  }
+
+  memset(reducer.frame, 0, sizeof(reducer.frame));
+  memset(reducer.overlap, 0, sizeof(reducer.overlap));
+  memset(reducer.noiseLog, 0, sizeof(reducer.noiseLog));
+  reducer.noiseTotal = 0;
+
+  for(int k = 0; k < DENOISE_BINS; k++) reducer.gains[k] = 32767;
+
+  // First hop of the first frame is silence, and its output is dropped, so output lines up with input.
+
+  reducer.fill = DENOISE_HOP;
+  reducer.skip = DENOISE_HOP;
+
+  uint32_t blocksPerSecond = sample_rate / DENOISE_HOP;
+
+  reducer.learnFrames = learnMs * blocksPerSecond / 1000;
+  if(reducer.learnFrames == 0) reducer.learnFrames = 1;
+  reducer.learned = 0;
+
+  // Gate closes over about 50ms once hold runs out.
+
+  uint32_t releaseFrames = blocksPerSecond / 20 + 1;
+
+  reducer.gateEnabled = gate;
+  reducer.gate = 32767;
+  reducer.gateFloor = (int16_t)lround(pow(10.0, DENOISE_GATE_FLOOR_DB / 20.0) * 32767);
+  reducer.gateRelease = (int16_t)lround(pow(10.0, DENOISE_GATE_FLOOR_DB / 20.0 / releaseFrames) * 32767);
+  reducer.gateThreshold = (int)lround(DENOISE_GATE_DB * 8 / 3.0103);
+  reducer.gateHold = DENOISE_GATE_HOLD_MS * blocksPerSecond / 1000;
+  reducer.holdLeft = 0;
+
+  reducer.samplesIn = 0;
+  reducer.samplesOut = 0;
+  reducer.sampleRate = sample_rate;
+  reducer.frames = 0;
+  reducer.gatedFrames = 0;
+  reducer.cycles = 0;
+  reducer.maxCycles = 0;
+
+}
+
+// Runs one full frame and hands out the next DENOISE_HOP samples of output.
+
+static void processFrame(NoiseReducer &reducer, int16_t *out, size_t &n){
+
+  uint32_t start = ESP.getCycleCount();
+
+  const int size = DENOISE_FFT_SIZE;
+  const int half = size / 2;
+
+  // Window, then scale so the largest value is under 2^14. re holds x * window * 2^exponent.
+
+  int32_t peak = 0;
+
+  for(int i = 0; i < size; i++){
+
+    int32_t v = abs((int32_t)reducer.frame[i] * reducer.window[i]);
+
+    if(v > peak) peak = v;
+
+  }
+
+  int shift = 0;
+
+  while((peak >> shift) >= (1 << 14)) shift++;
+
+  for(int i = 0; i < size; i++){
+
+    reducer.re[i] = ((int32_t)reducer.frame[i] * reducer.window[i] + (1 << shift >> 1)) >> shift;
+    reducer.im[i] = 0;
+
+  }
+
+  int exponent = 15 - shift;
+  int forward = fftQ15(reducer.re, reducer.im, size, reducer.cosTable, reducer.sinTable, FFT_BLOCK_FLOAT);
+
+  // Bin levels as log2 of true power in 1/8 steps, comparable between frames whatever their scaling.
+
+  int levelOffset = 16 * (exponent - forward);
+  bool learning = reducer.learned < reducer.learnFrames;
+  uint64_t total = 0;
+
+  for(int k = 0; k <= half; k++){
+
+    uint32_t power = (uint32_t)((int32_t)reducer.re[k] * reducer.re[k]) + (uint32_t)((int32_t)reducer.im[k] * reducer.im[k]);
+    int32_t level = log2x8(power) - levelOffset;
+
+    total += power;
+
+    if(learning){
+
+      reducer.noiseLog[k] += level;
+
+      continue;
+
+    }
+
+    int32_t d = level - reducer.noiseLog[k];
+
+    if(d < -DENOISE_TABLE) d = -DENOISE_TABLE;
+    if(d > DENOISE_TABLE) d = DENOISE_TABLE;
+
+    int16_t g = d < 0 ? reducer.gainTable[0] : d >= DENOISE_TABLE ? 32767 : reducer.gainTable[d];
+
+    if(g < reducer.gains[k]) g = ((int32_t)g + reducer.gains[k]) >> 1;
+
+    reducer.gains[k] = g;
+
+  }
+
+  if(learning && ++reducer.learned == reducer.learnFrames){
+
+    double noisePower = 0;
+
+    for(int k = 0; k <= half; k++){
+
+      reducer.noiseLog[k] = reducer.noiseLog[k] / (int32_t)reducer.learned + DENOISE_LOG_BIAS;
+
+      noisePower += pow(2.0, reducer.noiseLog[k] / 8.0);
+
+    }
+
+    reducer.noiseTotal = (int32_t)lround(8 * log2(noisePower));
+
+  }
+
+  if(!learning){
+
+    if(reducer.gateEnabled){
+
+      if(log2x8(total) - levelOffset - reducer.noiseTotal >= reducer.gateThreshold){
+
+        reducer.gate = 32767;
+        reducer.holdLeft = reducer.gateHold;
+
+      }
+
+      else if(reducer.holdLeft) reducer.holdLeft--;
+
+      else{
+
+        int16_t g = ((int32_t)reducer.gate * reducer.gateRelease) >> 15;
+
+        reducer.gate = g > reducer.gateFloor ? g : reducer.gateFloor;
+        reducer.gatedFrames++;
+
+      }
+
+    }
+
+    // Gains are symmetric, so the inverse transform stays real.
+
+    for(int k = 0; k <= half; k++){
+
+      int32_t g = ((int32_t)reducer.gains[k] * reducer.gate) >> 15;
+
+      reducer.re[k] = (reducer.re[k] * g + (1 << 14)) >> 15;
+      reducer.im[k] = (reducer.im[k] * g + (1 << 14)) >> 15;
+
+      if(k > 0 && k < half){
+
+        reducer.re[size - k] = (reducer.re[size - k] * g + (1 << 14)) >> 15;
+        reducer.im[size - k] = (reducer.im[size - k] * g + (1 << 14)) >> 15;
+
+      }
+
+    }
+
+  }
+
+  int inverse = fftQ15(reducer.re, reducer.im, size, reducer.cosTable, reducer.sinTable, FFT_BLOCK_FLOAT | FFT_INVERSE);
+
+  // Inverse without 1/N gives N * x * window * 2^(exponent - forward - inverse).
+
+  int back = forward + inverse - exponent - DENOISE_FFT_BITS;
+
+  for(int i = 0; i < size; i++){
+
+    int32_t v = back >= 0 ? (int32_t)reducer.re[i] << back : ((int32_t)reducer.re[i] + (1 << (-back - 1))) >> -back;
+
+    reducer.overlap[i] += v;
+
+  }
+
+  for(int i = 0; i < DENOISE_HOP; i++){
+
+    int32_t v = reducer.overlap[i];
+
+    if(v > 32767) v = 32767;
+    if(v < -32768) v = -32768;
+
+    if(reducer.skip) reducer.skip--;
+
+    else if(reducer.samplesOut < reducer.samplesIn){
+
+      out[n++] = v;
+      reducer.samplesOut++;
+
+    }
+
+  }
+
+  memmove(reducer.overlap, reducer.overlap + DENOISE_HOP, (size - DENOISE_HOP) * sizeof(int32_t));
+  memset(reducer.overlap + size - DENOISE_HOP, 0, DENOISE_HOP * sizeof(int32_t));
+
+  memmove(reducer.frame, reducer.frame + DENOISE_HOP, (size - DENOISE_HOP) * sizeof(int16_t));
+  reducer.fill = size - DENOISE_HOP;
+
+  uint32_t cycles = ESP.getCycleCount() - start;
+
+  reducer.frames++;
+  reducer.cycles += cycles;
+  if(cycles > reducer.maxCycles) reducer.maxCycles = cycles;
+
+}
+
+/*
+
+  denoiseProcess() - Cleans a block of samples. Output lags input by up to DENOISE_FFT_SIZE samples, which
+  denoiseFinish() hands out at the end.
+
+  NoiseReducer &reducer - Reducer from denoiseInit().
+  const int16_t *in - Samples to clean.
+  int16_t *out - Cleaned samples. Must hold sampleCount + DENOISE_HOP samples, and may not be the same buffer as in.
+  size_t sampleCount - Number of input samples.
+
+  return - Number of samples written to out.
+
+*/
+
+size_t denoiseProcess(NoiseReducer &reducer, const int16_t *in, int16_t *out, size_t sampleCount){
+
+  size_t n = 0;
+
+  for(size_t i = 0; i < sampleCount; i++){
+
+    reducer.frame[reducer.fill++] = in[i];
+    reducer.samplesIn++;
+
+    if(reducer.fill == DENOISE_FFT_SIZE) processFrame(reducer, out, n);
+
+  }
+
+  return n;
+
+}
+
+/*
+
+  denoiseFinish() - Flushes samples still held in the reducer at the end of a recording.
+
+  int16_t *out - Must hold DENOISE_FFT_SIZE samples.
+
+  return - Number of samples written to out.
+
+*/
+
+size_t denoiseFinish(NoiseReducer &reducer, int16_t *out){
+
+  size_t n = 0;
+
+  while(reducer.samplesOut < reducer.samplesIn){
+
+    while(reducer.fill < DENOISE_FFT_SIZE) reducer.frame[reducer.fill++] = 0;
+
+    processFrame(reducer, out, n);
+
+  }
+
+  return n;
+
+}
+
+// Prints cycles per block and share of the real-time budget to serial monitor.
+
+void denoiseReport(const NoiseReducer &reducer){
+
+  double average = reducer.frames ? (double)reducer.cycles / reducer.frames : 0;
+  double budget = reducer.sampleRate ? (double)ESP.getCpuFreqMHz() * 1000000.0 * DENOISE_HOP / reducer.sampleRate : 0;
+
+  Serial.printf("Noise reduction: %u blocks of %d samples, %.0f avg / %u max cycles per block, %.1f%% of real time at %u MHz. Noise profile from %u blocks, %u blocks gated.\n",
+                reducer.frames, DENOISE_HOP, average, reducer.maxCycles, budget ? average * 100 / budget : 0.0, ESP.getCpuFreqMHz(), reducer.learned, reducer.gatedFrames);
+
+}
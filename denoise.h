@@ -0,0 +1,90 @@
+#ifndef _DENOISE_H
+#define _DENOISE_H
+
+/*
+
+  Streaming noise reduction for recordings, spectral subtraction followed by a noise gate.
+
+  Audio is cut into DENOISE_FFT_SIZE frames every DENOISE_HOP samples, windowed with a periodic Hann window, and run
+  through a fixed point FFT. Each bin is scaled by a gain picked from its power over the noise profile, then frames
+  are put back together with an inverse FFT and overlap-add. Output is the input delayed by DENOISE_HOP samples,
+  which denoiseProcess() takes back out, so sample counts in and out match.
+
+  The FFT is fftQ15() with FFT_BLOCK_FLOAT. A stage is only halved when a value could overflow, and the number of
+  halvings is tracked, so quiet frames keep their precision.
+
+  Noise profile is learned from the first learnMs of the recording, which should be room noise only. Audio passes
+  through unchanged while learning. Powers are compared as log2 in 1/8 steps, so a gain is a table lookup per bin.
+
+    Spectral subtraction - Gain is sqrt(1 - strength * noise / power), never below DENOISE_FLOOR_DB. Gains fall at
+    most half way per frame, which keeps the warbling of single bins ("musical noise") down.
+    Noise gate - Frames whose total power is less than DENOISE_GATE_DB over the noise profile are faded down to
+    DENOISE_GATE_FLOOR_DB, after DENOISE_GATE_HOLD_MS without a louder frame. Louder frames open it at once.
+
+  DENOISE_FFT_SIZE - Frame size. Power of 2.
+  DENOISE_HOP - Samples between frames, and size of a block in cycle reports. Half of DENOISE_FFT_SIZE.
+  DENOISE_LOG_BIAS - Mean of log power is this many 1/8 steps under log of mean power for noise, so it is added back.
+
+*/
+
+#include <Arduino.h>
+
+#define DENOISE_FFT_BITS 8
+#define DENOISE_FFT_SIZE (1 << DENOISE_FFT_BITS)
+#define DENOISE_HOP (DENOISE_FFT_SIZE / 2)
+#define DENOISE_BINS (DENOISE_FFT_SIZE / 2 + 1)
+#define DENOISE_TABLE 128
+
+#define DENOISE_LEARN_MS 500
+#define DENOISE_STRENGTH 2.0f
+#define DENOISE_FLOOR_DB -18
+#define DENOISE_GATE_DB 3
+#define DENOISE_GATE_FLOOR_DB -24
+#define DENOISE_GATE_HOLD_MS 150
+#define DENOISE_LOG_BIAS 7
+
+struct NoiseReducer {
+
+  int16_t window[DENOISE_FFT_SIZE];
+  int16_t cosTable[DENOISE_FFT_SIZE / 2];
+  int16_t sinTable[DENOISE_FFT_SIZE / 2];
+  int16_t gainTable[DENOISE_TABLE];
+
+  int16_t frame[DENOISE_FFT_SIZE];
+  int16_t re[DENOISE_FFT_SIZE];
+  int16_t im[DENOISE_FFT_SIZE];
+  int32_t overlap[DENOISE_FFT_SIZE];
+  int fill;
+
+  int32_t noiseLog[DENOISE_BINS];
+  int32_t noiseTotal;
+  int16_t gains[DENOISE_BINS];
+  uint32_t learnFrames;
+  uint32_t learned;
+
+  bool gateEnabled;
+  int16_t gate;
+  int16_t gateFloor;
+  int16_t gateRelease;
+  int gateThreshold;
+  uint32_t gateHold;
+  uint32_t holdLeft;
+
+  uint32_t samplesIn;
+  uint32_t samplesOut;
+  uint32_t skip;
+
+  uint32_t sampleRate;
+  uint32_t frames;
+  uint32_t gatedFrames;
+  uint64_t cycles;
+  uint32_t maxCycles;
+
+};
+
+void denoiseInit(NoiseReducer &reducer, uint32_t sample_rate, float strength = DENOISE_STRENGTH, bool gate = true, uint32_t learnMs = DENOISE_LEARN_MS);
+size_t denoiseProcess(NoiseReducer &reducer, const int16_t *in, int16_t *out, size_t sampleCount);
+size_t denoiseFinish(NoiseReducer &reducer, int16_t *out);
+void denoiseReport(const NoiseReducer &reducer);
+
+#endif
@@ -0,0 +1,705 @@
+#include "edit_list.h"
+
+void editListClear(EditList &list){
+
+  list.count = 0;
+  list.poolUsed = 0;
+
+}
+
+// Returns offset of source in pool, adding it if no segment uses it yet. Returns -1 if pool is full.
+
+static int poolPath(EditList &list, const char * source){
+
+  for(int i = 0; i < list.count; i++){
+
+    if(strcmp(list.pool + list.segments[i].pathOffset, source) == 0) return list.segments[i].pathOffset;
+
+  }
+
+  size_t len = strlen(source) + 1;
+
+  if(list.poolUsed + len > EDIT_POOL_SIZE) return -1;
+
+  int offset = list.poolUsed;
+
+  memcpy(list.pool + offset, source, len);
+  list.poolUsed += len;
+
+  return offset;
+
+}
+
+/*
+
+  editListAdd() - Appends a segment.
+
+  EditList &list - List to add to.
+  const char * source - Source WAV file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  uint32_t start - First sample.
+  uint32_t end - Sample after last sample. Must be greater than start.
+  float gain - Gain applied to segment.
+
+  return - false if list is full or range is empty.
+
+*/
+
+bool editListAdd(EditList &list, const char * source, uint32_t start, uint32_t end, float gain){
+
+  if(list.count >= EDIT_MAX_SEGMENTS || end <= start) return false;
+
+  int offset = poolPath(list, source);
+
+  if(offset < 0) return false;
+
+  EditSegment &segment = list.segments[list.count++];
+
+  segment.pathOffset = offset;
+  segment.start = start;
+  segment.end = end;
+  segment.gain = gain;
+
+  return true;
+
+}
+
+/*
+
+  editListCut() - Removes samples from to to of the edited result, splitting a segment if the cut falls inside it.
+
+  return - false if a split would need more than EDIT_MAX_SEGMENTS.
+
+*/
+
+bool editListCut(EditList &list, uint32_t from, uint32_t to){
+
+  if(to <= from) return true;
+
+  EditSegment kept[EDIT_MAX_SEGMENTS];
+  int count = 0;
+  uint32_t position = 0;
+
+  for(int i = 0; i < list.count; i++){
+
+    EditSegment segment = list.segments[i];
+    uint32_t length = segment.end - segment.start;
+    uint32_t segmentEnd = position + length;
+
+    if(segmentEnd <= from || position >= to){
+
+      if(count >= EDIT_MAX_SEGMENTS) return false;
+
+      kept[count++] = segment;
+
+    }
+
+    else{
+
+      // Part before cut.
+
+      if(position < from){
+
+        if(count >= EDIT_MAX_SEGMENTS) return false;
+
+        kept[count] = segment;
+        kept[count++].end = segment.start + (from - position);
+
+      }
+
+      // Part after cut.
+
+      if(segmentEnd > to){
+
+        if(count >= EDIT_MAX_SEGMENTS) return false;
+
+        kept[count] = segment;
+        kept[count++].start = segment.start + (to - position);
+
+      }
+
+    }
+
+    position = segmentEnd;
+
+  }
+
+  memcpy(list.segments, kept, count * sizeof(EditSegment));
+  list.count = count;
+
+  return true;
+
+}
+
+// editListTrim() - Keeps only samples from to to of the edited result.
+
+bool editListTrim(EditList &list, uint32_t from, uint32_t to){
+
+  uint32_t total = editListSamples(list);
+
+  if(to < total && !editListCut(list, to, total)) return false;
+
+  return editListCut(list, 0, from);
+
+}
+
+// editListAppend() - Adds all segments of other to the end of list.
+
+bool editListAppend(EditList &list, const EditList &other){
+
+  for(int i = 0; i < other.count; i++){
+
+    const EditSegment &segment = other.segments[i];
+
+    if(!editListAdd(list, editListSource(other, i), segment.start, segment.end, segment.gain)) return false;
+
+  }
+
+  return true;
+
+}
+
+// Returns length of edited result in samples.
+
+uint32_t editListSamples(const EditList &list){
+
+  uint32_t total = 0;
+
+  for(int i = 0; i < list.count; i++) total += list.segments[i].end - list.segments[i].start;
+
+  return total;
+
+}
+
+const char *editListSource(const EditList &list, int segment){
+
+  return list.pool + list.segments[segment].pathOffset;
+
+}
+
+// Returns true if any segment plays from path.
+
+bool editListUses(const EditList &list, const char * path){
+
+  for(int i = 0; i < list.count; i++){
+
+    if(strcmp(editListSource(list, i), path) == 0) return true;
+
+  }
+
+  return false;
+
+}
+
+// Writes edit list path for a track to out, i.e. "/music/a.wav" gives "/music/a.edl".
+
+void editListPath(const char * trackPath, char *out, size_t size){
+
+  const char *dot = strrchr(trackPath, '.');
+  const char *slash = strrchr(trackPath, '/');
+  int stem = (dot && (!slash || dot > slash)) ? dot - trackPath : strlen(trackPath);
+
+  snprintf(out, size, "%.*s.edl", stem, trackPath);
+
+}
+
+/*
+
+  editListLoad() - Reads an edit list file. Ends of 0 are replaced by source length, and ends past source length are clamped.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Edit list file, see editListPath().
+  EditList &list - Filled with segments.
+
+  return - false if file does not exist or has no usable segments.
+
+*/
+
+bool editListLoad(fs::FS &fs, const char * path, EditList &list){
+
+  editListClear(list);
+
+  File file = fs.open(path, FILE_READ);
+
+  if(!file) return false;
+
+  char line[256];
+  size_t len = 0;
+  int c;
+
+  do{
+
+    c = file.read();
+
+    if(c >= 0 && c != '\n'){
+
+      if(len < sizeof(line) - 1) line[len++] = c;
+
+      continue;
+
+    }
+
+    line[len] = 0;
+
+    while(len && (line[len - 1] == '\r' || line[len - 1] == ' ')) line[--len] = 0;
+
+    len = 0;
+
+    if(line[0] == 0 || line[0] == '#') continue;
+
+    // Numbers are the last three fields, anything before them is the path.
+
+    char *fields[3];
+    bool ok = true;
+
+    for(int i = 2; i >= 0 && ok; i--){
+
+      char *space = strrchr(line, ' ');
+
+      if(!space) ok = false;
+
+      else{
+
+        fields[i] = space + 1;
+        *space = 0;
+
+      }
+
+    }
+
+    if(!ok){
+
+      Serial.printf("Bad edit list line in %s\n", path);
+
+      continue;
+
+    }
+
+    MonoWAVHeader header;
+    uint32_t dataOffset;
+
+    if(!readMonoWAVHeader(fs, line, header, dataOffset)) continue;
+
+    uint32_t samples = monoWAVSamples(header);
+    uint32_t start = strtoul(fields[0], NULL, 10);
+    uint32_t end = strtoul(fields[1], NULL, 10);
+
+    if(end == 0 || end > samples) end = samples;
+
+    editListAdd(list, line, start, end, atof(fields[2]));
+
+  } while(c >= 0);
+
+  file.close();
+
+  return list.count > 0;
+
+}
+
+// editListSave() - Writes edit list file, replacing any existing one.
+
+bool editListSave(fs::FS &fs, const char * path, const EditList &list){
+
+  File file = fs.open(path, FILE_WRITE);
+
+  if(!file){
+
+    Serial.printf("%s could not be created.\n", path);
+
+    return false;
+
+  }
+
+  char line[EDIT_POOL_SIZE + 48];
+
+  file.print("# source start end gain\n");
+
+  for(int i = 0; i < list.count; i++){
+
+    const EditSegment &segment = list.segments[i];
+
+    snprintf(line, sizeof(line), "%s %u %u %.4f\n", editListSource(list, i), segment.start, segment.end, segment.gain);
+
+    file.print(line);
+
+  }
+
+  file.close();
+
+  return true;
+
+}
+
+// Positions player reader at sourcePosition of current segment. Seeks within the open file if the source is unchanged.
+
+static bool openReader(EditPlayer &player){
+
+  const EditSegment &segment = player.list->segments[player.segment];
+  const char *source = editListSource(*player.list, player.segment);
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  player.readerReady = false;
+
+  if(!readMonoWAVHeader(*player.fs, source, header, dataOffset)) return false;
+
+  if(!selectSampleFormat(header, player.format)){
+
+    Serial.printf("%s: unsupported sample format.\n", source);
+
+    return false;
+
+  }
+
+  uint32_t bytesPerSample = player.format.bytesPerSample;
+  uint32_t offset = dataOffset + player.sourcePosition * bytesPerSample;
+
+  bool sameSource = player.openSegment >= 0 && player.list->segments[player.openSegment].pathOffset == segment.pathOffset;
+
+  if(sameSource){
+
+    blockReaderSetEnd(player.reader, 0xFFFFFFFF);
+    blockReaderSeek(player.reader, offset);
+
+  }
+
+  else{
+
+    if(player.openSegment >= 0) blockReaderClose(player.reader);
+
+    player.openSegment = -1;
+
+    if(!blockReaderOpen(player.reader, *player.fs, source, offset, player.buffer, player.bufferSize)) return false;
+
+  }
+
+  blockReaderSetEnd(player.reader, dataOffset + segment.end * bytesPerSample);
+
+  player.openSegment = player.segment;
+  player.readerReady = true;
+
+  return true;
+
+}
+
+// Moves player to offset samples into a segment. Plays from the track cache if it has the samples, otherwise opens the source.
+
+static bool openSegment(EditPlayer &player, int index, uint32_t offset){
+
+  const EditSegment &segment = player.list->segments[index];
+
+  trackCacheRelease(player.cacheEntry);
+
+  player.segment = index;
+  player.sourcePosition = segment.start + offset;
+  player.readerReady = false;
+  player.cacheEntry = trackCacheAcquire(editListSource(*player.list, index), player.sourcePosition);
+
+  return player.cacheEntry >= 0 || openReader(player);
+
+}
+
+/*
+
+  editPlayerOpen() - Prepares to stream an edit list. list must stay valid until editPlayerClose().
+
+  uint8_t *buffer - Read buffer shared by all segments. If NULL, one is allocated per source file.
+
+  return - false if the first segment could not be opened.
+
+*/
+
+bool editPlayerOpen(EditPlayer &player, fs::FS &fs, const EditList &list, uint8_t *buffer, size_t bufferSize){
+
+  player.fs = &fs;
+  player.list = &list;
+  player.segment = 0;
+  player.openSegment = -1;
+  player.readerReady = false;
+  player.cacheEntry = -1;
+  player.position = 0;
+  player.loopStart = 0;
+  player.loopEnd = 0;
+  player.buffer = buffer;
+
+  pipelineInitParams(player.params);
+
+  player.bufferSize = bufferSize;
+
+  return list.count > 0 && openSegment(player, 0, 0);
+
+}
+
+/*
+
+  editPlayerNext() - Returns a view of the next samples of the edited result, moving to the next segment when needed.
+  Views never cross segments or the end of an A-B loop. Segments whose source cannot be opened are skipped. Views are
+  always 16 bit samples, whatever the source format.
+
+  return - Size of view in bytes. 0 when all segments have been played.
+
+*/
+
+size_t editPlayerNext(EditPlayer &player, uint8_t **data, size_t maxBytes){
+
+  // A second loop jump without any samples in between means nothing in the loop can be played.
+
+  int jumps = 0;
+
+  while(player.segment < player.list->count){
+
+    const EditSegment &segment = player.list->segments[player.segment];
+    size_t maxSamples = maxBytes / sizeof(int16_t);
+
+    if(player.loopEnd > player.loopStart){
+
+      if(player.position >= player.loopEnd){
+
+        if(jumps++ || !editPlayerSeek(player, player.loopStart)) return 0;
+
+        continue;
+
+      }
+
+      if(maxSamples > player.loopEnd - player.position) maxSamples = player.loopEnd - player.position;
+
+    }
+
+    if(maxSamples > segment.end - player.sourcePosition) maxSamples = segment.end - player.sourcePosition;
+
+    size_t n = 0;
+
+    player.params.gain[PIPELINE_SEGMENT_GAIN] = pipelineGain(segment.gain);
+
+    // Cached samples go through the 16 bit pipeline into player buffer, so gain never changes the cache. Past the
+    // cached range, continue from the card.
+
+    if(player.cacheEntry >= 0){
+
+      const int16_t *cached;
+
+      n = trackCacheRead(player.cacheEntry, player.sourcePosition, &cached, maxSamples < EDIT_CONVERT_SAMPLES ? maxSamples : EDIT_CONVERT_SAMPLES);
+
+      if(n > 0){
+
+        playbackPipeline<int16_t, 1>((const uint8_t *)cached, player.converted, n, player.params);
+
+        *data = (uint8_t *)player.converted;
+
+      }
+
+      else{
+
+        trackCacheRelease(player.cacheEntry);
+
+        player.cacheEntry = -1;
+
+        if(player.sourcePosition < segment.end) openReader(player);
+
+      }
+
+    }
+
+    // Samples are read into player buffer, whatever the source format, and one pass of the pipeline chosen for the
+    // source applies segment gain and volume. Views of the reader are never changed, so a seek back inside the same
+    // block, i.e. an A-B loop jump, gets the original samples again instead of ones with gain already applied.
+
+    if(n == 0 && player.readerReady){
+
+      size_t bytesPerSample = player.format.bytesPerSample;
+      uint8_t *raw;
+
+      if(maxSamples > EDIT_CONVERT_SAMPLES) maxSamples = EDIT_CONVERT_SAMPLES;
+
+      n = blockReaderNext(player.reader, &raw, maxSamples * bytesPerSample, bytesPerSample) / bytesPerSample;
+
+      if(n > 0){
+
+        player.format.play(raw, player.converted, n, player.params);
+
+        *data = (uint8_t *)player.converted;
+
+      }
+
+    }
+
+    if(n > 0){
+
+      player.sourcePosition += n;
+      player.position += n;
+
+      return n * sizeof(int16_t);
+
+    }
+
+    if(player.segment + 1 >= player.list->count){
+
+      // End of list. Keep looping if the loop end is past it.
+
+      if(player.loopEnd > player.loopStart && player.position >= player.loopStart){
+
+        if(jumps++ || !editPlayerSeek(player, player.loopStart)) return 0;
+
+        continue;
+
+      }
+
+      player.segment++;
+
+    }
+
+    else openSegment(player, player.segment + 1, 0);
+
+  }
+
+  return 0;
+
+}
+
+/*
+
+  editPlayerSeek() - Moves player to a position in the edited result.
+
+  uint32_t position - Sample number in the edited result.
+
+  return - false if position is past the end.
+
+*/
+
+bool editPlayerSeek(EditPlayer &player, uint32_t position){
+
+  uint32_t segmentStart = 0;
+
+  for(int i = 0; i < player.list->count; i++){
+
+    const EditSegment &segment = player.list->segments[i];
+    uint32_t length = segment.end - segment.start;
+
+    if(position < segmentStart + length){
+
+      player.position = position;
+
+      openSegment(player, i, position - segmentStart);
+
+      return true;
+
+    }
+
+    segmentStart += length;
+
+  }
+
+  return false;
+
+}
+
+/*
+
+  editPlayerSetLoop() - Repeats samples from start to end of the edited result until cleared. Call from the same
+  task as trackCacheService(), since the loop is queued for caching.
+
+  uint32_t start - A point, as a sample number in the edited result.
+  uint32_t end - B point, exclusive. An end not greater than start clears the loop.
+
+*/
+
+void editPlayerSetLoop(EditPlayer &player, uint32_t start, uint32_t end){
+
+  if(end <= start){
+
+    player.loopStart = 0;
+    player.loopEnd = 0;
+
+    return;
+
+  }
+
+  player.loopStart = start;
+  player.loopEnd = end;
+
+  // Queue the part of each segment that falls inside the loop.
+
+  uint32_t segmentStart = 0;
+
+  for(int i = 0; i < player.list->count; i++){
+
+    const EditSegment &segment = player.list->segments[i];
+    uint32_t segmentEnd = segmentStart + segment.end - segment.start;
+
+    if(segmentEnd > start && segmentStart < end){
+
+      uint32_t from = start > segmentStart ? start - segmentStart : 0;
+      uint32_t to = (end < segmentEnd ? end : segmentEnd) - segmentStart;
+
+      trackCacheRequest(editListSource(*player.list, i), segment.start + from, segment.start + to);
+
+    }
+
+    segmentStart = segmentEnd;
+
+  }
+
+}
+
+// editPlayerSetVolume() - Sets gain applied on top of segment gain, in the same pass. Takes effect on the next view.
+
+void editPlayerSetVolume(EditPlayer &player, float volume){
+
+  player.params.gain[PIPELINE_VOLUME] = pipelineGain(volume);
+
+}
+
+bool editPlayerAvailable(EditPlayer &player){
+
+  if(!player.list || player.segment >= player.list->count) return false;
+
+  if(player.loopEnd > player.loopStart || player.segment + 1 < player.list->count) return true;
+
+  if(player.cacheEntry >= 0) return player.sourcePosition < player.list->segments[player.segment].end;
+
+  return player.readerReady && blockReaderAvailable(player.reader);
+
+}
+
+void editPlayerClose(EditPlayer &player){
+
+  if(player.openSegment >= 0) blockReaderClose(player.reader);
+
+  trackCacheRelease(player.cacheEntry);
+
+  player.openSegment = -1;
+  player.cacheEntry = -1;
+  player.list = NULL;
+
+}
+
+/*
+
+  renderEditList() - Writes edited result to a sink in one streaming pass, i.e. to a new WAV file with sinkOpenWAVFile().
+
+  return - Number of samples written.
+
+*/
+
+uint32_t renderEditList(fs::FS &fs, const EditList &list, AudioSink &sink){
+
+  EditPlayer player;
+  uint8_t *data;
+  size_t n;
+  uint32_t total = 0;
+
+  if(!editPlayerOpen(player, fs, list)) return 0;
+
+  while((n = editPlayerNext(player, &data, READ_BLOCK_SIZE)) > 0){
+
+    sinkWrite(sink, data, n);
+
+    total += n / 2;
+
+  }
+
+  editPlayerClose(player);
+
+  return total;
+
+}
@@ -0,0 +1,114 @@
+#ifndef _EDIT_LIST_H
+#define _EDIT_LIST_H
+
+/*
+
+  Non-destructive edit lists.
+
+  An edit list is a sequence of segments, each a sample range from a WAV file with its own gain.
+  Trimming, cutting and joining tracks only changes the list. Audio is resolved while playing by seeking in the
+  source files, so edits take no time no matter how long the files are. renderEditList() can write the result
+  to a new file in one streaming pass when a real file is needed.
+
+  Edit lists are stored next to their track, with the extension replaced by ".edl", i.e. "/music/a.wav" and
+  "/music/a.edl". The file is plain text, one segment per line:
+
+    # source start end gain
+    /music/a.wav 44100 441000 1.0
+    /music/b.wav 0 0 0.8
+
+  Sources may be any format supported by selectSampleFormat(), and are played as mono 16 bit. start and end are
+  sample numbers, end is exclusive. An end of 0 means end of file. Lines starting with # are ignored.
+
+  Players read from the track cache when a segment's samples are cached, and only open the source file once
+  playback runs past the cached range. An A-B loop set with editPlayerSetLoop() is queued for caching, so once it
+  is loaded, looping plays from RAM.
+
+  EDIT_MAX_SEGMENTS - Maximum segments in a list.
+  EDIT_POOL_SIZE - Bytes for source paths. Paths used by several segments are stored once.
+
+*/
+
+#include "mono_file.h"
+#include "sample_format.h"
+#include "track_cache.h"
+
+#define EDIT_MAX_SEGMENTS 32
+#define EDIT_POOL_SIZE 1024
+#define EDIT_CONVERT_SAMPLES 512
+
+struct EditSegment {
+
+  uint16_t pathOffset;
+  uint32_t start;
+  uint32_t end;
+  float gain;
+
+};
+
+struct EditList {
+
+  uint16_t count;
+  uint16_t poolUsed;
+  EditSegment segments[EDIT_MAX_SEGMENTS];
+  char pool[EDIT_POOL_SIZE];
+
+};
+
+/*
+
+  EditPlayer - Streams an edit list. Views are handed out like BlockReader, with segment gain and volume already
+  applied by the source's pipeline. Samples from the card and the cache are processed EDIT_CONVERT_SAMPLES at a time
+  into converted, so reader and cache views are never changed.
+
+  position is the number of samples of the edited result played so far, moved back by A-B loop jumps.
+
+*/
+
+struct EditPlayer {
+
+  fs::FS *fs;
+  const EditList *list;
+  int segment;
+  int openSegment;
+  bool readerReady;
+  uint32_t sourcePosition;
+  int cacheEntry;
+
+  uint32_t position;
+  uint32_t loopStart;
+  uint32_t loopEnd;
+
+  BlockReader reader;
+  uint8_t *buffer;
+  size_t bufferSize;
+
+  SampleFormat format;
+  PipelineParams params;
+  int16_t converted[EDIT_CONVERT_SAMPLES];
+
+};
+
+void editListClear(EditList &list);
+bool editListAdd(EditList &list, const char * source, uint32_t start, uint32_t end, float gain = 1.0);
+bool editListCut(EditList &list, uint32_t from, uint32_t to);
+bool editListTrim(EditList &list, uint32_t from, uint32_t to);
+bool editListAppend(EditList &list, const EditList &other);
+uint32_t editListSamples(const EditList &list);
+const char *editListSource(const EditList &list, int segment);
+bool editListUses(const EditList &list, const char * path);
+void editListPath(const char * trackPath, char *out, size_t size);
+bool editListLoad(fs::FS &fs, const char * path, EditList &list);
+bool editListSave(fs::FS &fs, const char * path, const EditList &list);
+
+bool editPlayerOpen(EditPlayer &player, fs::FS &fs, const EditList &list, uint8_t *buffer = NULL, size_t bufferSize = READ_BUFFER_BYTES(READ_BLOCK_SIZE));
+size_t editPlayerNext(EditPlayer &player, uint8_t **data, size_t maxBytes);
+bool editPlayerSeek(EditPlayer &player, uint32_t position);
+void editPlayerSetLoop(EditPlayer &player, uint32_t start, uint32_t end);
+void editPlayerSetVolume(EditPlayer &player, float volume);
+bool editPlayerAvailable(EditPlayer &player);
+void editPlayerClose(EditPlayer &player);
+
+uint32_t renderEditList(fs::FS &fs, const EditList &list, AudioSink &sink);
+
+#endif
@@ -0,0 +1,124 @@
+#include "fft.h"
+
+/*
+
+  fftTables() - Builds Q15 twiddle tables for an FFT of size points.
+
+  int16_t *cosTable, int16_t *sinTable - size / 2 entries each.
+  int size - Power of 2.
+
+*/
+
+void fftTables(int16_t *cosTable, int16_t *sinTable, int size){
+
+  for(int i = 0; i < size / 2; i++){
+
+    cosTable[i] = (int16_t)lround(cos(2.0 * M_PI * i / size) * 32767);
+    sinTable[i] = (int16_t)lround(sin(2.0 * M_PI * i / size) * 32767);
+
+  }
+
+}
+
+// x / 2^shift for shift 0 or 1, ties to even.
+
+static inline int32_t halve(int32_t x, int shift){
+
+  return (x + ((x >> 1) & shift)) >> shift;
+
+}
+
+/*
+
+  fftQ15() - In place fixed point radix-2 decimation in time FFT on re and im, forward or inverse, without the 1/N.
+
+  int16_t *re, int16_t *im - size values each, replaced by the transform.
+  int size - Power of 2.
+  const int16_t *cosTable, const int16_t *sinTable - From fftTables() for the same size.
+  int flags - FFT_INVERSE for the inverse transform, FFT_BLOCK_FLOAT to halve only stages that need it.
+
+  return - Number of stages halved. Output is the true transform divided by 2 to that power.
+
+*/
+
+int fftQ15(int16_t *re, int16_t *im, int size, const int16_t *cosTable, const int16_t *sinTable, int flags){
+
+  bool inverse = flags & FFT_INVERSE;
+  bool blockFloat = flags & FFT_BLOCK_FLOAT;
+
+  for(int i = 1, j = 0; i < size; i++){
+
+    int bit = size >> 1;
+
+    for(; j & bit; bit >>= 1) j ^= bit;
+
+    j ^= bit;
+
+    if(i < j){
+
+      int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+
+    }
+
+  }
+
+  int32_t bits = 0;
+
+  if(blockFloat) for(int i = 0; i < size; i++) bits |= abs(re[i]) | abs(im[i]);
+
+  int halved = 0;
+
+  for(int len = 2; len <= size; len <<= 1){
+
+    int half = len >> 1;
+    int step = size / len;
+    int shift = !blockFloat || bits >= 0x2000 ? 1 : 0;
+
+    halved += shift;
+    bits = 0;
+
+    for(int j = 0; j < half; j++){
+
+      int32_t wr = cosTable[j * step];
+      int32_t wi = inverse ? sinTable[j * step] : -sinTable[j * step];
+
+      for(int i = j; i < size; i += len){
+
+        int k = i + half;
+
+        int32_t tr = (re[k] * wr - im[k] * wi + (1 << 14)) >> 15;
+        int32_t ti = (re[k] * wi + im[k] * wr + (1 << 14)) >> 15;
+
+        int32_t ar = re[i];
+        int32_t ai = im[i];
+
+        re[k] = halve(ar - tr, shift);
+        im[k] = halve(ai - ti, shift);
+        re[i] = halve(ar + tr, shift);
+        im[i] = halve(ai + ti, shift);
+
+        if(blockFloat) bits |= abs(re[k]) | abs(im[k]) | abs(re[i]) | abs(im[i]);
+
+      }
+
+    }
+
+  }
+
+  return halved;
+
+}
+
+// log2 of x in 1/8 steps.
+
+int log2x8(uint64_t x){
+
+  if(x == 0) return 0;
+
+  int bits = 63 - __builtin_clzll(x);
+  int fraction = bits >= 3 ? (x >> (bits - 3)) & 7 : (x << (3 - bits)) & 7;
+
+  return bits * 8 + fraction;
+
+}
@@ -0,0 +1,30 @@
+#ifndef _FFT_H
+#define _FFT_H
+
+/*
+
+  Fixed point FFT shared by the spectrum analyzer and noise reduction.
+
+  fftQ15() is an in place radix-2 decimation in time FFT on separate int16_t re and im arrays, with Q15 twiddles
+  from fftTables(). Butterflies round rather than truncate, halving to even, or the error of each stage adds up to a
+  DC offset. Stages are scaled one of two ways:
+
+    Fixed - Every stage is halved, so the output is the true transform divided by size. Any input fits.
+    FFT_BLOCK_FLOAT - A stage is halved only if some value is 8192 or more, since a butterfly can at most double the
+    magnitude of a complex value, and a halved one never grows it. Inputs must be below 16384. Keeps more bits on
+    quiet frames, and the number of halved stages tells the caller the output scale.
+
+  log2x8() gives levels on the log scale both callers use, 8 steps per octave of power, roughly 3dB per 8 steps.
+
+*/
+
+#include <Arduino.h>
+
+#define FFT_INVERSE 1
+#define FFT_BLOCK_FLOAT 2
+
+void fftTables(int16_t *cosTable, int16_t *sinTable, int size);
+int fftQ15(int16_t *re, int16_t *im, int size, const int16_t *cosTable, const int16_t *sinTable, int flags);
+int log2x8(uint64_t x);
+
+#endif
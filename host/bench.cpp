@@ -0,0 +1,516 @@
+/*
+
+  Host benchmarks.
+
+  Runs the device benchmarks, and a few host only ones, against the stand-ins in stubs/. Times are host times, and
+  cycle counts are host time in cycles of the stub CPU frequency, see stubs/host.h. Use them to compare changes and
+  to check that a stage keeps a large margin over real time, not as ESP32 figures.
+
+    bench <card directory> <benchmark> [arguments]
+
+  The card directory is created if needed and is used for files the benchmarks write.
+
+*/
+
+#include "host.h"
+#include "mono_file.h"
+#include "audio_arena.h"
+#include "spectrum.h"
+#include "sample_format.h"
+#include "analysis.h"
+#include "power.h"
+#include "time_stretch.h"
+#include "audio_sink.h"
+#include "sample_pipeline.h"
+#include "sd_read_write.h"
+#include "latency.h"
+#include "denoise.h"
+
+#include <vector>
+#include <sys/stat.h>
+
+static fs::FS card;
+
+/*
+
+  library [files] - Scans a library of files spread over nested directories, default 4000, for scan time, pool use
+  and heap use during the scan. The index has the default sizes, and every file must fit in it.
+
+*/
+
+static bool benchLibrary(int argc, char **argv){
+
+  static LibraryIndex index;
+  uint32_t files = argc > 0 ? strtoul(argv[0], NULL, 10) : 4000;
+  char path[96];
+
+  // 20 artists of 10 albums, files spread evenly, each file is an empty WAV header.
+
+  card.mkdir("/library");
+
+  for(uint32_t i = 0; i < files; i++){
+
+    uint32_t artist = i % 20;
+    uint32_t album = i / 20 % 10;
+
+    snprintf(path, sizeof(path), "/library/artist %02u", artist);
+    card.mkdir(path);
+    snprintf(path, sizeof(path), "/library/artist %02u/album %02u", artist, album);
+    card.mkdir(path);
+    snprintf(path, sizeof(path), "/library/artist %02u/album %02u/%05u track name.wav", artist, album, i);
+
+    if(!card.exists(path)) card.open(path, FILE_WRITE).close();
+
+  }
+
+  if(!libraryInit(index)) return false;
+
+  return scanLibrary(card, "/library", index) == files && index.dropped == 0;
+
+}
+
+/*
+
+  spectrum [frames] - Runs spectrumUpdate() on noise at each FFT size, default 2000 frames each, and prints cycles per
+  frame against the cycles one core has between frames.
+
+*/
+
+static bool benchSpectrum(int argc, char **argv){
+
+  int frames = argc > 0 ? atoi(argv[0]) : 2000;
+  int16_t block[SPECTRUM_MAX_FFT];
+  uint32_t seed = 1;
+
+  for(int size = 64; size <= SPECTRUM_MAX_FFT; size *= 2){
+
+    if(!spectrumInit(size, size / 4 < SPECTRUM_BANDS ? size / 4 : SPECTRUM_BANDS)) return false;
+
+    unsigned long now = 0;
+
+    for(int f = 0; f < frames; f++){
+
+      for(int i = 0; i < size; i++){
+
+        seed = seed * 1664525 + 1013904223;
+        block[i] = (int16_t)(seed >> 16);
+
+      }
+
+      spectrumTapWrite(block, size);
+
+      now += SPECTRUM_FRAME_MS;
+
+      spectrumUpdate(now);
+
+    }
+
+    spectrumReport();
+
+  }
+
+  Serial.printf("Host cycles at %u MHz, %u cycles between frames every %d ms.\n", ESP.getCpuFreqMHz(), ESP.getCpuFreqMHz() * 1000 * SPECTRUM_FRAME_MS, SPECTRUM_FRAME_MS);
+
+  return true;
+
+}
+
+// Reference conversions for formats, written from the rules in sample_format.h without the pipeline templates.
+
+static int16_t referenceSample(uint16_t bits, bool isFloat, const uint8_t *p){
+
+  if(isFloat){
+
+    float x;
+
+    memcpy(&x, p, 4);
+
+    if(x != x) return 0;
+
+    double v = (double)x * 32768.0;
+
+    if(v >= 32767.0) return 32767;
+    if(v <= -32768.0) return -32768;
+
+    return (int16_t)trunc(v);
+
+  }
+
+  if(bits == 8) return (int16_t)((p[0] - 128) * 256);
+
+  return (int16_t)(p[bits / 8 - 2] | p[bits / 8 - 1] << 8);
+
+}
+
+/*
+
+  formats [samples] - Runs benchmarkSampleFormats(), then checks every kernel against referenceSample() on every 8 bit
+  value and random 24 bit, 32 bit and float samples, default 1000000 each. Floats include NaN, infinities and
+  denormals, taken from random bit patterns.
+
+*/
+
+static bool benchFormats(int argc, char **argv){
+
+  bool ok = benchmarkSampleFormats();
+  uint32_t samples = argc > 0 ? strtoul(argv[0], NULL, 10) : 1000000;
+  uint32_t seed = 1;
+
+  struct { uint16_t bits; bool isFloat; sampleKernel convert; } kernels[] = {
+
+    {8, false, convertU8},
+    {24, false, convertS24},
+    {32, false, convertS32},
+    {32, true, convertF32}
+
+  };
+
+  const uint32_t block = 1024;
+  uint8_t in[block * 4];
+  int16_t out[block];
+
+  for(int k = 0; k < 4; k++){
+
+    uint32_t bytes = kernels[k].bits / 8;
+    uint32_t total = kernels[k].bits == 8 ? 256 : samples;
+    uint32_t mismatches = 0;
+
+    for(uint32_t done = 0; done < total; done += block){
+
+      uint32_t n = total - done < block ? total - done : block;
+
+      for(uint32_t i = 0; i < n * bytes; i++){
+
+        seed = seed * 1664525 + 1013904223;
+        in[i] = kernels[k].bits == 8 ? (uint8_t)(done + i) : (uint8_t)(seed >> 24);
+
+      }
+
+      kernels[k].convert(in, out, n);
+
+      for(uint32_t i = 0; i < n; i++){
+
+        if(out[i] != referenceSample(kernels[k].bits, kernels[k].isFloat, in + i * bytes)) mismatches++;
+
+      }
+
+    }
+
+    Serial.printf("  %u bit%s: %u samples, %u mismatches against reference.\n", kernels[k].bits, kernels[k].isFloat ? " float" : "", total, mismatches);
+
+    ok &= mismatches == 0;
+
+  }
+
+  return ok;
+
+}
+
+// Writes seconds of a 16 bit 44.1kHz test tone with some noise to path, unless it is already there.
+
+static bool makeTestTrack(const char * path, uint32_t seconds){
+
+  if(card.exists(path)) return true;
+
+  AudioSink sink;
+  int16_t block[1024];
+  uint32_t seed = 1;
+
+  if(!sinkOpenWAVFile(sink, card, path, 44100)) return false;
+
+  for(uint32_t n = 0; n < seconds * 44100; n += 1024){
+
+    for(int i = 0; i < 1024; i++){
+
+      seed = seed * 1664525 + 1013904223;
+      block[i] = (int16_t)(sin((n + i) * 0.0627) * 12000) + (int16_t)(seed >> 22) - 512;
+
+    }
+
+    sinkWrite(sink, (const uint8_t *)block, sizeof(block));
+
+  }
+
+  sinkClose(sink);
+
+  return true;
+
+}
+
+/*
+
+  analysis [seconds] - Runs benchmarkAnalysis() on a test track, default 600 seconds. With "playing" as second
+  argument, runs it as if audio were playing, where analyzeTrack() should stay on one core.
+
+*/
+
+static bool benchAnalysis(int argc, char **argv){
+
+  uint32_t seconds = argc > 0 ? strtoul(argv[0], NULL, 10) : 600;
+  char path[64];
+
+  snprintf(path, sizeof(path), "/analysis_%u.wav", seconds);
+
+  if(!makeTestTrack(path, seconds)) return false;
+
+  powerUpdate(0, argc > 1 && strcmp(argv[1], "playing") == 0);
+
+  benchmarkAnalysis(card, path);
+
+  return true;
+
+}
+
+// stretch - Runs benchmarkTimeStretch(), cycles per output sample at each speed from 0.5x to 2x.
+
+static bool benchStretch(int argc, char **argv){
+
+  benchmarkTimeStretch();
+
+  Serial.printf("Host cycles at %u MHz, real time at 44.1kHz is under %u cycles per sample.\n", ESP.getCpuFreqMHz(), ESP.getCpuFreqMHz() * 1000000 / 44100);
+
+  return true;
+
+}
+
+// pipeline - Runs benchmarkPipeline(), chained kernels against fused pipelines for every format, checked bit exact.
+
+static bool benchPipeline(int argc, char **argv){
+
+  return benchmarkPipeline();
+
+}
+
+// Card transfers for reading a file's data once in CHUNK_SIZE reads, as before BlockReader, and once with BlockReader.
+
+static void countReads(const char * path, uint32_t offset, uint32_t &small, uint32_t &blocks){
+
+  uint8_t chunk[CHUNK_SIZE];
+  uint8_t *data;
+  uint32_t before = hostCardReads();
+
+  File file = card.open(path, FILE_READ);
+
+  file.seek(offset);
+
+  while(file.read(chunk, sizeof(chunk)) > 0);
+
+  file.close();
+
+  small = hostCardReads() - before;
+  before = hostCardReads();
+
+  BlockReader reader;
+
+  if(blockReaderOpen(reader, card, path, offset)){
+
+    while(blockReaderNext(reader, &data, READ_BLOCK_SIZE) > 0);
+
+    blockReaderClose(reader);
+
+  }
+
+  blocks = hostCardReads() - before;
+
+}
+
+// Reads a file's sample data.
+
+static std::vector<uint8_t> readData(const char * path, uint32_t &offset){
+
+  MonoWAVHeader header;
+  std::vector<uint8_t> data;
+
+  if(!readMonoWAVHeader(card, path, header, offset)) return data;
+
+  data.resize(header.subchunk2_size);
+
+  File file = card.open(path, FILE_READ);
+
+  file.seek(offset);
+  data.resize(file.read(data.data(), data.size()));
+  file.close();
+
+  return data;
+
+}
+
+static int alignChanges = 0;
+
+static void countAlignChange(const char * path, bool done){
+
+  if(done) alignChanges++;
+
+}
+
+/*
+
+  align [seconds] - Runs benchmarkAlignment() on a test track, default 60 seconds, then aligns the track with
+  alignMonoWAVFile() and checks samples are unchanged, data starts on SECTOR_SIZE, no .aln copy is left behind and
+  the file change handler saw exactly one change. Host MB/s are not card speeds, so card transfers for reading the data, see hostCardReads(), are
+  printed before and after aligning. Those are what alignment changes.
+
+*/
+
+static bool benchAlign(int argc, char **argv){
+
+  uint32_t seconds = argc > 0 ? strtoul(argv[0], NULL, 10) : 60;
+  const char *path = "/align_test.wav";
+
+  if(card.exists(path)) card.remove(path);
+
+  if(!makeTestTrack(path, seconds)) return false;
+
+  benchmarkAlignment(card, path);
+
+  uint32_t before, after, small[2], blocks[2];
+  std::vector<uint8_t> original = readData(path, before);
+
+  countReads(path, before, small[0], blocks[0]);
+
+  setFileChangeHandler(countAlignChange);
+
+  bool aligned = alignMonoWAVFile(card, path, SECTOR_SIZE);
+  std::vector<uint8_t> moved = readData(path, after);
+
+  setFileChangeHandler(NULL);
+
+  countReads(path, after, small[1], blocks[1]);
+
+  bool ok = aligned && after % SECTOR_SIZE == 0 && moved == original && alignChanges == 1 && !card.exists("/align_test.wav.aln");
+
+  Serial.printf("Card transfers for %u bytes of data:\n", (uint32_t)original.size());
+  Serial.printf("  offset %u: %u with %d byte reads, %u with BlockReader\n", before, small[0], CHUNK_SIZE, blocks[0]);
+  Serial.printf("  offset %u: %u with %d byte reads, %u with BlockReader\n", after, small[1], CHUNK_SIZE, blocks[1]);
+  Serial.printf("Samples %s, %d file change%s.\n", moved == original ? "unchanged" : "CHANGED", alignChanges, alignChanges == 1 ? "" : "s");
+
+  return ok;
+
+}
+
+// latency - Runs benchmarkLatency() on the simulated loopback, every measurement checked against the exact answer.
+
+static bool benchLatency(int argc, char **argv){
+
+  return benchmarkLatency(LOOP_SIMULATED);
+
+}
+
+/*
+
+  denoise [seconds] - Runs noise reduction at each recording rate on noise with a 440Hz tone over the middle third,
+  default 3 seconds. Prints denoiseReport(), then how far noise in the last third and the tone came down. Fails if
+  samples are lost or noise comes down less than 6dB.
+
+*/
+
+static double rms(const int16_t *samples, size_t count){
+
+  double sum = 0;
+
+  for(size_t i = 0; i < count; i++) sum += (double)samples[i] * samples[i];
+
+  return count ? sqrt(sum / count) : 0;
+
+}
+
+static bool benchDenoise(int argc, char **argv){
+
+  static NoiseReducer reducer;
+  double seconds = argc > 0 ? atof(argv[0]) : 3;
+  const uint32_t rates[] = {8000, 16000, 22050, 44100};
+  bool ok = true;
+
+  for(int r = 0; r < 4; r++){
+
+    uint32_t total = rates[r] * seconds;
+    std::vector<int16_t> in(total), out(total + DENOISE_FFT_SIZE);
+    uint32_t seed = 1;
+    size_t produced = 0;
+
+    for(uint32_t i = 0; i < total; i++){
+
+      seed = seed * 1664525 + 1013904223;
+
+      double tone = i >= total / 3 && i < 2 * total / 3 ? 8000 * sin(2 * M_PI * 440 * i / rates[r]) : 0;
+
+      in[i] = (int16_t)(tone + (int32_t)seed / 2147483648.0 * 1000);
+
+    }
+
+    denoiseInit(reducer, rates[r]);
+
+    for(uint32_t i = 0; i < total; i += 256) produced += denoiseProcess(reducer, &in[i], &out[produced], total - i < 256 ? total - i : 256);
+
+    produced += denoiseFinish(reducer, &out[produced]);
+
+    uint32_t third = total / 3;
+    double noiseDb = 20 * log10(rms(&out[2 * third], third) / rms(&in[2 * third], third));
+    double toneDb = 20 * log10(rms(&out[third], third) / rms(&in[third], third));
+
+    Serial.printf("%u Hz: ", rates[r]);
+    denoiseReport(reducer);
+    Serial.printf("  noise %.1f dB, tone %.2f dB, %u of %u samples out.\n", noiseDb, toneDb, (uint32_t)produced, total);
+
+    ok &= produced == total && noiseDb <= -6;
+
+  }
+
+  return ok;
+
+}
+
+struct Benchmark {
+
+  const char *name;
+  bool (*run)(int argc, char **argv);
+
+};
+
+static const Benchmark benchmarks[] = {
+
+  {"library", benchLibrary},
+  {"spectrum", benchSpectrum},
+  {"formats", benchFormats},
+  {"analysis", benchAnalysis},
+  {"stretch", benchStretch},
+  {"pipeline", benchPipeline},
+  {"align", benchAlign},
+  {"latency", benchLatency},
+  {"denoise", benchDenoise}
+
+};
+
+int main(int argc, char **argv){
+
+  int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+  if(argc < 3){
+
+    Serial.print("Usage: bench <card directory> <benchmark> [arguments]\nBenchmarks:");
+
+    for(int i = 0; i < count; i++) Serial.printf(" %s", benchmarks[i].name);
+
+    Serial.println();
+
+    return 2;
+
+  }
+
+  mkdir(argv[1], 0755);
+  hostCardRoot(argv[1]);
+
+  arenaInit();
+  arenaSeal();
+
+  for(int i = 0; i < count; i++){
+
+    if(strcmp(argv[2], benchmarks[i].name) == 0) return benchmarks[i].run(argc - 3, argv + 3) ? 0 : 1;
+
+  }
+
+  Serial.printf("Unknown benchmark %s.\n", argv[2]);
+
+  return 2;
+
+}
@@ -0,0 +1,618 @@
+/*
+
+  Render regression test.
+
+  Runs the reference inputs in data/input through the playback chain and the DSP stages, and compares every output
+  sample with the golden WAV files in data/golden. Any difference fails the test, so a change that alters output has
+  to come with new golden files and a reason for them.
+
+    render_test <data directory>              Compare against golden files.
+    render_test <data directory> --update     Rewrite golden files from the current code.
+    render_test <data directory> --inputs     Rewrite reference inputs. Golden files must be updated after.
+
+  Each case prints its speed relative to real time, which is the host throughput of that stage.
+
+*/
+
+#include "host.h"
+#include "mono_file.h"
+#include "audio_arena.h"
+#include "edit_list.h"
+#include "time_stretch.h"
+#include "denoise.h"
+#include "decimator.h"
+#include "silence_trim.h"
+
+#define MAX_INPUT_SAMPLES 48000
+
+static fs::FS card;
+static bool update = false;
+static int failures = 0;
+
+static int16_t input[MAX_INPUT_SAMPLES];
+static int16_t output[4 * MAX_INPUT_SAMPLES];
+
+/*
+
+  Reference inputs. Written with their own encoder rather than the player's, so a bug in the player's WAV code can not
+  hide in its own test data.
+
+*/
+
+// Deterministic noise, -1.0 - 1.0.
+
+static double noise(){
+
+  static uint32_t state = 12345;
+
+  state = state * 1664525 + 1013904223;
+
+  return (int32_t)state / 2147483648.0;
+
+}
+
+// Voice-like signal: a 140Hz harmonic stack with a slow vibrato, an amplitude envelope and a little noise.
+
+static double voice(double t){
+
+  double f = 140 + 6 * sin(2 * M_PI * 5 * t);
+  double envelope = 0.55 + 0.4 * sin(2 * M_PI * 3 * t);
+  double v = 0;
+
+  for(int h = 1; h <= 8; h++) v += sin(2 * M_PI * f * h * t) / h;
+
+  return envelope * 0.6 * v + 0.01 * noise();
+
+}
+
+// Stereo inputs carry the signal on the left and half of it on the right, so their mono mix is three quarters of it.
+
+static void writeInput(const char * path, uint32_t rate, uint16_t format, uint16_t bits, double (*signal)(double, uint32_t), uint32_t samples, uint16_t channels = 1){
+
+  File file = card.open(path, FILE_WRITE);
+  uint32_t bytesPerSample = bits / 8;
+  uint32_t dataSize = samples * channels * bytesPerSample;
+  uint32_t riffSize = 36 + dataSize;
+  uint32_t fmtSize = 16;
+  uint32_t byteRate = rate * channels * bytesPerSample;
+  uint16_t blockAlign = channels * bytesPerSample;
+
+  file.write((const uint8_t *)"RIFF", 4);
+  file.write((const uint8_t *)&riffSize, 4);
+  file.write((const uint8_t *)"WAVEfmt ", 8);
+  file.write((const uint8_t *)&fmtSize, 4);
+  file.write((const uint8_t *)&format, 2);
+  file.write((const uint8_t *)&channels, 2);
+  file.write((const uint8_t *)&rate, 4);
+  file.write((const uint8_t *)&byteRate, 4);
+  file.write((const uint8_t *)&blockAlign, 2);
+  file.write((const uint8_t *)&bits, 2);
+  file.write((const uint8_t *)"data", 4);
+  file.write((const uint8_t *)&dataSize, 4);
+
+  for(uint32_t i = 0; i < samples; i++){
+
+    double v = signal((double)i / rate, i);
+
+    for(uint16_t c = 0; c < channels; c++, v *= 0.5){
+
+      double clamped = v > 1.0 ? 1.0 : v < -1.0 ? -1.0 : v;
+      uint8_t bytes[4];
+
+      if(format == 3){
+
+        float f = v;
+
+        memcpy(bytes, &f, 4);
+
+      }
+
+      else{
+
+        int32_t s = bits == 8 ? lround(clamped * 127) + 128 : lround(clamped * ((1 << (bits - 1)) - 1));
+
+        for(uint32_t b = 0; b < bytesPerSample; b++) bytes[b] = s >> (8 * b);
+
+      }
+
+      file.write(bytes, bytesPerSample);
+
+    }
+
+  }
+
+  file.close();
+
+}
+
+static double voiceInput(double t, uint32_t i){
+
+  return voice(t);
+
+}
+
+// Float input goes past full scale in places, which the decoder must clip.
+
+static double loudInput(double t, uint32_t i){
+
+  return 1.6 * voice(t);
+
+}
+
+// Half a second of room noise, then speech over it. For noise reduction, which learns from the start.
+
+static double noisyInput(double t, uint32_t i){
+
+  return (t < 0.5 ? 0 : voice(t)) + 0.03 * noise();
+
+}
+
+// Silence, a short phrase, silence, a second phrase, silence. For silence trimming.
+
+static double memoInput(double t, uint32_t i){
+
+  bool speaking = (t > 0.45 && t < 0.7) || (t > 0.95 && t < 1.1);
+
+  return (speaking ? voice(t) : 0) + 0.002 * noise();
+
+}
+
+// Exponential sweep from 50Hz to 20kHz. For decimation, where everything above the new Nyquist must be removed.
+
+static double sweepInput(double t, uint32_t i){
+
+  double duration = 0.25;
+  double k = log(20000.0 / 50);
+
+  return 0.8 * sin(2 * M_PI * 50 * duration / k * (exp(t / duration * k) - 1));
+
+}
+
+static void writeInputs(){
+
+  card.mkdir("/input");
+
+  writeInput("/input/voice16.wav", 44100, 1, 16, voiceInput, 13230);
+  writeInput("/input/u8.wav", 22050, 1, 8, voiceInput, 6615);
+  writeInput("/input/s24.wav", 16000, 1, 24, voiceInput, 4800);
+  writeInput("/input/s32.wav", 8000, 1, 32, voiceInput, 2400);
+  writeInput("/input/f32.wav", 44100, 3, 32, loudInput, 6615);
+  writeInput("/input/noisy16.wav", 16000, 1, 16, noisyInput, 16000);
+  writeInput("/input/memo16.wav", 16000, 1, 16, memoInput, 19200);
+  writeInput("/input/sweep48.wav", 48000, 1, 16, sweepInput, 12000);
+  writeInput("/input/stereo16.wav", 44100, 1, 16, voiceInput, 13230, 2);
+  writeInput("/input/stereo24.wav", 22050, 1, 24, voiceInput, 6615, 2);
+
+  // Same audio as voice16, rewritten with the data chunk on a sector boundary.
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+  AudioSink sink;
+
+  readMonoWAVHeader(card, "/input/voice16.wav", header, dataOffset);
+  setMonoWAVAlignment(SECTOR_SIZE);
+  sinkOpenWAVFile(sink, card, "/input/aligned16.wav", header.sample_rate);
+  renderMonoWAVFile(card, "/input/voice16.wav", sink, 1.0);
+  sinkClose(sink);
+  setMonoWAVAlignment(0);
+
+  Serial.println("Inputs written. Run with --update to make golden files for them.");
+
+}
+
+/*
+
+  Golden output. In update mode cases render into the golden file, otherwise into a compare sink on it.
+
+*/
+
+struct Output {
+
+  char path[64];
+  AudioSink sink;
+  unsigned long start;
+
+};
+
+static bool openOutput(Output &out, const char * name, uint32_t sample_rate){
+
+  snprintf(out.path, sizeof(out.path), "/golden/%s.wav", name);
+
+  bool ok = update ? sinkOpenWAVFile(out.sink, card, out.path, sample_rate) : sinkOpenCompare(out.sink, card, out.path);
+
+  if(!ok){
+
+    Serial.printf("FAIL %s: %s could not be opened.\n", name, out.path);
+
+    failures++;
+
+  }
+
+  out.start = micros();
+
+  return ok;
+
+}
+
+// Ends a case. seconds is the length of audio processed, for the real time figure.
+
+static void closeOutput(Output &out, const char * name, double seconds){
+
+  unsigned long elapsed = micros() - out.start;
+  double speed = elapsed ? seconds * 1000000.0 / elapsed : 0.0;
+
+  sinkClose(out.sink);
+
+  if(update){
+
+    Serial.printf("%-14s %6u samples written to %s.\n", name, out.sink.bytesWritten / 2, out.path);
+
+    return;
+
+  }
+
+  bool pass = out.sink.mismatches == 0 && out.sink.bytesWritten > 0;
+
+  if(!pass) failures++;
+
+  Serial.printf("%s %-14s %6u samples, %u mismatching, max error %d, %.0fx real time.\n", pass ? "ok  " : "FAIL", name,
+                out.sink.bytesWritten / 2, out.sink.mismatches, out.sink.maxError, speed);
+
+}
+
+// Decodes an input through the playback chain at unity gain. Returns number of samples.
+
+static size_t loadInput(const char * path, uint32_t &sample_rate){
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+  AudioSink sink;
+
+  if(!readMonoWAVHeader(card, path, header, dataOffset)) return 0;
+
+  sample_rate = header.sample_rate;
+
+  sinkInitMemory(sink, (uint8_t *)input, sizeof(input));
+
+  size_t n = renderMonoWAVFile(card, path, sink, 1.0);
+
+  return n < MAX_INPUT_SAMPLES ? n : MAX_INPUT_SAMPLES;
+
+}
+
+/*
+
+  Cases.
+
+*/
+
+static void renderCase(const char * name, const char * path, float gain){
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+  Output out;
+
+  if(!readMonoWAVHeader(card, path, header, dataOffset) || !openOutput(out, name, header.sample_rate)) return;
+
+  uint32_t n = renderMonoWAVFile(card, path, out.sink, gain);
+
+  closeOutput(out, name, (double)n / header.sample_rate);
+
+}
+
+static void editListCase(){
+
+  static EditList list;
+  Output out;
+
+  editListClear(list);
+  editListAdd(list, "/input/voice16.wav", 1000, 5000, 1.0);
+  editListAdd(list, "/input/aligned16.wav", 4000, 9000, 0.5);
+  editListAdd(list, "/input/f32.wav", 0, 3000, 0.8);
+  editListAdd(list, "/input/voice16.wav", 9000, 12000, 1.2);
+
+  if(!openOutput(out, "editlist", 44100)) return;
+
+  uint32_t n = renderEditList(card, list, out.sink);
+
+  closeOutput(out, "editlist", n / 44100.0);
+
+}
+
+// Plays into an A-B loop inside one read block with segment gain, four times round. Every pass must match the first,
+// so gain is never applied twice to samples the reader still holds.
+
+static void loopCase(){
+
+  static EditList list;
+  static EditPlayer player;
+  Output out;
+  uint8_t *data;
+  uint32_t total = 0;
+
+  editListClear(list);
+  editListAdd(list, "/input/voice16.wav", 0, 12000, 0.5);
+
+  if(!editPlayerOpen(player, card, list) || !openOutput(out, "loop", 44100)) return;
+
+  editPlayerSetLoop(player, 2000, 3000);
+
+  while(total < 6000){
+
+    size_t n = editPlayerNext(player, &data, CHUNK_SIZE);
+
+    if(n == 0) break;
+
+    sinkWrite(out.sink, data, n);
+
+    total += n / 2;
+
+  }
+
+  editPlayerClose(player);
+
+  closeOutput(out, "loop", total / 44100.0);
+
+}
+
+// Feeds stretcher the way audioTask() does, CHUNK_SIZE bytes at a time, and writes every frame it produces.
+
+static void stretchCase(const char * name, float speed){
+
+  static TimeStretch stretch;
+  int16_t frame[STRETCH_HOP];
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/voice16.wav", sample_rate);
+  size_t pushed = 0;
+  Output out;
+
+  if(!openOutput(out, name, sample_rate)) return;
+
+  stretchSetSpeed(stretch, speed);
+  stretchReset(stretch);
+
+  while(pushed < total){
+
+    size_t n = total - pushed < CHUNK_SIZE / 2 ? total - pushed : CHUNK_SIZE / 2;
+
+    pushed += stretchPush(stretch, input + pushed, n);
+
+    while(stretchPull(stretch, frame)) sinkWrite(out.sink, (const uint8_t *)frame, sizeof(frame));
+
+  }
+
+  while(stretchFinish(stretch, frame)) sinkWrite(out.sink, (const uint8_t *)frame, sizeof(frame));
+
+  closeOutput(out, name, (double)total / sample_rate);
+
+}
+
+// Hands out samples CHUNK_SIZE bytes at a time, standing in for the track's EditPlayer.
+
+struct MemoryTrack {
+
+  const int16_t *samples;
+  size_t total;
+  size_t read;
+
+};
+
+static size_t readMemoryTrack(void *context, uint8_t **data, size_t maxBytes){
+
+  MemoryTrack &track = *(MemoryTrack *)context;
+  size_t n = track.total - track.read < maxBytes / 2 ? track.total - track.read : maxBytes / 2;
+
+  *data = (uint8_t *)(track.samples + track.read);
+  track.read += n;
+
+  return n * sizeof(int16_t);
+
+}
+
+/*
+
+  stretchSwitch() - Plays samples through stretchNext(), as audioTask() does, switching speed when the output reaches
+  each time in switchAt, so stretching is switched on and off mid-track. Returns samples output.
+
+*/
+
+static uint32_t stretchSwitch(const int16_t *samples, size_t total, AudioSink &sink, const uint32_t *switchAt, const float *speeds, int switches){
+
+  static TimeStretch stretch;
+  int16_t frame[STRETCH_HOP];
+  MemoryTrack track = {samples, total, 0};
+  StretchReader reader = {readMemoryTrack, &track, CHUNK_SIZE};
+  uint32_t written = 0;
+  int current = 0;
+
+  stretchSetSpeed(stretch, speeds[0]);
+  stretchReset(stretch);
+
+  while(true){
+
+    if(current + 1 < switches && written >= switchAt[current + 1]) stretchSetSpeed(stretch, speeds[++current]);
+
+    const int16_t *block;
+    uint32_t sourceCount;
+    size_t n = stretchNext(stretch, reader, frame, &block, sourceCount);
+
+    if(n == 0) return written;
+
+    sinkWrite(sink, (const uint8_t *)block, n * sizeof(int16_t));
+
+    written += n;
+
+  }
+
+}
+
+static void stretchSwitchCase(){
+
+  const uint32_t switchAt[] = {0, 2940, 6615, 9555};
+  const float speeds[] = {1.0f, 1.5f, 1.0f, 0.75f};
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/voice16.wav", sample_rate);
+  Output out;
+
+  if(!openOutput(out, "stretch_switch", sample_rate)) return;
+
+  uint32_t n = stretchSwitch(input, total, out.sink, switchAt, speeds, 4);
+
+  closeOutput(out, "stretch_switch", (double)n / sample_rate);
+
+}
+
+static void denoiseCase(){
+
+  static NoiseReducer reducer;
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/noisy16.wav", sample_rate);
+  size_t produced = 0;
+  Output out;
+
+  if(!openOutput(out, "denoise", sample_rate)) return;
+
+  denoiseInit(reducer, sample_rate);
+
+  for(size_t i = 0; i < total; i += 256){
+
+    size_t n = total - i < 256 ? total - i : 256;
+
+    produced += denoiseProcess(reducer, input + i, output + produced, n);
+
+  }
+
+  produced += denoiseFinish(reducer, output + produced);
+
+  sinkWrite(out.sink, (const uint8_t *)output, produced * sizeof(int16_t));
+
+  closeOutput(out, "denoise", (double)total / sample_rate);
+
+}
+
+static void decimateCase(){
+
+  static Decimator decimator;
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/sweep48.wav", sample_rate);
+  size_t produced = 0;
+  Output out;
+
+  if(!decimatorInit(decimator, sample_rate, 16000) || !openOutput(out, "decimate", 16000)) return;
+
+  for(size_t i = 0; i < total; i += 256){
+
+    size_t n = total - i < 256 ? total - i : 256;
+
+    produced += decimatorProcess(decimator, input + i, output + produced, n);
+
+  }
+
+  sinkWrite(out.sink, (const uint8_t *)output, produced * sizeof(int16_t));
+
+  closeOutput(out, "decimate", (double)total / sample_rate);
+
+}
+
+// voice16 as the built in ADC would capture it, 300 LSB off mid-rail, through conditionADCSamples(). The DC blocker
+// must take the offset off and leave the voice as it was, apart from its lowest frequencies.
+
+static void adcCase(){
+
+  static uint16_t raw[MAX_INPUT_SAMPLES];
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/voice16.wav", sample_rate);
+  float prev = 0;
+  Output out;
+
+  if(!openOutput(out, "adc", sample_rate)) return;
+
+  for(size_t i = 0; i < total; i++) raw[i] = (uint16_t)((input[i] >> 5) + 2048 + 300);
+
+  for(size_t i = 0; i < total; i += 256) conditionADCSamples(raw + i, output + i, total - i < 256 ? total - i : 256, prev);
+
+  sinkWrite(out.sink, (const uint8_t *)output, total * sizeof(int16_t));
+
+  closeOutput(out, "adc", (double)total / sample_rate);
+
+}
+
+static void trimCase(){
+
+  static SilenceTrimmer trimmer;
+  uint32_t sample_rate;
+  size_t total = loadInput("/input/memo16.wav", sample_rate);
+  Output out;
+
+  if(!openOutput(out, "trim", sample_rate)) return;
+
+  if(!trimmerInit(trimmer, out.sink, sample_rate, TRIM_THRESHOLD, TRIM_PREROLL_MS, TRIM_HANG_MS)){
+
+    failures++;
+
+    return;
+
+  }
+
+  for(size_t i = 0; i < total; i += 256) trimmerWrite(trimmer, input + i, total - i < 256 ? total - i : 256);
+
+  trimmerFinish(trimmer);
+
+  closeOutput(out, "trim", (double)total / sample_rate);
+
+}
+
+int main(int argc, char **argv){
+
+  if(argc < 2){
+
+    Serial.println("Usage: render_test <data directory> [--update | --inputs]");
+
+    return 2;
+
+  }
+
+  hostCardRoot(argv[1]);
+
+  update = argc > 2 && strcmp(argv[2], "--update") == 0;
+
+  arenaInit();
+  arenaSeal();
+
+  if(argc > 2 && strcmp(argv[2], "--inputs") == 0){
+
+    writeInputs();
+
+    return 0;
+
+  }
+
+  if(update) card.mkdir("/golden");
+
+  renderCase("voice16", "/input/voice16.wav", 0.7);
+  renderCase("voice16_clip", "/input/voice16.wav", 1.8);
+  renderCase("u8", "/input/u8.wav", 0.7);
+  renderCase("s24", "/input/s24.wav", 0.7);
+  renderCase("s32", "/input/s32.wav", 0.7);
+  renderCase("f32", "/input/f32.wav", 0.7);
+  renderCase("aligned16", "/input/aligned16.wav", 0.7);
+  renderCase("stereo16", "/input/stereo16.wav", 0.7);
+  renderCase("stereo24", "/input/stereo24.wav", 0.7);
+
+  editListCase();
+  loopCase();
+  stretchCase("stretch_075", 0.75);
+  stretchCase("stretch_150", 1.5);
+  stretchSwitchCase();
+  denoiseCase();
+  decimateCase();
+  adcCase();
+  trimCase();
+
+  if(update) return 0;
+
+  Serial.printf(failures ? "%d render cases failed.\n" : "All render cases match.\n", failures);
+
+  return failures ? 1 : 0;
+
+}
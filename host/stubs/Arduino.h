@@ -0,0 +1,111 @@
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+// Host stand-in for the parts of the Arduino ESP32 core used by the player. See host.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_heap_caps.h"
+
+#define IRAM_ATTR
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define LOW 0
+#define HIGH 1
+
+class String {
+
+  public:
+
+    String(const char * text = "") : text(text ? text : "") {}
+
+    const char *c_str() const { return text.c_str(); }
+    size_t length() const { return text.size(); }
+
+  private:
+
+    std::string text;
+
+};
+
+class HardwareSerial {
+
+  public:
+
+    void begin(unsigned long baud) {}
+    void updateBaudRate(unsigned long baud) {}
+    void setRxBufferSize(size_t size) {}
+    void setTimeout(unsigned long ms) {}
+    void flush() {}
+
+    size_t printf(const char * format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const char * text);
+    size_t print(const String &text) { return print(text.c_str()); }
+    size_t print(char c);
+    size_t print(long long n);
+    size_t print(unsigned long long n);
+    size_t print(int n) { return print((long long)n); }
+    size_t print(unsigned int n) { return print((unsigned long long)n); }
+    size_t print(long n) { return print((long long)n); }
+    size_t print(unsigned long n) { return print((unsigned long long)n); }
+    size_t print(double n);
+
+    size_t println() { return print("\n"); }
+    template <typename T> size_t println(T value) { return print(value) + println(); }
+
+    size_t write(uint8_t c);
+    size_t write(const uint8_t * data, size_t size);
+
+    int available();
+    int read();
+    size_t readBytes(uint8_t * buffer, size_t length);
+
+};
+
+class EspClass {
+
+  public:
+
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getCpuFreqMHz();
+    uint32_t getCycleCount();
+    uint32_t getPsramSize();
+    uint32_t getFreePsram();
+
+};
+
+extern HardwareSerial Serial;
+extern EspClass ESP;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+bool psramFound();
+void *ps_malloc(size_t size);
+
+int analogRead(uint8_t pin);
+int digitalRead(uint8_t pin);
+void pinMode(uint8_t pin, uint8_t mode);
+
+#endif
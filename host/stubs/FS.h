@@ -0,0 +1,80 @@
+#ifndef _HOST_FS_H
+#define _HOST_FS_H
+
+// Host stand-in for the Arduino FS API, backed by a directory on the host. See host.h.
+
+#include <Arduino.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct FileImpl;
+
+class File {
+
+  public:
+
+    File() {}
+    File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+    operator bool() const { return (bool)impl; }
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t * buffer, size_t size);
+    size_t print(const char * text) { return write((const uint8_t *)text, strlen(text)); }
+    int available();
+    int read();
+    int peek();
+    size_t read(uint8_t * buffer, size_t size);
+    void flush();
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close() { impl.reset(); }
+
+    const char *path() const;
+    const char *name() const;
+    bool isDirectory() const;
+    File openNextFile(const char * mode = FILE_READ);
+
+  private:
+
+    std::shared_ptr<FileImpl> impl;
+
+};
+
+class FS {
+
+  public:
+
+    File open(const char * path, const char * mode = FILE_READ, const bool create = false);
+    File open(const String &path, const char * mode = FILE_READ, const bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char * path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char * path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char * from, const char * to);
+    bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char * path);
+    bool mkdir(const String &path) { return mkdir(path.c_str()); }
+    bool rmdir(const char * path);
+    bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+};
+
+}
+
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _HOST_SD_MMC_H
+#define _HOST_SD_MMC_H
+
+#include "FS.h"
+
+typedef enum {
+
+  CARD_NONE,
+  CARD_MMC,
+  CARD_SD,
+  CARD_SDHC,
+  CARD_UNKNOWN
+
+} sdcard_type_t;
+
+#define SDMMC_FREQ_DEFAULT 20000
+#define SDMMC_FREQ_HIGHSPEED 40000
+
+class SDMMCFS : public fs::FS {
+
+  public:
+
+    bool setPins(int clk, int cmd, int d0) { return true; }
+    bool begin(const char * mountpoint = "/sdcard", bool mode1bit = false, bool formatOnFail = false,
+               int sdmmcFrequency = SDMMC_FREQ_DEFAULT, uint8_t maxOpenFiles = 5) { return true; }
+    void end() {}
+    sdcard_type_t cardType() { return CARD_SDHC; }
+    uint64_t cardSize() { return 32ULL << 30; }
+    uint64_t totalBytes() { return 32ULL << 30; }
+    uint64_t usedBytes() { return 0; }
+
+};
+
+extern SDMMCFS SD_MMC;
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef _HOST_ADC_H
+#define _HOST_ADC_H
+
+typedef enum { ADC_UNIT_1 = 1, ADC_UNIT_2 = 2 } adc_unit_t;
+typedef enum { ADC1_CHANNEL_0 = 0, ADC1_CHANNEL_4 = 4, ADC1_CHANNEL_MAX = 8 } adc1_channel_t;
+
+#endif
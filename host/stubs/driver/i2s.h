@@ -0,0 +1,85 @@
+#ifndef _HOST_I2S_H
+#define _HOST_I2S_H
+
+// Host stand-in for the legacy ESP-IDF I2S driver. See host.h for how writes, reads and events behave.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/adc.h"
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+
+#define I2S_PIN_NO_CHANGE -1
+
+typedef enum { I2S_NUM_0, I2S_NUM_1, I2S_NUM_MAX } i2s_port_t;
+
+typedef enum {
+
+  I2S_MODE_MASTER = 1 << 0,
+  I2S_MODE_SLAVE = 1 << 1,
+  I2S_MODE_TX = 1 << 2,
+  I2S_MODE_RX = 1 << 3,
+  I2S_MODE_DAC_BUILT_IN = 1 << 4,
+  I2S_MODE_ADC_BUILT_IN = 1 << 5
+
+} i2s_mode_t;
+
+typedef enum { I2S_BITS_PER_SAMPLE_16BIT = 16, I2S_BITS_PER_SAMPLE_32BIT = 32 } i2s_bits_per_sample_t;
+typedef enum { I2S_CHANNEL_FMT_RIGHT_LEFT, I2S_CHANNEL_FMT_ALL_RIGHT, I2S_CHANNEL_FMT_ALL_LEFT, I2S_CHANNEL_FMT_ONLY_RIGHT, I2S_CHANNEL_FMT_ONLY_LEFT } i2s_channel_fmt_t;
+typedef enum { I2S_COMM_FORMAT_STAND_I2S = 1, I2S_COMM_FORMAT_I2S = 1 } i2s_comm_format_t;
+
+typedef struct {
+
+  i2s_mode_t mode;
+  uint32_t sample_rate;
+  i2s_bits_per_sample_t bits_per_sample;
+  i2s_channel_fmt_t channel_format;
+  i2s_comm_format_t communication_format;
+  int intr_alloc_flags;
+  int dma_buf_count;
+  int dma_buf_len;
+  bool use_apll;
+  bool tx_desc_auto_clear;
+  int fixed_mclk;
+
+} i2s_config_t;
+
+typedef struct {
+
+  int mck_io_num;
+  int bck_io_num;
+  int ws_io_num;
+  int data_out_num;
+  int data_in_num;
+
+} i2s_pin_config_t;
+
+typedef enum { I2S_EVENT_DMA_ERROR, I2S_EVENT_TX_DONE, I2S_EVENT_RX_DONE, I2S_EVENT_TX_Q_OVF, I2S_EVENT_RX_Q_OVF } i2s_event_type_t;
+
+typedef struct {
+
+  i2s_event_type_t type;
+  size_t size;
+
+} i2s_event_t;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t * config, int queueSize, void * queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t * pins);
+esp_err_t i2s_set_sample_rates(i2s_port_t port, uint32_t rate);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port);
+esp_err_t i2s_start(i2s_port_t port);
+esp_err_t i2s_stop(i2s_port_t port);
+esp_err_t i2s_write(i2s_port_t port, const void * src, size_t size, size_t * bytesWritten, TickType_t ticks);
+esp_err_t i2s_read(i2s_port_t port, void * dest, size_t size, size_t * bytesRead, TickType_t ticks);
+esp_err_t i2s_set_adc_mode(adc_unit_t unit, adc1_channel_t channel);
+esp_err_t i2s_adc_enable(i2s_port_t port);
+esp_err_t i2s_adc_disable(i2s_port_t port);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+// Host stand-in for the FreeRTOS API used by the player. Tasks are threads, ticks are milliseconds. See host.h.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef struct HostTask *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_FULL 0
+
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configTICK_RATE_HZ 1000
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _HOST_QUEUE_H
+#define _HOST_QUEUE_H
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t ticks);
+BaseType_t xQueuePeek(QueueHandle_t queue, void * item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+
+#define xQueueSendToBack xQueueSend
+
+#endif
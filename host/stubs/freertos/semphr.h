@@ -0,0 +1,15 @@
+#ifndef _HOST_SEMPHR_H
+#define _HOST_SEMPHR_H
+
+#include "queue.h"
+
+// Semaphores are queues of zero size items, as in FreeRTOS. Mutexes start full.
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+#endif
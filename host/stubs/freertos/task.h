@@ -0,0 +1,20 @@
+#ifndef _HOST_TASK_H
+#define _HOST_TASK_H
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char * name, uint32_t stackDepth, void * parameters,
+                                   UBaseType_t priority, TaskHandle_t * handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t function, const char * name, uint32_t stackDepth, void * parameters,
+                       UBaseType_t priority, TaskHandle_t * handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t xPortGetCoreID();
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#endif
@@ -0,0 +1,1046 @@
+#include "host.h"
+#include "FS.h"
+#include "SD_MMC.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+SDMMCFS SD_MMC;
+
+static std::string cardRoot = "card";
+static int serialFd = -1;
+static std::mutex serialMutex;
+static std::atomic<uint32_t> cpuMHz(240);
+static std::atomic<size_t> minFreeHeap(HOST_HEAP_BYTES);
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+/*
+
+  Board.
+
+*/
+
+void hostCardRoot(const char * root){
+
+  cardRoot = root;
+
+}
+
+// Returns host path of a card path. Valid until the next call from the same thread.
+
+const char *hostCardPath(const char * path){
+
+  static thread_local std::string hostPath;
+
+  hostPath = cardRoot + (path[0] == '/' ? "" : "/") + path;
+
+  return hostPath.c_str();
+
+}
+
+unsigned long micros(){
+
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+
+}
+
+unsigned long millis(){
+
+  return micros() / 1000;
+
+}
+
+void delay(uint32_t ms){
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+
+}
+
+void delayMicroseconds(uint32_t us){
+
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz){
+
+  cpuMHz = mhz;
+
+  return true;
+
+}
+
+uint32_t getCpuFrequencyMhz(){
+
+  return cpuMHz;
+
+}
+
+int analogRead(uint8_t pin){
+
+  return 0;
+
+}
+
+int digitalRead(uint8_t pin){
+
+  return LOW;
+
+}
+
+void pinMode(uint8_t pin, uint8_t mode){}
+
+/*
+
+  Heap. Free heap is a fixed size minus what glibc has handed out, so before / after differences are real allocations
+  made by the code under test, including ones made by the stubs for open files and directories.
+
+*/
+
+static size_t freeHeap(){
+
+  size_t used = mallinfo2().uordblks;
+  size_t free = used < HOST_HEAP_BYTES ? HOST_HEAP_BYTES - used : 0;
+  size_t min = minFreeHeap.load();
+
+  while(free < min && !minFreeHeap.compare_exchange_weak(min, free));
+
+  return free;
+
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps){
+
+  void *p = malloc(size);
+
+  freeHeap();
+
+  return p;
+
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps){
+
+  void *p = calloc(n, size);
+
+  freeHeap();
+
+  return p;
+
+}
+
+void heap_caps_free(void * ptr){
+
+  free(ptr);
+
+}
+
+size_t heap_caps_get_free_size(uint32_t caps){
+
+  return freeHeap();
+
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps){
+
+  freeHeap();
+
+  return minFreeHeap;
+
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps){
+
+  return freeHeap();
+
+}
+
+bool psramFound(){
+
+  return true;
+
+}
+
+void *ps_malloc(size_t size){
+
+  return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+
+}
+
+uint32_t EspClass::getFreeHeap(){
+
+  return freeHeap();
+
+}
+
+uint32_t EspClass::getMinFreeHeap(){
+
+  return heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+
+}
+
+uint32_t EspClass::getMaxAllocHeap(){
+
+  return freeHeap();
+
+}
+
+uint32_t EspClass::getCpuFreqMHz(){
+
+  return cpuMHz;
+
+}
+
+// Host time in cycles of the stub CPU frequency. See host.h.
+
+uint32_t EspClass::getCycleCount(){
+
+  uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - bootTime).count();
+
+  return (uint32_t)(ns * cpuMHz / 1000);
+
+}
+
+uint32_t EspClass::getPsramSize(){
+
+  return 4 * 1024 * 1024;
+
+}
+
+uint32_t EspClass::getFreePsram(){
+
+  return 4 * 1024 * 1024;
+
+}
+
+/*
+
+  Serial.
+
+*/
+
+void hostSerialAttach(int fd){
+
+  serialFd = fd;
+
+}
+
+size_t HardwareSerial::write(const uint8_t * data, size_t size){
+
+  std::lock_guard<std::mutex> lock(serialMutex);
+
+  if(serialFd < 0) return fwrite(data, 1, size, stdout);
+
+  size_t done = 0;
+
+  while(done < size){
+
+    ssize_t n = ::write(serialFd, data + done, size - done);
+
+    if(n > 0) done += n;
+    else if(n < 0 && errno != EAGAIN && errno != EINTR) break;
+    else std::this_thread::yield();
+
+  }
+
+  return done;
+
+}
+
+size_t HardwareSerial::write(uint8_t c){
+
+  return write(&c, 1);
+
+}
+
+size_t HardwareSerial::printf(const char * format, ...){
+
+  char text[1024];
+  va_list args;
+
+  va_start(args, format);
+  int n = vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  if(n < 0) return 0;
+
+  return write((const uint8_t *)text, (size_t)n < sizeof(text) ? n : sizeof(text) - 1);
+
+}
+
+size_t HardwareSerial::print(const char * text){
+
+  return write((const uint8_t *)text, strlen(text));
+
+}
+
+size_t HardwareSerial::print(char c){
+
+  return write((uint8_t)c);
+
+}
+
+size_t HardwareSerial::print(long long n){
+
+  return printf("%lld", n);
+
+}
+
+size_t HardwareSerial::print(unsigned long long n){
+
+  return printf("%llu", n);
+
+}
+
+size_t HardwareSerial::print(double n){
+
+  return printf("%.2f", n);
+
+}
+
+int HardwareSerial::available(){
+
+  int n = 0;
+
+  if(serialFd < 0 || ioctl(serialFd, FIONREAD, &n) < 0) return 0;
+
+  return n;
+
+}
+
+int HardwareSerial::read(){
+
+  uint8_t c;
+
+  return readBytes(&c, 1) == 1 ? c : -1;
+
+}
+
+size_t HardwareSerial::readBytes(uint8_t * buffer, size_t length){
+
+  if(serialFd < 0) return 0;
+
+  ssize_t n = ::read(serialFd, buffer, length);
+
+  return n > 0 ? n : 0;
+
+}
+
+/*
+
+  File system. Paths are card paths, i.e. "/music/a.wav". As on FAT, rename does not replace an existing file.
+
+  Reads are also counted as the card transfers FatFs would make for them. Whole sectors go straight to the caller in
+  one transfer, a partial sector is read into the file's one sector window unless it is already there.
+
+*/
+
+#define HOST_SECTOR_SIZE 512
+
+static uint32_t cardReads = 0;
+
+uint32_t hostCardReads(){
+
+  return cardReads;
+
+}
+
+namespace fs {
+
+struct FileImpl {
+
+  FILE *file;
+  DIR *dir;
+  std::string path;
+  std::string name;
+  bool writing;
+  long window;
+
+  FileImpl(const std::string &path) : file(NULL), dir(NULL), path(path), writing(false), window(-1) {
+
+    size_t slash = path.rfind('/');
+
+    name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+  }
+
+  ~FileImpl(){
+
+    if(file) fclose(file);
+    if(dir) closedir(dir);
+
+  }
+
+  // stdio needs a seek between reads and writes on the same stream.
+
+  void direction(bool write){
+
+    if(file && write != writing) fseek(file, 0, SEEK_CUR);
+
+    writing = write;
+
+  }
+
+};
+
+size_t File::write(const uint8_t * buffer, size_t size){
+
+  if(!impl || !impl->file) return 0;
+
+  impl->direction(true);
+
+  impl->window = -1;
+
+  return fwrite(buffer, 1, size, impl->file);
+
+}
+
+int File::available(){
+
+  return impl && impl->file ? (int)(size() - position()) : 0;
+
+}
+
+int File::read(){
+
+  uint8_t c;
+
+  return read(&c, 1) == 1 ? c : -1;
+
+}
+
+int File::peek(){
+
+  if(!impl || !impl->file) return -1;
+
+  impl->direction(false);
+
+  int c = fgetc(impl->file);
+
+  if(c != EOF) ungetc(c, impl->file);
+
+  return c;
+
+}
+
+size_t File::read(uint8_t * buffer, size_t size){
+
+  if(!impl || !impl->file) return 0;
+
+  impl->direction(false);
+
+  long start = ftell(impl->file);
+  size_t n = fread(buffer, 1, size, impl->file);
+
+  if(n == 0) return 0;
+
+  long end = start + n;
+  long sector = start / HOST_SECTOR_SIZE;
+
+  // Leading partial sector, whole sectors, trailing partial sector.
+
+  if(start % HOST_SECTOR_SIZE){
+
+    if(impl->window != sector) cardReads++;
+
+    impl->window = sector++;
+
+  }
+
+  if(end / HOST_SECTOR_SIZE > sector) cardReads++;
+
+  if(end % HOST_SECTOR_SIZE && end / HOST_SECTOR_SIZE >= sector){
+
+    if(impl->window != end / HOST_SECTOR_SIZE) cardReads++;
+
+    impl->window = end / HOST_SECTOR_SIZE;
+
+  }
+
+  return n;
+
+}
+
+void File::flush(){
+
+  if(impl && impl->file) fflush(impl->file);
+
+}
+
+bool File::seek(uint32_t pos, SeekMode mode){
+
+  if(!impl || !impl->file) return false;
+
+  return fseek(impl->file, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0;
+
+}
+
+size_t File::position() const {
+
+  return impl && impl->file ? ftell(impl->file) : 0;
+
+}
+
+size_t File::size() const {
+
+  struct stat info;
+
+  if(!impl || !impl->file) return 0;
+
+  fflush(impl->file);
+
+  return fstat(fileno(impl->file), &info) == 0 ? info.st_size : 0;
+
+}
+
+const char *File::path() const {
+
+  return impl ? impl->path.c_str() : NULL;
+
+}
+
+const char *File::name() const {
+
+  return impl ? impl->name.c_str() : NULL;
+
+}
+
+bool File::isDirectory() const {
+
+  return impl && impl->dir;
+
+}
+
+File File::openNextFile(const char * mode){
+
+  if(!impl || !impl->dir) return File();
+
+  struct dirent *entry;
+
+  while((entry = readdir(impl->dir)) != NULL){
+
+    if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+    std::string child = impl->path == "/" ? "/" + std::string(entry->d_name) : impl->path + "/" + entry->d_name;
+
+    return FS().open(child.c_str(), mode);
+
+  }
+
+  return File();
+
+}
+
+File FS::open(const char * path, const char * mode, const bool create){
+
+  std::string host = hostCardPath(path);
+  std::shared_ptr<FileImpl> impl = std::make_shared<FileImpl>(path);
+  struct stat info;
+
+  if(stat(host.c_str(), &info) == 0 && S_ISDIR(info.st_mode)){
+
+    impl->dir = opendir(host.c_str());
+
+    return impl->dir ? File(impl) : File();
+
+  }
+
+  const char *hostMode = strcmp(mode, FILE_WRITE) == 0 ? "w+b" : strcmp(mode, FILE_APPEND) == 0 ? "a+b" : strcmp(mode, "r+") == 0 ? "r+b" : "rb";
+
+  impl->file = fopen(host.c_str(), hostMode);
+
+  return impl->file ? File(impl) : File();
+
+}
+
+bool FS::exists(const char * path){
+
+  struct stat info;
+
+  return stat(hostCardPath(path), &info) == 0;
+
+}
+
+bool FS::remove(const char * path){
+
+  return unlink(hostCardPath(path)) == 0;
+
+}
+
+bool FS::rename(const char * from, const char * to){
+
+  std::string hostFrom = hostCardPath(from);
+
+  if(exists(to)) return false;
+
+  return ::rename(hostFrom.c_str(), hostCardPath(to)) == 0;
+
+}
+
+bool FS::mkdir(const char * path){
+
+  return ::mkdir(hostCardPath(path), 0755) == 0;
+
+}
+
+bool FS::rmdir(const char * path){
+
+  return ::rmdir(hostCardPath(path)) == 0;
+
+}
+
+}
+
+/*
+
+  FreeRTOS. Queues and semaphores share one type, semaphores having zero size items.
+
+*/
+
+struct HostQueue {
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t count;
+  std::deque<std::string> items;
+
+};
+
+struct HostTask {
+
+  std::mutex mutex;
+  std::condition_variable notified;
+  uint32_t notifications;
+  uint32_t stackDepth;
+  BaseType_t core;
+
+};
+
+struct HostTaskExit {};
+
+static thread_local HostTask *currentTask = NULL;
+
+template <typename Predicate> static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate ready){
+
+  if(ticks == portMAX_DELAY){
+
+    cv.wait(lock, ready);
+
+    return true;
+
+  }
+
+  return cv.wait_for(lock, std::chrono::milliseconds(ticks), ready);
+
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize){
+
+  HostQueue *queue = new HostQueue();
+
+  queue->length = length;
+  queue->itemSize = itemSize;
+  queue->count = 0;
+
+  return queue;
+
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * item, TickType_t ticks){
+
+  std::unique_lock<std::mutex> lock(queue->mutex);
+
+  if(!waitFor(queue->changed, lock, ticks, [queue]{ return queue->count < queue->length; })) return errQUEUE_FULL;
+
+  if(queue->itemSize) queue->items.push_back(std::string((const char *)item, queue->itemSize));
+
+  queue->count++;
+  queue->changed.notify_all();
+
+  return pdPASS;
+
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * item, TickType_t ticks){
+
+  std::unique_lock<std::mutex> lock(queue->mutex);
+
+  if(!waitFor(queue->changed, lock, ticks, [queue]{ return queue->count > 0; })) return pdFALSE;
+
+  if(queue->itemSize){
+
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+
+    queue->items.pop_front();
+
+  }
+
+  queue->count--;
+  queue->changed.notify_all();
+
+  return pdTRUE;
+
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void * item, TickType_t ticks){
+
+  std::unique_lock<std::mutex> lock(queue->mutex);
+
+  if(!waitFor(queue->changed, lock, ticks, [queue]{ return queue->count > 0; })) return pdFALSE;
+
+  if(queue->itemSize) memcpy(item, queue->items.front().data(), queue->itemSize);
+
+  return pdTRUE;
+
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue){
+
+  std::lock_guard<std::mutex> lock(queue->mutex);
+
+  queue->items.clear();
+  queue->count = 0;
+  queue->changed.notify_all();
+
+  return pdPASS;
+
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue){
+
+  std::lock_guard<std::mutex> lock(queue->mutex);
+
+  return queue->count;
+
+}
+
+void vQueueDelete(QueueHandle_t queue){
+
+  delete queue;
+
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount){
+
+  QueueHandle_t semaphore = xQueueCreate(maxCount, 0);
+
+  semaphore->count = initialCount;
+
+  return semaphore;
+
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(){
+
+  return xSemaphoreCreateCounting(1, 1);
+
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(){
+
+  return xSemaphoreCreateCounting(1, 0);
+
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks){
+
+  return xQueueReceive(semaphore, NULL, ticks);
+
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore){
+
+  return xQueueSend(semaphore, NULL, 0);
+
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore){
+
+  vQueueDelete(semaphore);
+
+}
+
+// Tasks never free their handle, since other tasks may still hold it.
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char * name, uint32_t stackDepth, void * parameters,
+                                   UBaseType_t priority, TaskHandle_t * handle, BaseType_t core){
+
+  HostTask *task = new HostTask();
+
+  task->notifications = 0;
+  task->stackDepth = stackDepth;
+  task->core = core == tskNO_AFFINITY ? 0 : core;
+
+  if(handle) *handle = task;
+
+  std::thread([task, function, parameters]{
+
+    currentTask = task;
+
+    try{
+
+      function(parameters);
+
+    }
+    catch(HostTaskExit &){}
+
+  }).detach();
+
+  return pdPASS;
+
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char * name, uint32_t stackDepth, void * parameters,
+                       UBaseType_t priority, TaskHandle_t * handle){
+
+  return xTaskCreatePinnedToCore(function, name, stackDepth, parameters, priority, handle, tskNO_AFFINITY);
+
+}
+
+// The main thread stands in for Arduino's loopTask, which runs on core 1.
+
+TaskHandle_t xTaskGetCurrentTaskHandle(){
+
+  if(!currentTask){
+
+    currentTask = new HostTask();
+
+    currentTask->notifications = 0;
+    currentTask->stackDepth = 8192;
+    currentTask->core = 1;
+
+  }
+
+  return currentTask;
+
+}
+
+// Only a task deleting itself is supported, which is all the player does.
+
+void vTaskDelete(TaskHandle_t task){
+
+  if(task == NULL || task == currentTask) throw HostTaskExit();
+
+}
+
+void vTaskDelay(TickType_t ticks){
+
+  if(ticks == 0) std::this_thread::yield();
+  else std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+
+}
+
+TickType_t xTaskGetTickCount(){
+
+  return millis();
+
+}
+
+// Host stacks are not measured, the stack size asked for is reported as unused.
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task){
+
+  return task ? task->stackDepth : xTaskGetCurrentTaskHandle()->stackDepth;
+
+}
+
+BaseType_t xPortGetCoreID(){
+
+  return xTaskGetCurrentTaskHandle()->core;
+
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task){
+
+  std::lock_guard<std::mutex> lock(task->mutex);
+
+  task->notifications++;
+  task->notified.notify_all();
+
+  return pdPASS;
+
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks){
+
+  HostTask *task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->mutex);
+
+  if(!waitFor(task->notified, lock, ticks, [task]{ return task->notifications > 0; })) return 0;
+
+  uint32_t value = task->notifications;
+
+  task->notifications = clearOnExit ? 0 : value - 1;
+
+  return value;
+
+}
+
+/*
+
+  I2S. Writes are taken immediately. Capture reads come from the capture source, or are mid-rail silence in the raw
+  format of the built in ADC, channel in the top 4 bits.
+
+*/
+
+struct HostI2SPort {
+
+  bool installed;
+  QueueHandle_t events;
+  uint32_t sampleRate;
+  uint32_t written;
+
+};
+
+static HostI2SPort ports[I2S_NUM_MAX];
+static hostCaptureFunction captureSource = NULL;
+
+void hostCaptureSource(hostCaptureFunction source){
+
+  captureSource = source;
+
+}
+
+bool hostI2SEvent(i2s_port_t port, i2s_event_type_t type){
+
+  i2s_event_t event = {type, 0};
+
+  return ports[port].installed && ports[port].events && xQueueSend(ports[port].events, &event, 0) == pdPASS;
+
+}
+
+uint32_t hostI2SWritten(i2s_port_t port){
+
+  return ports[port].written;
+
+}
+
+uint32_t hostI2SRate(i2s_port_t port){
+
+  return ports[port].sampleRate;
+
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t * config, int queueSize, void * queue){
+
+  if(port >= I2S_NUM_MAX || ports[port].installed) return ESP_ERR_INVALID_STATE;
+
+  ports[port].installed = true;
+  ports[port].sampleRate = config->sample_rate;
+  ports[port].events = queue && queueSize > 0 ? xQueueCreate(queueSize, sizeof(i2s_event_t)) : NULL;
+
+  if(queue) *(QueueHandle_t *)queue = ports[port].events;
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port){
+
+  if(port >= I2S_NUM_MAX || !ports[port].installed) return ESP_ERR_INVALID_STATE;
+
+  if(ports[port].events) vQueueDelete(ports[port].events);
+
+  ports[port].installed = false;
+  ports[port].events = NULL;
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t * pins){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_set_sample_rates(i2s_port_t port, uint32_t rate){
+
+  if(port >= I2S_NUM_MAX || !ports[port].installed) return ESP_ERR_INVALID_STATE;
+
+  ports[port].sampleRate = rate;
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_start(i2s_port_t port){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_stop(i2s_port_t port){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void * src, size_t size, size_t * bytesWritten, TickType_t ticks){
+
+  if(port >= I2S_NUM_MAX || !ports[port].installed) return ESP_ERR_INVALID_STATE;
+
+  ports[port].written += size;
+
+  if(bytesWritten) *bytesWritten = size;
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_read(i2s_port_t port, void * dest, size_t size, size_t * bytesRead, TickType_t ticks){
+
+  if(port >= I2S_NUM_MAX || !ports[port].installed) return ESP_ERR_INVALID_STATE;
+
+  uint16_t *raw = (uint16_t *)dest;
+  size_t sampleCount = size / sizeof(uint16_t);
+  size_t n = captureSource ? captureSource(raw, sampleCount) : 0;
+
+  for(size_t i = n; i < sampleCount; i++) raw[i] = (ADC1_CHANNEL_4 << 12) | 2048;
+
+  if(bytesRead) *bytesRead = sampleCount * sizeof(uint16_t);
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_set_adc_mode(adc_unit_t unit, adc1_channel_t channel){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_adc_enable(i2s_port_t port){
+
+  return ESP_OK;
+
+}
+
+esp_err_t i2s_adc_disable(i2s_port_t port){
+
+  return ESP_OK;
+
+}
@@ -0,0 +1,40 @@
+#ifndef _HOST_H
+#define _HOST_H
+
+/*
+
+  Linux host stand-in for the ESP32 board.
+
+  The stubs in this directory replace the Arduino core, SD_MMC, the legacy I2S driver and FreeRTOS, so the player's
+  modules build unchanged with a normal compiler. They are only as deep as the player needs:
+
+    SD_MMC - A directory on the host, "card" under the working directory unless hostCardRoot() is called. Reads are
+    counted as FatFs card transfers, see hostCardReads().
+    Serial - stdout, or a file descriptor set with hostSerialAttach(), i.e. a pseudo-terminal for the transfer test.
+    Tasks - One thread each. Mutexes, semaphores, notifications and queues behave like FreeRTOS ones.
+    I2S - Writes are accepted immediately. Reads return the capture source set with hostCaptureSource(), or mid-rail
+    silence. Events can be queued with hostI2SEvent().
+    Heap - getFreeHeap() is HOST_HEAP_BYTES minus glibc's bytes in use, so differences are real allocations.
+
+  Cycle counts are host time scaled to the stub CPU frequency, 240MHz unless changed with setCpuFrequencyMhz(). Real
+  time checks that compare cycles against CPU MHz therefore hold for the host machine. They are not ESP32 cycle counts.
+
+*/
+
+#include <Arduino.h>
+#include "driver/i2s.h"
+
+#define HOST_HEAP_BYTES (320 * 1024 * 1024)
+
+typedef size_t (*hostCaptureFunction)(uint16_t *raw, size_t sampleCount);
+
+void hostCardRoot(const char * root);
+const char *hostCardPath(const char * path);
+void hostSerialAttach(int fd);
+void hostCaptureSource(hostCaptureFunction source);
+bool hostI2SEvent(i2s_port_t port, i2s_event_type_t type);
+uint32_t hostI2SWritten(i2s_port_t port);
+uint32_t hostI2SRate(i2s_port_t port);
+uint32_t hostCardReads();
+
+#endif
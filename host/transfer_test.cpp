@@ -0,0 +1,183 @@
+/*
+
+  Serial transfer loopback test.
+
+  Runs the device side of serial_transfer.cpp on one end of a pseudo-terminal and tools/send_wav.py on the other, so
+  the real host tool and the real device code talk through a serial line. The file is sent twice:
+
+    1. Fresh transfer. The received file must match the source byte for byte.
+    2. Same file again, while a cached copy of the first one is pinned, as if playing. The old file must be replaced
+    between fileChangeBegin() and fileChangeEnd(), and the cached copy must no longer be handed out.
+
+    transfer_test <card directory> <python> <send_wav.py> <file>
+
+  Serial is attached to the pseudo-terminal, so the test's own output goes to stdout with printf().
+
+*/
+
+#include "host.h"
+#include "serial_transfer.h"
+#include "track_cache.h"
+#include "audio_arena.h"
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static fs::FS card;
+static char dest[128];
+static int changesBegun = 0;
+static int changesEnded = 0;
+static bool changeOrder = true;
+
+// File change handler, counts calls for the destination and checks they come in pairs.
+
+static void countChange(const char * path, bool done){
+
+  if(strcmp(path, dest) != 0) return;
+
+  if(done) changesEnded++;
+  else changesBegun++;
+
+  changeOrder &= changesBegun - changesEnded == (done ? 0 : 1);
+
+}
+
+// Runs send_wav.py on the terminal at slave, serving the device side until it exits. Returns true if it succeeded.
+
+static bool send(const char * python, const char * script, const char * slave, const char * file){
+
+  pid_t pid = fork();
+
+  if(pid < 0) return false;
+
+  if(pid == 0){
+
+    execl(python, python, script, slave, file, "--dest", "/xfer", (char *)NULL);
+
+    _exit(127);
+
+  }
+
+  int status;
+
+  while(waitpid(pid, &status, WNOHANG) == 0){
+
+    if(!transferService(card)) usleep(100);
+
+  }
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+}
+
+// Compares a card file with a host file.
+
+static bool sameFile(const char * cardPath, const char * hostPath){
+
+  FILE *a = fopen(hostCardPath(cardPath), "rb");
+  FILE *b = fopen(hostPath, "rb");
+  bool same = a && b;
+
+  while(same){
+
+    int x = fgetc(a);
+    int y = fgetc(b);
+
+    same = x == y;
+
+    if(x == EOF) break;
+
+  }
+
+  if(a) fclose(a);
+  if(b) fclose(b);
+
+  return same;
+
+}
+
+int main(int argc, char **argv){
+
+  if(argc < 5){
+
+    printf("Usage: transfer_test <card directory> <python> <send_wav.py> <file>\n");
+
+    return 2;
+
+  }
+
+  mkdir(argv[1], 0755);
+  hostCardRoot(argv[1]);
+
+  char name[128];
+
+  snprintf(name, sizeof(name), "%s", argv[4]);
+  snprintf(dest, sizeof(dest), "/xfer/%s", basename(name));
+
+  if(card.exists(dest)) card.remove(dest);
+
+  arenaInit();
+  trackCacheInit();
+  arenaSeal();
+
+  setFileChangeHandler(countChange);
+
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if(master < 0 || grantpt(master) < 0 || unlockpt(master) < 0){
+
+    printf("FAIL: no pseudo-terminal.\n");
+
+    return 1;
+
+  }
+
+  hostSerialAttach(master);
+  transferInit(115200);
+
+  int failures = 0;
+
+  // 1. Fresh transfer.
+
+  bool sent = send(argv[2], argv[3], ptsname(master), argv[4]);
+  bool same = sent && sameFile(dest, argv[4]);
+
+  failures += !same;
+
+  printf("%s fresh transfer: %s, %s.\n", same ? "ok  " : "FAIL", sent ? "sent" : "send failed", same ? "file matches" : "file differs");
+
+  // 2. Replace the file while a cached copy is pinned.
+
+  trackCacheRequest(dest, 0, 0);
+
+  while(trackCacheService(card));
+
+  int pinned = trackCacheAcquire(dest, 0);
+
+  changesBegun = 0;
+  changesEnded = 0;
+
+  sent = send(argv[2], argv[3], ptsname(master), argv[4]);
+  same = sent && sameFile(dest, argv[4]);
+
+  int stale = trackCacheAcquire(dest, 0);
+  bool pass = same && pinned >= 0 && stale < 0 && changesBegun == 1 && changesEnded == 1 && changeOrder;
+
+  trackCacheRelease(stale);
+  trackCacheRelease(pinned);
+
+  failures += !pass;
+
+  printf("%s replace: %s, %d/%d change calls, cached copy %s.\n", pass ? "ok  " : "FAIL", same ? "file matches" : "file differs",
+         changesBegun, changesEnded, pinned < 0 ? "never loaded" : stale < 0 ? "dropped" : "still handed out");
+
+  close(master);
+
+  printf(failures ? "%d transfer checks failed.\n" : "All transfer checks pass.\n", failures);
+
+  return failures ? 1 : 0;
+
+}
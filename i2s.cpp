@@ -1,10 +1,130 @@
+#include <Arduino.h>
 #include "i2s.h"
 
+// dma_buf_count and dma_buf_len for each playback latency level, lowest latency first.
+
+static const int latencyLevels[I2S_LATENCY_LEVELS][2] = {
+
+  {4, 128},
+  {6, 256},
+  {8, 256},
+  {8, 512},
+  {16, 512},
+  {16, 1024}
+
+};
+
+static const int profileLevels[] = {0, 2, 4, 2};
+
+static volatile latencyProfile currentProfile = LATENCY_BALANCED;
+static volatile bool profileChanged = false;
+static volatile int currentLevel = 2;
+static volatile uint32_t underruns = 0;
+
+static QueueHandle_t playbackEvents = NULL;
+static QueueHandle_t captureEvents = NULL;
+static uint32_t captureOverruns = 0;
+static unsigned long lastUpdate = 0;
+static unsigned long stableMillis = 0;
+static bool wasPlaying = false;
+static bool primed = false;
+
+// Playback rate, and the rate of the track set with I2SSetPlaybackRate() waiting to be applied.
+
+static volatile uint32_t playbackRate = SAMPLE_RATE;
+static volatile uint32_t pendingRate = SAMPLE_RATE;
+
+/*
+
+  installPlayback() - Installs I2S_NUM_1 driver for playback with the DMA buffering of currentLevel.
+
+*/
+
+static void installPlayback(){
+
+  i2s_config_t i2s_playback_config = {
+    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
+    .sample_rate = playbackRate,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // stereo or mono
+    .communication_format = I2S_COMM_FORMAT_I2S,
+    .intr_alloc_flags = 0,
+    .dma_buf_count = latencyLevels[currentLevel][0],
+    .dma_buf_len = latencyLevels[currentLevel][1],
+    .use_apll = false,
+    .tx_desc_auto_clear = true
+  };
+
+  i2s_pin_config_t playback_pins = {
+      .bck_io_num = I2S_BCK_IO, // separate GPIOs for playback if needed
+      .ws_io_num  = I2S_WS_IO,
+      .data_out_num = I2S_DO_IO,
+      .data_in_num  = I2S_PIN_NO_CHANGE
+  };
+
+  i2s_driver_install(I2S_NUM_1, &i2s_playback_config, I2S_EVENT_QUEUE_LEN, &playbackEvents);
+  i2s_set_pin(I2S_NUM_1, &playback_pins);
+  i2s_zero_dma_buffer(I2S_NUM_1);
+
+}
+
+/*
+
+  setLevel() - Reinstalls playback driver with new latency level. Must only be called from the task that writes to I2S_NUM_1.
+
+*/
+
+static void setLevel(int level){
+
+  if(level < 0) level = 0;
+  if(level >= I2S_LATENCY_LEVELS) level = I2S_LATENCY_LEVELS - 1;
+
+  if(level == currentLevel) return;
+
+  i2s_driver_uninstall(I2S_NUM_1);
+
+  currentLevel = level;
+
+  installPlayback();
+
+  // The new driver queues overflow events until it is written to, see I2SUpdateLatency().
+
+  primed = false;
+
+  Serial.printf("I2S playback buffering: %d x %d (%.1f ms).\n", latencyLevels[level][0], latencyLevels[level][1], I2SOutputLatencyMs());
+
+}
+
+/*
+
+  drainUnderruns() - Empties playback event queue. DMA queue overflow events mean every DMA buffer ran empty, i.e. an underrun.
+
+  returns int - Number of underruns since last call.
+
+*/
+
+static int drainUnderruns(){
+
+  i2s_event_t event;
+  int count = 0;
+
+  if(!playbackEvents) return 0;
+
+  while(xQueueReceive(playbackEvents, &event, 0) == pdTRUE){
+
+    if(event.type == I2S_EVENT_TX_Q_OVF) count++;
+
+  }
+
+  return count;
+
+}
+
 /*
 
   I2SInit() - Initialize and set I2S modes.
 
-  One i2s_config struct for audio capture, and one for audio playback.
+  One i2s_config struct for audio capture, and one for audio playback. Playback buffering is set by the current latency profile.
 
 */
 
@@ -34,33 +154,11 @@ void I2SInit(){
 
   };
 
-  i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL);
+  i2s_driver_install(I2S_NUM_0, &i2s_config, I2S_EVENT_QUEUE_LEN, &captureEvents);
   i2s_set_pin(I2S_NUM_0, &pin_config);
   i2s_zero_dma_buffer(I2S_NUM_0);
 
-  i2s_config_t i2s_playback_config = {
-    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-    .sample_rate = SAMPLE_RATE,
-    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // stereo or mono
-    .communication_format = I2S_COMM_FORMAT_I2S,
-    .intr_alloc_flags = 0,
-    .dma_buf_count = 8,
-    .dma_buf_len = 256,
-    .use_apll = false,
-    .tx_desc_auto_clear = true
-  };
-
-  i2s_pin_config_t playback_pins = {
-      .bck_io_num = I2S_BCK_IO, // separate GPIOs for playback if needed
-      .ws_io_num  = I2S_WS_IO,
-      .data_out_num = I2S_DO_IO,
-      .data_in_num  = I2S_PIN_NO_CHANGE
-  };
-
-  i2s_driver_install(I2S_NUM_1, &i2s_playback_config, 0, NULL);
-  i2s_set_pin(I2S_NUM_1, &playback_pins);
-  i2s_zero_dma_buffer(I2S_NUM_1);
+  installPlayback();
 
 }
 
@@ -83,10 +181,10 @@ void generateSineWave(double freq, double duration, float amplitude){
 
   size_t bytes_written;
 
-  double phaseIncrement = 2.0f * PI * freq / SAMPLE_RATE;
+  double phaseIncrement = 2.0f * PI * freq / playbackRate;
 
   int currentSample = 0;
-  int totalSamples = SAMPLE_RATE * duration;
+  int totalSamples = playbackRate * duration;
 
   while(currentSample < totalSamples){
 
@@ -108,4 +206,180 @@ void generateSineWave(double freq, double duration, float amplitude){
 
   }
 
+}
+
+/*
+
+  I2SSetLatencyProfile() - Selects playback latency profile. Safe to call from any task, change is applied
+  by the audio task on its next call to I2SUpdateLatency().
+
+  latencyProfile profile - LATENCY_LOW, LATENCY_BALANCED, LATENCY_ROBUST or LATENCY_ADAPTIVE.
+
+*/
+
+void I2SSetLatencyProfile(latencyProfile profile){
+
+  currentProfile = profile;
+  profileChanged = true;
+
+}
+
+latencyProfile I2SGetLatencyProfile(){
+
+  return currentProfile;
+
+}
+
+/*
+
+  I2SSetPlaybackRate() - Sets the playback sample rate, i.e. to the rate in a track's header when it opens. Safe to
+  call from any task, i2s_set_sample_rates() is called by the audio task on its next call to I2SUpdateLatency(),
+  before the track's first block is written.
+
+  uint32_t rate - Sample rate in Hz.
+
+*/
+
+void I2SSetPlaybackRate(uint32_t rate){
+
+  if(rate) pendingRate = rate;
+
+}
+
+uint32_t I2SPlaybackRate(){
+
+  return playbackRate;
+
+}
+
+/*
+
+  I2SUpdateLatency() - Applies profile changes and adaptive buffering. Call from the audio task between i2s_write() calls.
+
+  bool playing - true if audio is being written. Underruns are only counted while playing, and adaptive mode only lowers latency while idle.
+
+  While idle the DMA runs empty and queues an overflow event per buffer. Those are discarded when playback starts, on
+  the first call, and again on the second, after the first block of new audio was written. Counting starts after that.
+
+*/
+
+void I2SUpdateLatency(bool playing){
+
+  int events = drainUnderruns();
+  unsigned long now = millis();
+  unsigned long elapsed = now - lastUpdate;
+
+  lastUpdate = now;
+
+  // Clocks restart at the new rate. Like a reinstall, that queues events until the port is written to again.
+
+  if(pendingRate != playbackRate){
+
+    playbackRate = pendingRate;
+
+    i2s_set_sample_rates(I2S_NUM_1, playbackRate);
+
+    primed = false;
+
+  }
+
+  if(profileChanged){
+
+    profileChanged = false;
+    stableMillis = 0;
+
+    setLevel(profileLevels[currentProfile]);
+
+    return;
+
+  }
+
+  if(!playing){
+
+    wasPlaying = false;
+
+    if(currentProfile == LATENCY_ADAPTIVE && currentLevel > 0 && stableMillis >= I2S_ADAPT_STABLE_MS){
+
+      stableMillis = 0;
+      setLevel(currentLevel - 1);
+
+    }
+
+    return;
+
+  }
+
+  if(!wasPlaying || !primed){
+
+    primed = wasPlaying;
+    wasPlaying = true;
+
+    return;
+
+  }
+
+  if(events > 0){
+
+    underruns += events;
+    stableMillis = 0;
+
+    if(currentProfile == LATENCY_ADAPTIVE) setLevel(currentLevel + 1);
+
+  }
+
+  else{
+
+    stableMillis += elapsed;
+
+  }
+
+}
+
+// Returns number of samples buffered between i2s_write() and the output pins.
+
+uint32_t I2SOutputLatencySamples(){
+
+  int level = currentLevel;
+
+  return latencyLevels[level][0] * latencyLevels[level][1];
+
+}
+
+float I2SOutputLatencyMs(){
+
+  return I2SOutputLatencySamples() * 1000.0f / playbackRate;
+
+}
+
+// Returns total underruns counted while playing since boot.
+
+uint32_t I2SUnderrunCount(){
+
+  return underruns;
+
+}
+
+/*
+
+  I2SCaptureOverruns() - Counts capture DMA overruns, i.e. capture buffers overwritten before i2s_read() took them.
+  Call regularly from the capture task so the event queue does not fill up.
+
+  returns uint32_t - Total overruns since boot.
+
+*/
+
+uint32_t I2SCaptureOverruns(){
+
+  i2s_event_t event;
+
+  if(!captureEvents) return captureOverruns;
+
+  while(xQueueReceive(captureEvents, &event, 0) == pdTRUE){
+
+    if(event.type == I2S_EVENT_RX_Q_OVF) captureOverruns++;
+
+  }
+
+  return captureOverruns;
+
 }
\ No newline at end of file
@@ -31,7 +31,44 @@
 #define I2S_DO_IO       25
 #define I2S_DI_IO       32
 
+/*
+
+	Playback latency profiles.
+
+	Playback DMA buffering is picked from I2S_LATENCY_LEVELS, a ladder of dma_buf_count / dma_buf_len pairs
+	from lowest to highest latency. LATENCY_LOW, LATENCY_BALANCED and LATENCY_ROBUST pin the ladder to a fixed
+	level. LATENCY_ADAPTIVE starts at balanced, moves one level up whenever an underrun is detected, and one level
+	down after I2S_ADAPT_STABLE_MS of playback without underruns.
+
+	The playback driver is only reinstalled from I2SUpdateLatency(), which is called by the audio task between
+	blocks, and at least once a second while idle. Moving down only happens while playback is idle so it never causes a gap.
+	Playback rate changes from I2SSetPlaybackRate() are applied at the same point, and kept across reinstalls.
+
+*/
+
+typedef enum{
+
+	LATENCY_LOW,
+	LATENCY_BALANCED,
+	LATENCY_ROBUST,
+	LATENCY_ADAPTIVE
+
+} latencyProfile;
+
+#define I2S_LATENCY_LEVELS 6
+#define I2S_ADAPT_STABLE_MS 60000
+#define I2S_EVENT_QUEUE_LEN 16
+
 void I2SInit();
+void I2SSetLatencyProfile(latencyProfile profile);
+latencyProfile I2SGetLatencyProfile();
+void I2SSetPlaybackRate(uint32_t rate);
+uint32_t I2SPlaybackRate();
+void I2SUpdateLatency(bool playing);
+uint32_t I2SOutputLatencySamples();
+float I2SOutputLatencyMs();
+uint32_t I2SUnderrunCount();
+uint32_t I2SCaptureOverruns();
 void generateSineWave(double freq, double duration, float amplitude);
 
 #endif
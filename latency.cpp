@@ -0,0 +1,495 @@
+#include "latency.h"
+#include "mono_file.h"
+#include "audio_arena.h"
+
+// State of the simulated loopback. Output queue drains one sample per captured sample, like the DMA on real ports.
+
+struct Loopback {
+
+  int16_t *queue;
+  uint32_t queueSize;
+  uint32_t queueHead;
+  uint32_t queueCount;
+
+  int16_t *delay;
+  uint32_t delayPos;
+
+  uint32_t seed;
+
+};
+
+/*
+
+  latencyDefaultConfig() - Fills config with a 1kHz, 4 cycle burst at half scale. Simulated queue matches the current
+  playback latency level, see I2SOutputLatencySamples().
+
+  LatencyConfig &config - Config to fill.
+  loopbackType type - LOOP_I2S or LOOP_SIMULATED.
+
+*/
+
+void latencyDefaultConfig(LatencyConfig &config, loopbackType type){
+
+  config.type = type;
+  config.toneHz = 1000;
+  config.burstCycles = 4;
+  config.amplitude = 0.5f;
+  config.warmupMs = 100;
+  config.windowMs = 500;
+  config.queueSamples = I2SOutputLatencySamples();
+  config.delaySamples = 0;
+  config.noise = 0;
+
+}
+
+static bool loopbackOpen(Loopback &loop, const LatencyConfig &config){
+
+  loop.queueSize = config.queueSamples ? config.queueSamples : 1;
+  loop.queueHead = 0;
+  loop.queueCount = 0;
+  loop.delayPos = 0;
+  loop.seed = 1;
+
+  // Without PSRAM each buffer takes a pool block, which holds the queue of every fixed latency profile.
+
+  size_t queueBytes = loop.queueSize * sizeof(int16_t);
+  size_t delayBytes = config.delaySamples * sizeof(int16_t);
+
+  loop.queue = (int16_t *)arenaTakeBuffer(queueBytes, queueBytes);
+  loop.delay = NULL;
+
+  if(config.delaySamples){
+
+    loop.delay = (int16_t *)arenaTakeBuffer(delayBytes, delayBytes);
+
+    if(loop.delay) memset(loop.delay, 0, delayBytes);
+
+  }
+
+  if(!loop.queue || (config.delaySamples && !loop.delay)){
+
+    Serial.println("Not enough memory for simulated loopback.");
+
+    arenaGiveBuffer(loop.queue);
+    arenaGiveBuffer(loop.delay);
+
+    return false;
+
+  }
+
+  return true;
+
+}
+
+static void loopbackClose(Loopback &loop){
+
+  arenaGiveBuffer(loop.queue);
+  arenaGiveBuffer(loop.delay);
+
+}
+
+// Queues as many samples as fit without blocking, like i2s_write() with no wait. Returns samples accepted.
+
+static size_t portWrite(const LatencyConfig &config, Loopback &loop, const int16_t *samples, size_t sampleCount){
+
+  if(config.type == LOOP_I2S){
+
+    size_t written = 0;
+
+    i2s_write(I2S_NUM_1, samples, sampleCount * sizeof(int16_t), &written, 0);
+
+    return written / sizeof(int16_t);
+
+  }
+
+  size_t n = loop.queueSize - loop.queueCount;
+
+  if(n > sampleCount) n = sampleCount;
+
+  for(size_t i = 0; i < n; i++) loop.queue[(loop.queueHead + loop.queueCount + i) % loop.queueSize] = samples[i];
+
+  loop.queueCount += n;
+
+  return n;
+
+}
+
+/*
+
+  portRead() - Reads a block of raw ADC samples, in the format i2s_read() gives on I2S_NUM_0.
+
+  The simulated DAC plays one queued sample, or silence if the queue ran dry, for every sample captured. Its output
+  goes through the delay line and is scaled so conditionADCSamples() gives back the same level.
+
+*/
+
+static void portRead(const LatencyConfig &config, Loopback &loop, uint16_t *raw, size_t sampleCount){
+
+  if(config.type == LOOP_I2S){
+
+    size_t bytesRead;
+
+    i2s_read(I2S_NUM_0, raw, sampleCount * sizeof(uint16_t), &bytesRead, portMAX_DELAY);
+
+    return;
+
+  }
+
+  for(size_t i = 0; i < sampleCount; i++){
+
+    int32_t s = 0;
+
+    if(loop.queueCount){
+
+      s = loop.queue[loop.queueHead];
+      loop.queueHead = (loop.queueHead + 1) % loop.queueSize;
+      loop.queueCount--;
+
+    }
+
+    if(loop.delay){
+
+      int16_t delayed = loop.delay[loop.delayPos];
+
+      loop.delay[loop.delayPos] = s;
+      loop.delayPos = (loop.delayPos + 1) % config.delaySamples;
+
+      s = delayed;
+
+    }
+
+    int32_t adc = 2048 + s / 32;
+
+    if(config.noise){
+
+      loop.seed = loop.seed * 1664525 + 1013904223;
+      adc += (int32_t)((loop.seed >> 16) % (2 * config.noise + 1)) - config.noise;
+
+    }
+
+    raw[i] = adc < 0 ? 0 : adc > 4095 ? 4095 : adc;
+
+  }
+
+}
+
+/*
+
+  measureLatency() - Plays one burst and measures how long it takes to come back. Results are printed to serial monitor.
+
+  const LatencyConfig &config - Burst and loopback settings, see latencyDefaultConfig().
+  LatencyResult &result - Filled with latencies in samples and the normalized correlation peak. expectedSamples is the
+  exact output latency for LOOP_SIMULATED, -1 for LOOP_I2S.
+
+  return - true if the burst was found.
+
+*/
+
+bool measureLatency(const LatencyConfig &config, LatencyResult &result){
+
+  result.ok = false;
+  result.outputSamples = 0;
+  result.roundTripSamples = 0;
+  result.peak = 0;
+  result.expectedSamples = -1;
+
+  int burstLen = config.burstCycles * SAMPLE_RATE / config.toneHz;
+
+  if(burstLen < 4 || burstLen > LATENCY_MAX_BURST){
+
+    Serial.printf("Burst of %d samples is not supported, limit is %d.\n", burstLen, LATENCY_MAX_BURST);
+
+    return false;
+
+  }
+
+  // Burst as played, and Q12 template for the correlation.
+
+  int16_t burst[LATENCY_MAX_BURST];
+  int16_t templ[LATENCY_MAX_BURST];
+  int64_t templEnergy = 0;
+
+  for(int i = 0; i < burstLen; i++){
+
+    float window = 0.5f - 0.5f * cosf(2.0f * PI * i / (burstLen - 1));
+    float s = window * sinf(2.0f * PI * config.toneHz * i / SAMPLE_RATE);
+
+    burst[i] = (int16_t)(s * config.amplitude * 32767);
+    templ[i] = (int16_t)lroundf(s * 4096);
+    templEnergy += (int32_t)templ[i] * templ[i];
+
+  }
+
+  Loopback loop;
+
+  memset(&loop, 0, sizeof(loop));
+
+  if(config.type == LOOP_SIMULATED && !loopbackOpen(loop, config)) return false;
+
+  if(config.type == LOOP_I2S){
+
+    i2s_set_adc_mode(ADC_UNIT_1, ADC1_CHANNEL_4);
+    i2s_adc_enable(I2S_NUM_0);
+
+  }
+
+  uint16_t raw[LATENCY_BLOCK];
+  int16_t in[LATENCY_BLOCK];
+  int16_t silence[LATENCY_BLOCK];
+
+  memset(silence, 0, sizeof(silence));
+
+  // Capture history is stored twice back to back, so the window is always one straight run. Samples are scaled to
+  // 11 bits, the ADC has 12, so the correlation fits in 32 bit.
+
+  int16_t history[2 * LATENCY_MAX_BURST];
+  int historyPos = 0;
+  int64_t windowEnergy = 0;
+
+  memset(history, 0, sizeof(history));
+
+  float prev = 0;
+
+  uint32_t captured = 0;
+  uint32_t warmup = (uint64_t)config.warmupMs * SAMPLE_RATE / 1000;
+  uint32_t window = (uint64_t)config.windowMs * SAMPLE_RATE / 1000;
+  int32_t burstPos = -1;
+  int64_t handoff = -1;
+
+  int32_t best = 0;
+  int64_t bestIndex = -1;
+  int64_t bestEnergy = 0;
+  int32_t bestLeft = 0;
+  int32_t bestRight = 0;
+  int32_t lastDot = 0;
+  bool needRight = false;
+
+  while(handoff < 0 || captured < handoff + window){
+
+    portRead(config, loop, raw, LATENCY_BLOCK);
+    conditionADCSamples(raw, in, LATENCY_BLOCK, prev);
+
+    for(int i = 0; i < LATENCY_BLOCK; i++){
+
+      int16_t x = in[i] >> 5;
+      int16_t old = history[historyPos];
+
+      windowEnergy += (int32_t)x * x - (int32_t)old * old;
+
+      history[historyPos] = x;
+      history[historyPos + burstLen] = x;
+
+      if(++historyPos == burstLen) historyPos = 0;
+
+      // Window ends at capture sample c, so a burst starting at c - burstLen + 1 lines up with the template.
+
+      int64_t onset = (int64_t)captured + i - burstLen + 1;
+
+      if(handoff < 0 || onset < handoff) continue;
+
+      const int16_t *w = history + historyPos;
+      int32_t dot = 0;
+
+      for(int k = 0; k < burstLen; k++) dot += (int32_t)templ[k] * w[k];
+
+      if(needRight){
+
+        bestRight = dot;
+        needRight = false;
+
+      }
+
+      // Sign is ignored, the analog path may invert.
+
+      if(abs(dot) > abs(best)){
+
+        best = dot;
+        bestIndex = onset;
+        bestEnergy = windowEnergy;
+        bestLeft = onset > handoff ? lastDot : dot;
+        bestRight = dot;
+        needRight = true;
+
+      }
+
+      lastDot = dot;
+
+    }
+
+    captured += LATENCY_BLOCK;
+
+    // Output queue is kept full, like audioTask() blocking in i2s_write(). Burst starts once capture has settled.
+
+    if(burstPos < 0 && captured >= warmup) burstPos = 0;
+
+    for(;;){
+
+      const int16_t *chunk = silence;
+      size_t n = LATENCY_BLOCK;
+
+      if(burstPos >= 0 && burstPos < burstLen){
+
+        chunk = burst + burstPos;
+        n = burstLen - burstPos < LATENCY_BLOCK ? burstLen - burstPos : LATENCY_BLOCK;
+
+      }
+
+      uint32_t ahead = config.type == LOOP_SIMULATED ? loop.queueCount : 0;
+      size_t accepted = portWrite(config, loop, chunk, n);
+
+      if(accepted && burstPos == 0){
+
+        handoff = captured;
+
+        if(config.type == LOOP_SIMULATED) result.expectedSamples = ahead + config.delaySamples;
+
+      }
+
+      if(burstPos >= 0) burstPos += accepted;
+
+      if(accepted < n) break;
+
+    }
+
+  }
+
+  if(config.type == LOOP_I2S) i2s_adc_disable(I2S_NUM_0);
+  else loopbackClose(loop);
+
+  if(bestIndex < 0 || bestEnergy <= 0) result.peak = 0;
+  else result.peak = fabsf((float)best) / sqrtf((float)templEnergy * (float)bestEnergy);
+
+  if(result.peak < LATENCY_MIN_PEAK){
+
+    Serial.printf("No burst found, correlation peak %.2f. Check loopback wiring and level.\n", result.peak);
+
+    return false;
+
+  }
+
+  // Parabola through the peak and its neighbours gives the fractional part.
+
+  float y0 = best < 0 ? -bestLeft : bestLeft;
+  float y1 = abs(best);
+  float y2 = best < 0 ? -bestRight : bestRight;
+  float curve = y0 - 2 * y1 + y2;
+  float frac = curve < 0 ? 0.5f * (y0 - y2) / curve : 0;
+
+  // i2s_read() hands the onset over at the end of the block that holds it.
+
+  uint32_t delivered = (bestIndex / LATENCY_BLOCK + 1) * LATENCY_BLOCK;
+
+  result.ok = true;
+  result.outputSamples = bestIndex + frac - handoff;
+  result.roundTripSamples = delivered - handoff;
+
+  Serial.printf("%s: output %.1f samples (%.2f ms), round trip %.0f samples (%.2f ms), peak %.2f", config.type == LOOP_I2S ? "I2S loopback" : "Simulated loopback",
+                result.outputSamples, result.outputSamples * 1000.0f / SAMPLE_RATE, result.roundTripSamples, result.roundTripSamples * 1000.0f / SAMPLE_RATE, result.peak);
+
+  if(result.expectedSamples >= 0) Serial.printf(", expected %d.\n", result.expectedSamples);
+  else Serial.println(".");
+
+  return true;
+
+}
+
+static int compareFloats(const void *a, const void *b){
+
+  float x = *(const float *)a;
+  float y = *(const float *)b;
+
+  return x < y ? -1 : x > y;
+
+}
+
+/*
+
+  benchmarkLatency() - Measures latency for a range of settings.
+
+  LOOP_I2S runs LATENCY_RUNS bursts at each fixed latency profile and prints the median next to the configured output
+  buffering, then restores the previous profile. Must be called from the task that writes to I2S_NUM_1, with playback
+  paused, since profile changes reinstall the playback driver.
+
+  LOOP_SIMULATED sweeps queue sizes, delays and noise, and checks every measurement against the known answer.
+
+  loopbackType type - LOOP_I2S or LOOP_SIMULATED.
+
+  return - true if every burst was found, and for LOOP_SIMULATED, every output latency was within half a sample.
+
+*/
+
+bool benchmarkLatency(loopbackType type){
+
+  LatencyConfig config;
+  LatencyResult result;
+  bool ok = true;
+
+  latencyDefaultConfig(config, type);
+
+  if(type == LOOP_SIMULATED){
+
+    const uint32_t queues[] = {512, 2048, 4096, 8192};
+    const uint32_t delays[] = {0, 37, 2205};
+    const uint16_t noise[] = {0, 64};
+
+    for(int q = 0; q < 4; q++) for(int d = 0; d < 3; d++) for(int n = 0; n < 2; n++){
+
+      config.queueSamples = queues[q];
+      config.delaySamples = delays[d];
+      config.noise = noise[n];
+
+      Serial.printf("Queue %u, delay %u, noise %u. ", config.queueSamples, config.delaySamples, config.noise);
+
+      bool found = measureLatency(config, result);
+
+      ok &= found && fabsf(result.outputSamples - result.expectedSamples) < 0.5f;
+
+    }
+
+    Serial.println(ok ? "Simulated loopback: all measurements match." : "Simulated loopback: MISMATCH.");
+
+    return ok;
+
+  }
+
+  latencyProfile saved = I2SGetLatencyProfile();
+  const latencyProfile profiles[] = {LATENCY_LOW, LATENCY_BALANCED, LATENCY_ROBUST};
+  const char *names[] = {"low", "balanced", "robust"};
+
+  for(int p = 0; p < 3; p++){
+
+    I2SSetLatencyProfile(profiles[p]);
+    I2SUpdateLatency(false);
+
+    float output[LATENCY_RUNS];
+    float roundTrip[LATENCY_RUNS];
+    int found = 0;
+
+    for(int r = 0; r < LATENCY_RUNS; r++){
+
+      if(!measureLatency(config, result)) continue;
+
+      output[found] = result.outputSamples;
+      roundTrip[found] = result.roundTripSamples;
+      found++;
+
+    }
+
+    ok &= found == LATENCY_RUNS;
+
+    if(!found) continue;
+
+    qsort(output, found, sizeof(float), compareFloats);
+    qsort(roundTrip, found, sizeof(float), compareFloats);
+
+    Serial.printf("Profile %s, %.2f ms output buffering: median output %.2f ms, round trip %.2f ms over %d runs.\n", names[p], I2SOutputLatencyMs(),
+                  output[found / 2] * 1000.0f / SAMPLE_RATE, roundTrip[found / 2] * 1000.0f / SAMPLE_RATE, found);
+
+  }
+
+  I2SSetLatencyProfile(saved);
+  I2SUpdateLatency(false);
+
+  return ok;
+
+}
@@ -0,0 +1,81 @@
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+/*
+
+  Round-trip audio latency measurement.
+
+  A Hann windowed tone burst is written to the output the way audioTask() writes audio, keeping the output DMA queue
+  full, and read back through record()'s capture path, i2s_read() on I2S_NUM_0 and conditionADCSamples(). The burst
+  is found in the capture with a streaming cross-correlation, interpolated to a fraction of a sample.
+
+  Latency is measured on the capture sample clock. The moment the first burst sample is accepted by the output is the
+  number of samples captured so far, and the burst onset is its position in the capture, so no other clock is needed.
+
+    Output latency - Hand-off to onset at the ADC: samples queued ahead of the burst plus the analog path.
+    Round trip - Hand-off until i2s_read() returns the onset, which adds the capture DMA buffer.
+
+  Loopback paths:
+
+    LOOP_I2S - Plays on I2S_NUM_1 and captures on I2S_NUM_0. The DAC output must be wired to the ADC input on
+    I2S_DI_IO, biased to mid-rail. Playback must be paused and level recording stopped, since the harness drives both
+    ports itself.
+    LOOP_SIMULATED - Stand-in for both ports, so the harness runs without hardware, i.e. on a host. Has an output
+    queue of queueSamples, an analog path of delaySamples, and noise of up to noise ADC steps. Expected output latency
+    is known exactly, so the measurement can be checked.
+
+  LATENCY_BLOCK - Samples per i2s_read(), matches capture dma_buf_len in I2SInit().
+  LATENCY_MAX_BURST - Longest burst, in samples. Keeps the correlation in 32 bit.
+  LATENCY_MIN_PEAK - Normalized correlation below this is reported as no burst found.
+
+*/
+
+#include <Arduino.h>
+#include "i2s.h"
+
+#define LATENCY_BLOCK 256
+#define LATENCY_MAX_BURST 256
+#define LATENCY_MIN_PEAK 0.5f
+#define LATENCY_RUNS 5
+
+typedef enum{
+
+  LOOP_I2S,
+  LOOP_SIMULATED
+
+} loopbackType;
+
+struct LatencyConfig {
+
+  loopbackType type;
+
+  float toneHz;
+  uint16_t burstCycles;
+  float amplitude;
+
+  uint32_t warmupMs;
+  uint32_t windowMs;
+
+  uint32_t queueSamples;
+  uint32_t delaySamples;
+  uint16_t noise;
+
+};
+
+struct LatencyResult {
+
+  bool ok;
+
+  float outputSamples;
+  float roundTripSamples;
+  float peak;
+
+  int32_t expectedSamples;
+
+};
+
+void latencyDefaultConfig(LatencyConfig &config, loopbackType type);
+bool measureLatency(const LatencyConfig &config, LatencyResult &result);
+bool benchmarkLatency(loopbackType type);
+
+#endif
@@ -0,0 +1,442 @@
+#include "level_record.h"
+#include "i2s.h"
+#include "audio_arena.h"
+#include "denoise.h"
+#include "esp_heap_caps.h"
+#include <atomic>
+
+static fs::FS *recordFS;
+static char recordDir[64];
+
+static int16_t *ring = NULL;
+static uint32_t capacity;
+static uint32_t mask;
+
+static int16_t threshold;
+static uint32_t preRoll;
+static uint32_t hold;
+
+// Noise reduction in the capture task, and its output for one block. Static, the capture task stack is small.
+
+static bool denoise;
+static NoiseReducer reducer;
+static int16_t cleaned[LEVEL_BLOCK_SAMPLES + DENOISE_HOP];
+
+// Sample counters since arming. Written by capture task, except readIndex which is written by writer task. They wrap
+// about every 27 hours, so they are only compared through differences, and capacity is a power of 2 so ring positions
+// stay continuous across the wrap.
+
+static std::atomic<uint32_t> captureIndex(0);
+static std::atomic<uint32_t> readIndex(0);
+static std::atomic<int> state(LEVEL_DISARMED);
+
+// Recording boundaries, sent by capture task in start / end pairs. A new recording can start while the writer is
+// still finishing the last one.
+
+struct SegmentEvent {
+
+  bool start;
+  uint32_t index;
+
+};
+
+#define LEVEL_SEGMENT_EVENTS 8
+
+static QueueHandle_t segments = NULL;
+
+static std::atomic<bool> running(false);
+static std::atomic<int> tasksRunning(0);
+
+static LevelRecordStats stats;
+
+/*
+
+  captureTask() - Reads and conditions capture blocks into the ring, and starts and ends recordings based on level.
+
+*/
+
+static void captureTask(void *parameters){
+
+  uint16_t raw[LEVEL_BLOCK_SAMPLES];
+  int16_t block[LEVEL_BLOCK_SAMPLES];
+  float prev = 0;
+  uint32_t lastLoud = 0;
+  size_t bytesRead;
+
+  // Samples captured since arming or since the last recording ended, up to preRoll. Limits pre-roll of the next one.
+
+  uint32_t history = 0;
+
+  while(running){
+
+    i2s_read(I2S_NUM_0, raw, sizeof(raw), &bytesRead, portMAX_DELAY);
+
+    int numSamples = bytesRead / sizeof(uint16_t);
+
+    conditionADCSamples(raw, block, numSamples, prev);
+
+    int16_t *samples = block;
+
+    if(denoise){
+
+      numSamples = denoiseProcess(reducer, block, cleaned, numSamples);
+      samples = cleaned;
+
+    }
+
+    uint32_t index = captureIndex.load(std::memory_order_relaxed);
+    int32_t peak = 0;
+
+    for(int i = 0; i < numSamples; i++){
+
+      ring[(index + i) & mask] = samples[i];
+
+      int32_t v = samples[i] < 0 ? -(int32_t)samples[i] : samples[i];
+
+      if(v > peak) peak = v;
+
+    }
+
+    captureIndex.store(index + numSamples, std::memory_order_release);
+
+    int current = state.load();
+
+    // A trigger while the writer finishes the last recording starts the next one, with pre-roll back to its end.
+
+    if(current != LEVEL_RECORDING && peak >= threshold){
+
+      SegmentEvent event = {true, index - history};
+
+      if(xQueueSend(segments, &event, 0) == pdTRUE){
+
+        lastLoud = index + numSamples;
+
+        state = LEVEL_RECORDING;
+
+      }
+
+    }
+
+    else if(current == LEVEL_RECORDING){
+
+      if(peak >= threshold) lastLoud = index + numSamples;
+
+      else if(index + numSamples - lastLoud >= hold){
+
+        SegmentEvent event = {false, index + numSamples};
+
+        // Queue full, try again next block.
+
+        if(xQueueSend(segments, &event, 0) == pdTRUE){
+
+          history = 0;
+          state = LEVEL_FINISHING;
+
+        }
+
+      }
+
+    }
+
+    history = history + numSamples < preRoll ? history + numSamples : preRoll;
+
+    stats.dmaOverruns = I2SCaptureOverruns();
+
+  }
+
+  arenaUnwatchTask(xTaskGetCurrentTaskHandle());
+
+  tasksRunning--;
+
+  vTaskDelete(NULL);
+
+}
+
+// Finds first unused file name in recordDir.
+
+static void nextFilePath(char *path, size_t size){
+
+  for(uint32_t n = stats.files + 1; ; n++){
+
+    snprintf(path, size, "%s/rec_%04u.wav", recordDir, n);
+
+    if(!recordFS->exists(path)) return;
+
+  }
+
+}
+
+/*
+
+  writerTask() - Copies recordings from ring to SD card. Runs at lower priority than capture task.
+
+*/
+
+static void writerTask(void *parameters){
+
+  AudioSink sink;
+  bool open = false;
+  bool ended = false;
+  uint32_t end = 0;
+  char path[96];
+  SegmentEvent event;
+
+  while(running || open){
+
+    if(!open){
+
+      // Start event stays queued until its file is open, so a failed open is retried.
+
+      if(xQueuePeek(segments, &event, 0) != pdTRUE){
+
+        vTaskDelay(pdMS_TO_TICKS(10));
+
+        continue;
+
+      }
+
+      nextFilePath(path, sizeof(path));
+
+      if(!sinkOpenWAVFile(sink, *recordFS, path, SAMPLE_RATE)){
+
+        vTaskDelay(pdMS_TO_TICKS(100));
+
+        continue;
+
+      }
+
+      xQueueReceive(segments, &event, 0);
+
+      readIndex = event.index;
+      open = true;
+      ended = false;
+
+      Serial.printf("Recording %s\n", path);
+
+    }
+
+    // Events alternate, so the next one is this recording's end.
+
+    if(!ended && xQueueReceive(segments, &event, 0) == pdTRUE){
+
+      ended = true;
+      end = event.index;
+
+    }
+
+    uint32_t read = readIndex.load(std::memory_order_relaxed);
+    uint32_t written = captureIndex.load(std::memory_order_acquire);
+
+    if(!running && !ended){
+
+      ended = true;
+      end = written;
+
+    }
+
+    if(written - read > stats.maxFill) stats.maxFill = written - read;
+
+    // Writer fell a whole ring behind, skip to oldest samples that cannot be overwritten during the next write.
+
+    uint32_t safe = capacity - LEVEL_WRITE_SAMPLES - LEVEL_BLOCK_SAMPLES;
+
+    if(written - read > safe){
+
+      uint32_t skip = written - read - safe;
+
+      stats.ringOverruns += skip;
+      read += skip;
+
+    }
+
+    uint32_t limit = ended && (int32_t)(end - written) < 0 ? end : written;
+    uint32_t available = (int32_t)(limit - read) > 0 ? limit - read : 0;
+
+    if(available == 0 && ended && (int32_t)(read - end) >= 0){
+
+      sinkClose(sink);
+
+      open = false;
+      stats.files++;
+
+      Serial.printf("Recorded %s, %u samples.\n", path, sink.bytesWritten / sizeof(int16_t));
+
+      // Capture may already have started the next recording.
+
+      int finishing = LEVEL_FINISHING;
+
+      if(running) state.compare_exchange_strong(finishing, LEVEL_ARMED);
+
+      continue;
+
+    }
+
+    // Wait for a full write unless recording has ended.
+
+    if(available < LEVEL_WRITE_SAMPLES && !ended){
+
+      vTaskDelay(pdMS_TO_TICKS(10));
+
+      continue;
+
+    }
+
+    uint32_t n = available < LEVEL_WRITE_SAMPLES ? available : LEVEL_WRITE_SAMPLES;
+    uint32_t offset = read & mask;
+    uint32_t first = capacity - offset < n ? capacity - offset : n;
+
+    sinkWrite(sink, (const uint8_t *)(ring + offset), first * sizeof(int16_t));
+
+    if(n > first) sinkWrite(sink, (const uint8_t *)ring, (n - first) * sizeof(int16_t));
+
+    readIndex.store(read + n, std::memory_order_release);
+
+  }
+
+  arenaUnwatchTask(xTaskGetCurrentTaskHandle());
+
+  tasksRunning--;
+
+  vTaskDelete(NULL);
+
+}
+
+/*
+
+  levelRecordDefaultOptions() - Sets options to LEVEL_THRESHOLD, LEVEL_PREROLL_MS and LEVEL_HOLD_MS, without noise
+  reduction.
+
+*/
+
+void levelRecordDefaultOptions(LevelRecordOptions &options){
+
+  options.threshold = LEVEL_THRESHOLD;
+  options.preRollMs = LEVEL_PREROLL_MS;
+  options.holdMs = LEVEL_HOLD_MS;
+  options.denoise = false;
+
+}
+
+/*
+
+  levelRecordArm() - Starts continuous capture and waits for audio above threshold.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * dirname - Directory for recordings, i.e. "/rec". Created if missing.
+  const LevelRecordOptions &options - threshold is the peak level, out of 32767, that starts a recording. preRollMs is
+  audio kept from before the trigger, holdMs the quiet time that ends a recording. denoise runs noise reduction in the
+  capture task.
+
+  return - false if already armed, or without PSRAM for the ring buffer.
+
+*/
+
+bool levelRecordArm(fs::FS &fs, const char * dirname, const LevelRecordOptions &options){
+
+  if(running || tasksRunning) return false;
+
+  for(capacity = LEVEL_WRITE_SAMPLES; capacity < SAMPLE_RATE * LEVEL_RING_SECONDS; capacity *= 2);
+
+  ring = psramFound() ? (int16_t *)heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : NULL;
+
+  if(!ring){
+
+    Serial.println(psramFound() ? "Pre-roll buffer could not be allocated." : "Level triggered recording needs PSRAM.");
+
+    return false;
+
+  }
+
+  mask = capacity - 1;
+
+  if(!segments) segments = xQueueCreate(LEVEL_SEGMENT_EVENTS, sizeof(SegmentEvent));
+
+  if(!segments){
+
+    heap_caps_free(ring);
+    ring = NULL;
+
+    return false;
+
+  }
+
+  xQueueReset(segments);
+
+  recordFS = &fs;
+  strncpy(recordDir, dirname, sizeof(recordDir) - 1);
+  recordDir[sizeof(recordDir) - 1] = 0;
+
+  if(!fs.exists(recordDir)) createDir(fs, recordDir);
+
+  threshold = options.threshold;
+  preRoll = SAMPLE_RATE * options.preRollMs / 1000;
+  hold = SAMPLE_RATE * options.holdMs / 1000;
+  denoise = options.denoise;
+
+  if(denoise) denoiseInit(reducer, SAMPLE_RATE);
+
+  // Pre-roll has to leave room in the ring for the writer to catch up.
+
+  if(preRoll > capacity / 2) preRoll = capacity / 2;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.dmaOverruns = I2SCaptureOverruns();
+
+  captureIndex = 0;
+  readIndex = 0;
+  state = LEVEL_ARMED;
+  running = true;
+  tasksRunning = 2;
+
+  i2s_set_adc_mode(ADC_UNIT_1, ADC1_CHANNEL_4);
+  i2s_adc_enable(I2S_NUM_0);
+
+  TaskHandle_t capture = NULL;
+  TaskHandle_t writer = NULL;
+
+  xTaskCreatePinnedToCore(captureTask, "Capture", 4096, NULL, 3, &capture, 0);
+  xTaskCreatePinnedToCore(writerTask, "RecWriter", 4096, NULL, 1, &writer, 1);
+
+  arenaWatchTask(capture, "Capture");
+  arenaWatchTask(writer, "RecWriter");
+
+  return true;
+
+}
+
+/*
+
+  levelRecordDisarm() - Stops capture. A recording in progress is ended and written out before this returns.
+
+*/
+
+void levelRecordDisarm(){
+
+  if(!running) return;
+
+  running = false;
+
+  while(tasksRunning) vTaskDelay(pdMS_TO_TICKS(10));
+
+  i2s_adc_disable(I2S_NUM_0);
+
+  heap_caps_free(ring);
+  ring = NULL;
+
+  if(denoise) denoiseReport(reducer);
+
+  state = LEVEL_DISARMED;
+
+}
+
+// Returns counters. dmaOverruns and ringOverruns should stay at 0, anything else means audio was lost.
+
+LevelRecordStats levelRecordStats(){
+
+  LevelRecordStats current = stats;
+
+  current.state = (levelRecordState)state.load();
+
+  return current;
+
+}
@@ -0,0 +1,76 @@
+#ifndef _LEVEL_RECORD_H
+#define _LEVEL_RECORD_H
+
+/*
+
+  Level triggered recording.
+
+  While armed, a capture task reads I2S_NUM_0 continuously into a pre-roll ring buffer in PSRAM and never waits on
+  the SD card. When a block peaks at or above threshold, a recording starts preRollMs before that block.
+  It ends once holdMs pass without another loud block.
+
+  A separate writer task copies recordings from the ring buffer to numbered files, i.e. "/rec/rec_0001.wav", in
+  LEVEL_WRITE_SAMPLES blocks. If the writer falls more than a ring buffer behind, the oldest audio is lost and
+  counted in ringOverruns. dmaOverruns counts capture DMA buffers that were overwritten before being read.
+
+  A loud block during LEVEL_FINISHING, while the writer still empties the ring, starts the next recording right away.
+
+  With denoise set, the capture task runs noise reduction on each block before it goes into the ring, so the trigger
+  sees cleaned audio, see denoise.h. The first half second after arming is taken as the noise profile.
+
+  LEVEL_RING_SECONDS - Least ring buffer length, rounded up to a power of 2 samples. Seconds of audio do not fit an
+  audio arena pool block, and the writer needs LEVEL_WRITE_SAMPLES of the ring to itself, so boards without PSRAM
+  can not arm.
+  LEVEL_BLOCK_SAMPLES - Samples per i2s_read().
+  LEVEL_WRITE_SAMPLES - Largest write to SD.
+  LEVEL_THRESHOLD - Default trigger peak, out of 32767. 2000 is -24dBFS, about 62 LSB of the built in ADC after
+  conditionADCSamples(), well above its noise and mains hum of a few LSB.
+
+*/
+
+#include "mono_file.h"
+
+#define LEVEL_RING_SECONDS 4
+#define LEVEL_BLOCK_SAMPLES 256
+#define LEVEL_WRITE_SAMPLES 8192
+
+#define LEVEL_THRESHOLD 2000
+#define LEVEL_PREROLL_MS 500
+#define LEVEL_HOLD_MS 2000
+
+typedef enum{
+
+  LEVEL_DISARMED,
+  LEVEL_ARMED,
+  LEVEL_RECORDING,
+  LEVEL_FINISHING
+
+} levelRecordState;
+
+// Options for levelRecordArm(), set to defaults with levelRecordDefaultOptions().
+
+struct LevelRecordOptions {
+
+  int16_t threshold;
+  uint32_t preRollMs;
+  uint32_t holdMs;
+  bool denoise;
+
+};
+
+struct LevelRecordStats {
+
+  levelRecordState state;
+  uint32_t files;
+  uint32_t ringOverruns;
+  uint32_t dmaOverruns;
+  uint32_t maxFill;
+
+};
+
+void levelRecordDefaultOptions(LevelRecordOptions &options);
+bool levelRecordArm(fs::FS &fs, const char * dirname, const LevelRecordOptions &options);
+void levelRecordDisarm();
+LevelRecordStats levelRecordStats();
+
+#endif
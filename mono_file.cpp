@@ -1,28 +1,106 @@
 #include "mono_file.h"
 #include "i2s.h"
+#include "sample_format.h"
+#include "analysis.h"
+#include "audio_arena.h"
+#include "decimator.h"
+#include "denoise.h"
+#include "track_cache.h"
+
+// Data chunk alignment used by createMonoWAVFile(), set with setMonoWAVAlignment(). 0 writes the plain 44 byte header.
+
+static uint32_t wavDataAlign = 0;
+
+/*
+
+  setMonoWAVAlignment() - Sets where createMonoWAVFile() starts the data chunk. Header is padded with a JUNK chunk so
+  the first sample lands on a multiple of align, i.e. SECTOR_SIZE, so reads and writes of sample data never straddle
+  a sector. A cluster size also works, at the cost of that much padding per file.
+
+  uint32_t align - Alignment in bytes. Must be a power of two, or 0 for no padding.
+
+*/
+
+void setMonoWAVAlignment(uint32_t align){
+
+  if(align & (align - 1)){
+
+    Serial.printf("WAV data alignment %u is not a power of two.\n", align);
+
+    return;
+
+  }
+
+  wavDataAlign = align;
+
+}
+
+// Returns JUNK chunk payload size that moves a data chunk header at headerEnd onto an align boundary.
+
+static uint32_t junkPadding(uint32_t headerEnd, uint32_t align){
+
+  uint32_t dataOffset = headerEnd + 8 + 8;
+
+  dataOffset = (dataOffset + align - 1) & ~(align - 1);
+
+  return dataOffset - headerEnd - 8 - 8;
+
+}
+
+// Writes a JUNK chunk with a zeroed payload of size bytes.
+
+static bool writeJunkChunk(File &file, uint32_t size){
+
+  uint8_t zeros[64] = {0};
+
+  if(file.write((const uint8_t *)"JUNK", 4) != 4 || file.write((uint8_t *)&size, 4) != 4) return false;
+
+  while(size > 0){
+
+    uint32_t n = size < sizeof(zeros) ? size : sizeof(zeros);
+
+    if(file.write(zeros, n) != n) return false;
+
+    size -= n;
+
+  }
+
+  return true;
+
+}
 
 /*
 
   createMonoWAVFile() - Creates an empty mono WAV file on SD card at given location.
 
+  If setMonoWAVAlignment() was called, a JUNK chunk goes between the fmt and data chunks so samples start aligned.
+  Players skip JUNK chunks, and readMonoWAVHeader() returns the real data offset.
+
   fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
   const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
   uint32_t num_samples - Total number of samples in file. If file size is not known on creation, this can be changed in editMonoWAVHeader().
   uint32_t sample_rate - Sample rate of file. We are using CD quality audio, so this should always be 44100.
   uint16_t bits_per_sample - Number of bits per sample. We are using 16 bit PCM WAV, so this should always be 16.
 
-  return - This function does not return on success. Instead, file will simply appear on SD card. Can be checked using listDir() in created file directory.
+  return - File offset of first sample, or 0 if file could not be written. Can be checked using listDir() in created file directory.
 
 */
 
-void createMonoWAVFile(fs::FS &fs, const char *path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample) {
+uint32_t createMonoWAVFile(fs::FS &fs, const char *path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample) {
 
   struct MonoWAVHeader header;
 
   int num_channels = 1;
 
+  // RIFF and fmt chunks take 36 bytes, everything after them is JUNK and data chunk.
+
+  const uint32_t fmtEnd = 36;
+
+  uint32_t junk = wavDataAlign ? junkPadding(fmtEnd, wavDataAlign) : 0;
+  uint32_t dataOffset = fmtEnd + (wavDataAlign ? 8 + junk : 0) + 8;
+
   memcpy(header.riff, "RIFF", 4);
-  header.chunk_size = 36 + (num_samples * num_channels * (bits_per_sample / 8));
+  header.chunk_size = dataOffset - 8 + (num_samples * num_channels * (bits_per_sample / 8));
   memcpy(header.wave, "WAVE", 4);
   memcpy(header.fmt, "fmt ", 4);
   header.subchunk1_size = 16;
@@ -41,15 +119,18 @@ void createMonoWAVFile(fs::FS &fs, const char *path, uint32_t num_samples, uint3
 
     Serial.println("File could not be created.");
 
-    return;
+    return 0;
   }
 
-  size_t headerSize = sizeof(header);
-  size_t written = file.write((uint8_t *)&header, headerSize);
+  bool ok = file.write((uint8_t *)&header, fmtEnd) == fmtEnd;
 
-  if (written == headerSize) {
+  if (ok && wavDataAlign) ok = writeJunkChunk(file, junk);
 
-    Serial.print((uint16_t)written);
+  if (ok) ok = file.write((uint8_t *)&header + fmtEnd, 8) == 8;
+
+  if (ok) {
+
+    Serial.print(dataOffset);
     Serial.println(" bytes written successfullyy.");
 
   }
@@ -58,16 +139,22 @@ void createMonoWAVFile(fs::FS &fs, const char *path, uint32_t num_samples, uint3
 
     Serial.println("Data could not be written to file.");
 
-    return;
+    file.close();
+
+    return 0;
   }
 
   file.close();
+
+  return dataOffset;
 }
 
 /*
 
   editMonoWAVHeader() - Edits header information after creation. Used when file information is not static, or not known at creation, and needs to be updated.
 
+  The data chunk is found by walking the header, so files with a JUNK chunk from setMonoWAVAlignment() are handled.
+
   fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
   const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
   uint32_t num_samples - Total number of samples in file. If file size is not known on creation, this can be changed in editMonoWAVHeader().
@@ -80,6 +167,11 @@ void createMonoWAVFile(fs::FS &fs, const char *path, uint32_t num_samples, uint3
 
 void editMonoWAVHeader(fs::FS &fs, const char * path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample){
 
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, path, header, dataOffset)) return;
+
   File file = fs.open(path, "r+");
 
   if(!file){
@@ -89,12 +181,12 @@ void editMonoWAVHeader(fs::FS &fs, const char * path, uint32_t num_samples, uint
   }
 
   uint32_t subChunk2Size = num_samples * (bits_per_sample / 8);
-  uint32_t chunkSize = 36 + subChunk2Size;
+  uint32_t chunkSize = dataOffset - 8 + subChunk2Size;
 
   file.seek(4);
   file.write((uint8_t *)&chunkSize, 4);
 
-  file.seek(40);
+  file.seek(dataOffset - 4);
   file.write((uint8_t *)&subChunk2Size, 4);
 
   file.close();
@@ -116,36 +208,29 @@ void editMonoWAVHeader(fs::FS &fs, const char * path, uint32_t num_samples, uint
 
 void writeSineWave(fs::FS &fs, const char * path, float freq, float duration){
 
-  createMonoWAVFile(fs, path, 44100, 44100, 16);
+  uint32_t numSamples = SAMPLE_RATE * duration;
 
-  File file = fs.open(path, FILE_APPEND);
+  createMonoWAVFile(fs, path, numSamples, SAMPLE_RATE, 16);
 
-  int sum = 0;
-  int expectedSum = 0;
+  File file = fs.open(path, FILE_APPEND);
 
-  int bufferSize = 256;
+  const int bufferSize = 256;
 
-  uint16_t buffer[bufferSize];
+  int16_t buffer[bufferSize];
 
   int j = 0;
 
-  int i;
-
-  int f = 1;
-
   Serial.println(freq);
 
-  int s = 44100;
-
-  for (i = 0; i < (s * duration); i++) {
+  for (uint32_t i = 0; i < numSamples; i++) {
 
-    buffer[j++] = (uint16_t)((sin(M_TWO_PI * freq * ((double)i / 44100)) * 32767) * 0.5f);
+    buffer[j++] = (int16_t)(sin(M_TWO_PI * freq * ((double)i / SAMPLE_RATE)) * 32767 * 0.5);
 
     if (j == bufferSize) {
 
       j = 0;
 
-      size_t written = file.write((uint8_t*)&buffer, bufferSize * sizeof(uint16_t));
+      file.write((uint8_t*)buffer, bufferSize * sizeof(int16_t));
 
     }
 
@@ -153,13 +238,11 @@ void writeSineWave(fs::FS &fs, const char * path, float freq, float duration){
 
   if (j > 0) {
 
-    file.write((uint8_t*)&buffer, j * sizeof(uint16_t));
+    file.write((uint8_t*)buffer, j * sizeof(int16_t));
   }
 
   file.close();
 
-  editMonoWAVHeader(fs, path, (int) (s * duration), 44100, 16);
-
 }
 
 /*
@@ -169,88 +252,280 @@ void writeSineWave(fs::FS &fs, const char * path, float freq, float duration){
   fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
   const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
 
-  return - This function returns the duration of a file in seconds, rounded.
+  return - Duration in seconds, rounded down, and length in sample frames.
 
 */
 
 std::vector<int> printMonoWAVData(fs::FS &fs, const char * path){
 
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, path, header, dataOffset) || header.sample_rate == 0) return {0, 0};
+
+  uint16_t numChannels = header.num_channels;
+  uint32_t sampleRate = header.sample_rate;
+
+  uint32_t frames = monoWAVSamples(header);
+
+  Serial.printf("\nFILE INFO:\n\nNUM CHANNELS: %d\nSAMPLE RATE: %d\nDATA OFFSET: %u%s\nDuration: %.2fs\n\n", numChannels, sampleRate, dataOffset, dataOffset % SECTOR_SIZE ? "" : " (sector aligned)", (double)frames / sampleRate);
+
+  return {(int)(frames / sampleRate), (int)frames};
+
+}
+
+/*
+
+  readMonoWAVHeader() - Reads header of a WAV file by walking its chunks, so files with extra chunks before the
+  data chunk (i.e. LIST or JUNK) are handled.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  MonoWAVHeader &header - Filled with fmt chunk fields and data chunk size.
+  uint32_t &dataOffset - Set to file offset of first sample.
+
+  return - true if both fmt and data chunks were found.
+
+*/
+
+bool readMonoWAVHeader(fs::FS &fs, const char * path, MonoWAVHeader &header, uint32_t &dataOffset){
+
   File file = fs.open(path, FILE_READ);
 
-  // if(!file){
+  if(!file){
+
+    Serial.printf("%s could not be opened.\n", path);
+
+    return false;
+
+  }
+
+  bool foundFmt = false;
+  bool foundData = false;
+
+  if(file.read((uint8_t *)&header, 12) != 12 || memcmp(header.riff, "RIFF", 4) != 0 || memcmp(header.wave, "WAVE", 4) != 0){
+
+    Serial.printf("%s is not a WAV file.\n", path);
+
+    file.close();
+
+    return false;
+
+  }
+
+  char id[4];
+  uint32_t size;
+  uint32_t position = 12;
+
+  while(!foundData && file.read((uint8_t *)id, 4) == 4 && file.read((uint8_t *)&size, 4) == 4){
+
+    position += 8;
+
+    if(memcmp(id, "fmt ", 4) == 0 && size >= 16){
+
+      memcpy(header.fmt, id, 4);
+      header.subchunk1_size = size;
+      file.read((uint8_t *)&header.audio_format, 16);
+      foundFmt = true;
 
-  //   Serial.printf("%s could not be opened.\n", path);
+      // WAVE_FORMAT_EXTENSIBLE keeps the real format in the first 2 bytes of its sub format GUID.
 
-  //   return NULL;
+      if(header.audio_format == WAV_FORMAT_EXTENSIBLE && size >= 40){
 
-  // }
+        file.seek(position + 24);
+        file.read((uint8_t *)&header.audio_format, 2);
 
-  uint16_t numChannels;
-  uint32_t sampleRate;
-  uint32_t fileSize;
+      }
 
+    }
+
+    else if(memcmp(id, "data", 4) == 0){
+
+      memcpy(header.data, id, 4);
+      header.subchunk2_size = size;
+      dataOffset = position;
+      foundData = true;
 
-  file.seek(22);
-  file.read((uint8_t *)&numChannels, 2);
+      break;
 
-  file.seek(24);
-  file.read((uint8_t *)&sampleRate, 4);
+    }
+
+    // Chunks are padded to even length.
 
-  file.seek(40);
-  file.read((uint8_t *)&fileSize, 4);
+    position += size + (size & 1);
+    file.seek(position);
 
-  Serial.printf("\nFILE INFO:\n\nNUM CHANNELS: %d\nSAMPLE RATE: %d\nDuration: %.2fs\n\n", numChannels, sampleRate, (double) (fileSize / sampleRate / 2));
+  }
 
   file.close();
 
-  return {(int)(fileSize / sampleRate / 2), (int)(fileSize / 2)};
+  return foundFmt && foundData;
+
+}
+
+// Returns number of samples in data chunk of a header read by readMonoWAVHeader().
+
+uint32_t monoWAVSamples(const MonoWAVHeader &header){
+
+  return header.block_align ? header.subchunk2_size / header.block_align : header.subchunk2_size / 2;
 
 }
 
 /*
 
-  playMonoWAVFile() - Plays a given WAV file by sending sample data to I2S audio converter. Uses i2s.h i2s_write() to send buffer data.
+  applyGain() - Scales samples in place, clipping to 16 bit range. Gain is converted to Q12 fixed point once per
+  block, so output is the same on every platform.
+
+  int16_t *samples - Samples to scale.
+  size_t sampleCount - Number of samples.
+  float gain - Gain, i.e. 1.0 for no change.
+
+*/
+
+void applyGain(int16_t *samples, size_t sampleCount, float gain){
+
+  int32_t gainQ = (int32_t)(gain * (1 << GAIN_SHIFT) + 0.5f);
+
+  if(gainQ == (1 << GAIN_SHIFT)) return;
+
+  for(size_t i = 0; i < sampleCount; i++){
+
+    int32_t v = ((int32_t)samples[i] * gainQ) >> GAIN_SHIFT;
+
+    if(v > 32767) v = 32767;
+    if(v < -32768) v = -32768;
+
+    samples[i] = v;
+
+  }
+
+}
+
+/*
+
+  renderMonoWAVFile() - Runs a WAV file through the playback chain (header parsing, format conversion, gain) into a sink.
+
+  Non I2S sinks run as fast as possible. Time taken and speed relative to real time are printed to serial monitor.
 
   fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
-  const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  const char * path - Name of file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  AudioSink &sink - Destination. Sink is not closed.
+  float gain - Gain applied to every sample.
 
-  return - This function does not return. 
+  return - Number of samples rendered.
 
 */
 
-void playMonoWAVFile(fs::FS &fs, const char * path){
-
-  File file = fs.open(path, "r");
+uint32_t renderMonoWAVFile(fs::FS &fs, const char * path, AudioSink &sink, float gain){
 
+  MonoWAVHeader header;
+  SampleFormat format;
+  uint32_t dataOffset;
+  BlockReader reader;
+  uint8_t * data;
   size_t bytes_read;
-  size_t bytes_written;
-  uint16_t buffer[256];
-  int16_t * samples;
-  size_t sampleCount;
+  uint32_t totalSamples = 0;
+  int16_t converted[CHUNK_SIZE / 2];
 
-  if(!file){
+  if(!readMonoWAVHeader(fs, path, header, dataOffset)) return 0;
 
-    Serial.printf("%s could not be opened.\n", path);
+  if(!selectSampleFormat(header, format)){
 
-    return;
+    Serial.printf("%s: unsupported sample format.\n", path);
+
+    return 0;
 
   }
 
-  Serial.printf("Opened %s\n", path);
+  if(!blockReaderOpen(reader, fs, path, dataOffset)) return 0;
 
-  file.seek(44);
+  blockReaderSetEnd(reader, dataOffset + header.subchunk2_size);
 
-  while(file.available() && (bytes_read = file.read((uint8_t *)buffer, sizeof(buffer))) > 0){
+  size_t viewSize = sink.type == SINK_I2S || format.convert ? CHUNK_SIZE : READ_BLOCK_SIZE;
+  size_t bytesPerSample = format.bytesPerSample;
 
-    sampleCount = bytes_read / 2;
+  PipelineParams params;
+
+  pipelineInitParams(params);
+
+  params.gain[PIPELINE_SEGMENT_GAIN] = pipelineGain(gain);
+
+  unsigned long start = micros();
 
-    samples = (int16_t*)buffer;
+  while((bytes_read = blockReaderNext(reader, &data, viewSize / sizeof(int16_t) * bytesPerSample, bytesPerSample)) > 0){
 
-    i2s_write(I2S_NUM_1, buffer, bytes_read, &bytes_written, portMAX_DELAY);
+    size_t sampleCount = bytes_read / bytesPerSample;
+
+    // 16 bit data is processed in place, other formats are decoded into converted.
+
+    int16_t *out = format.convert ? converted : (int16_t *)data;
+
+    format.play(data, out, sampleCount, params);
+
+    sinkWrite(sink, (uint8_t *)out, sampleCount * sizeof(int16_t));
+
+    totalSamples += sampleCount;
 
   }
 
-  file.close();
+  unsigned long elapsed = micros() - start;
+
+  blockReaderClose(reader);
+
+  double seconds = (double)totalSamples / header.sample_rate;
+
+  Serial.printf("Rendered %u samples (%.2fs) in %lu ms, %.1fx real time.\n", totalSamples, seconds, elapsed / 1000, elapsed ? seconds * 1000000.0 / elapsed : 0.0);
+
+  return totalSamples;
+
+}
+
+/*
+
+  checkMonoWAVRender() - Renders a file and compares output against a golden WAV file rendered earlier with the same gain.
+  Used to catch regressions when processing changes. host/render_test does the same on Linux for the reference inputs
+  and golden files in host/data.
+
+  return - Number of mismatching samples. 0 if output is bit exact.
+
+*/
+
+uint32_t checkMonoWAVRender(fs::FS &fs, const char * path, const char * goldenPath, float gain){
+
+  AudioSink sink;
+
+  if(!sinkOpenCompare(sink, fs, goldenPath)) return 0xFFFFFFFF;
+
+  renderMonoWAVFile(fs, path, sink, gain);
+
+  sinkClose(sink);
+
+  Serial.printf("%s vs %s: %u mismatching samples, max error %d.\n", path, goldenPath, sink.mismatches, sink.maxError);
+
+  return sink.mismatches;
+
+}
+
+/*
+
+  playMonoWAVFile() - Plays a given WAV file by sending sample data to I2S audio converter through an I2S sink.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+
+  return - This function does not return. 
+
+*/
+
+void playMonoWAVFile(fs::FS &fs, const char * path){
+
+  AudioSink sink;
+
+  sinkInitI2S(sink, I2S_NUM_1);
+
+  Serial.printf("Playing %s\n", path);
+
+  renderMonoWAVFile(fs, path, sink, 1.0);
 
 }
 
@@ -262,6 +537,9 @@ void playMonoWAVFile(fs::FS &fs, const char * path){
   After writing, original file is deleted, and temporary file is renamed. I did it this way because reading and writing
   over same file significantly increased amount of time needed. 
 
+  RMS comes from analyzeTrack(), which uses both cores unless audio is playing. Only 16 bit mono PCM files are
+  normalized, other formats are skipped with a message, since samples are scaled in place.
+
   This is used primarily to normalize all files on the SD card for listening purposes. Should be called when new 
   files are added to ensure that all files are at approximately the same level of "loudness".
 
@@ -276,45 +554,65 @@ void playMonoWAVFile(fs::FS &fs, const char * path){
 
 void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization){
 
-  int16_t buffer[512];
+  BlockReader reader;
+  uint8_t * data;
   int16_t * samples;
   size_t bytes_read;
   size_t sampleCount;
   size_t totalSamples = 0;
 
-  double rms = rootMeanSquare(fs, path);
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, path, header, dataOffset)){
+
+    Serial.println("File could not be found.");
+
+    return;
+
+  }
+
+  // Samples are scaled in place as 16 bit mono, other formats would be rewritten as garbage.
+
+  if(header.audio_format != 1 || header.num_channels != 1 || header.bits_per_sample != 16){
+
+    Serial.printf("%s skipped, only 16 bit mono PCM files are normalized.\n", path);
+
+    return;
+
+  }
+
+  static TrackAnalysis analysis;
+
+  if(!analyzeTrack(fs, path, analysis)) return;
+
+  double rms = analysis.rms;
   double normalizationRatio = normalization / rms;
   double normalizedSample;
 
-  File file = fs.open(path, "r+");
+  uint32_t fileSize = header.subchunk2_size;
 
-  if(!file){
+  double numSamples = monoWAVSamples(header);
 
-    Serial.println("File could not be found.");
+  if(!blockReaderOpen(reader, fs, path, dataOffset)){
 
     return;
 
   }
 
-  uint32_t fileSize;
-  file.seek(40);
-  file.read((uint8_t *)&fileSize, 4);
-
-  double numSamples = (fileSize / 2);
+  blockReaderSetEnd(reader, dataOffset + fileSize);
 
-  createMonoWAVFile(fs, "/temp.wav", numSamples, 44100, 16);
+  uint32_t tempOffset = createMonoWAVFile(fs, "/temp.wav", numSamples, header.sample_rate, 16);
   File temp = fs.open("/temp.wav", "r+");
-  temp.seek(44);
-
-  file.seek(44);
+  temp.seek(tempOffset);
 
   Serial.println("Normalizing.");
 
-  while(file.available() && (bytes_read = file.read((uint8_t *)buffer, sizeof(buffer))) > 0){
+  while((bytes_read = blockReaderNext(reader, &data, READ_BLOCK_SIZE)) > 0){
 
     sampleCount = bytes_read / 2;
 
-    samples = (int16_t*)buffer;
+    samples = (int16_t*)data;
 
     for(size_t i = 0; i < sampleCount; i++){
 
@@ -329,7 +627,7 @@ void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization){
 
     //file.seek(file.position() - bytes_read);
 
-    temp.write((uint8_t*)&buffer, bytes_read);
+    temp.write(data, bytes_read);
 
     totalSamples += sampleCount;
 
@@ -337,13 +635,18 @@ void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization){
 
   }
 
-  file.close();
+  blockReaderClose(reader);
   temp.close();
 
   Serial.printf("PATH: %s\n", path);
 
+  fileChangeBegin(path);
+
   deleteFile(fs, path);
   renameFile(fs, "/temp.wav", path);
+  trackCacheInvalidate(path);
+
+  fileChangeEnd(path);
 
   //Serial.println("Normalization complete.");
 
@@ -352,6 +655,194 @@ void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization){
 
 }
 
+/*
+
+  alignMonoWAVFile() - Rewrites an existing WAV file so its samples start on a multiple of align. A JUNK chunk is
+  inserted in front of the data chunk. The aligned copy is written to "path.aln", then the original is removed and
+  the copy renamed over it, the same way serial transfers replace files.
+
+  Original is never written to, so power loss while copying leaves it as it was, with a stale .aln file the next run
+  overwrites. Card needs room for a second copy of the file. Files already aligned are left alone. A track playing
+  from the file is closed while it is replaced and reopened after, see setFileChangeHandler(). Call from the task that
+  calls trackCacheService().
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  uint32_t align - Alignment in bytes, a power of two, i.e. SECTOR_SIZE.
+
+  return - true if file is aligned when done.
+
+*/
+
+bool alignMonoWAVFile(fs::FS &fs, const char * path, uint32_t align){
+
+  char tempPath[256];
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(align == 0 || (align & (align - 1)) || !readMonoWAVHeader(fs, path, header, dataOffset)) return false;
+
+  if(dataOffset % align == 0) return true;
+
+  if(snprintf(tempPath, sizeof(tempPath), "%s.aln", path) >= (int)sizeof(tempPath)) return false;
+
+  uint32_t chunkStart = dataOffset - 8;
+  uint32_t junk = junkPadding(chunkStart, align);
+  uint32_t shift = 8 + junk;
+
+  uint8_t *block = arenaTakeBlock();
+
+  if(!block){
+
+    Serial.println("No free copy buffer in audio arena.");
+
+    return false;
+
+  }
+
+  File file = fs.open(path, FILE_READ);
+  File temp = fs.open(tempPath, FILE_WRITE);
+
+  if(!file || !temp){
+
+    Serial.printf("%s could not be opened.\n", file ? tempPath : path);
+
+    if(file) file.close();
+    if(temp) temp.close();
+    arenaGiveBlock(block);
+
+    return false;
+
+  }
+
+  uint32_t size = file.size();
+  uint32_t riffSize = size + shift - 8;
+  uint32_t pos = 0;
+  bool ok = chunkStart <= ARENA_BLOCK_BYTES;
+
+  unsigned long start = millis();
+
+  // Header up to the data chunk, with the RIFF size grown by the JUNK chunk that follows it.
+
+  if(ok) ok = file.read(block, chunkStart) == chunkStart;
+
+  if(ok){
+
+    memcpy(block + 4, &riffSize, 4);
+
+    ok = temp.write(block, chunkStart) == chunkStart && writeJunkChunk(temp, junk);
+
+    pos = chunkStart;
+
+  }
+
+  // Chunks are cut so every write after the first ends on a block boundary of the new layout.
+
+  while(ok && pos < size){
+
+    uint32_t dest = pos + shift;
+    uint32_t n = ARENA_BLOCK_BYTES - dest % ARENA_BLOCK_BYTES;
+
+    if(n > size - pos) n = size - pos;
+
+    ok = file.read(block, n) == n && temp.write(block, n) == n;
+
+    pos += n;
+
+  }
+
+  file.close();
+  temp.close();
+  arenaGiveBlock(block);
+
+  if(!ok){
+
+    Serial.printf("%s could not be aligned, file left as it was.\n", path);
+
+    fs.remove(tempPath);
+
+    return false;
+
+  }
+
+  // The playing track lets go of the file while it is replaced. Samples do not change, but cached ranges point into
+  // the old file, so they are dropped.
+
+  fileChangeBegin(path);
+
+  bool renamed = fs.remove(path) && fs.rename(tempPath, path);
+
+  trackCacheInvalidate(path);
+  fileChangeEnd(path);
+
+  if(!renamed){
+
+    Serial.printf("%s could not be renamed to %s.\n", tempPath, path);
+
+    return false;
+
+  }
+
+  Serial.printf("%s: data moved from %u to %u in %lu ms.\n", path, dataOffset, dataOffset + shift, millis() - start);
+
+  return true;
+
+}
+
+/*
+
+  benchmarkAlignment() - Shows read speed gained by aligning the data chunk. Copies a WAV file twice, once with the
+  plain 44 byte header and once aligned to SECTOR_SIZE, and runs benchmarkRead() on both from their data offsets.
+  Copies are removed when done.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Source WAV file.
+
+*/
+
+void benchmarkAlignment(fs::FS &fs, const char * path){
+
+  const char *copies[2] = {"/align_44.wav", "/align_512.wav"};
+  uint32_t aligns[2] = {0, SECTOR_SIZE};
+  uint32_t saved = wavDataAlign;
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, path, header, dataOffset)) return;
+
+  for(int i = 0; i < 2; i++){
+
+    wavDataAlign = aligns[i];
+
+    uint32_t offset = createMonoWAVFile(fs, copies[i], monoWAVSamples(header), header.sample_rate, header.bits_per_sample);
+
+    BlockReader reader;
+    uint8_t *data;
+    size_t n;
+
+    File copy = fs.open(copies[i], FILE_APPEND);
+
+    if(!offset || !copy || !blockReaderOpen(reader, fs, path, dataOffset)) break;
+
+    blockReaderSetEnd(reader, dataOffset + header.subchunk2_size);
+
+    while((n = blockReaderNext(reader, &data, READ_BLOCK_SIZE)) > 0) copy.write(data, n);
+
+    blockReaderClose(reader);
+    copy.close();
+
+    benchmarkRead(fs, copies[i], offset);
+
+    deleteFile(fs, copies[i]);
+
+  }
+
+  wavDataAlign = saved;
+
+}
+
 /*
 
   rootMeanSquare() Used to find root mean square of given file, which gives an approximate average "loudness".
@@ -367,7 +858,8 @@ void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization){
 
 double rootMeanSquare(fs::FS &fs, const char * path){
 
-  int buffer[512];
+  BlockReader reader;
+  uint8_t * data;
   double rms = 0.0;
   size_t bytes_read;
   size_t totalSamples = 0;
@@ -376,9 +868,10 @@ double rootMeanSquare(fs::FS &fs, const char * path){
 
   double normalizedSample;
 
-  File file = fs.open(path, "r+");
+  MonoWAVHeader header;
+  uint32_t dataOffset;
 
-  if(!file){
+  if(!readMonoWAVHeader(fs, path, header, dataOffset) || !blockReaderOpen(reader, fs, path, dataOffset)){
 
     Serial.println("File could not be opened.");
 
@@ -386,15 +879,15 @@ double rootMeanSquare(fs::FS &fs, const char * path){
 
   }
 
-  file.seek(44);
+  blockReaderSetEnd(reader, dataOffset + header.subchunk2_size);
 
-  while(file.available() && (bytes_read = file.read((uint8_t*)&buffer, sizeof(buffer))) > 0){
+  while((bytes_read = blockReaderNext(reader, &data, READ_BLOCK_SIZE)) > 0){
 
     sampleCount = bytes_read / 2;
 
     totalSamples += sampleCount;
 
-    samples = (int16_t*)buffer;
+    samples = (int16_t*)data;
 
     for(int i=0;i<sampleCount;i++){
 
@@ -410,74 +903,220 @@ double rootMeanSquare(fs::FS &fs, const char * path){
 
   Serial.printf("%.2f\t%d\n", rms, totalSamples);
 
-  file.close();
+  blockReaderClose(reader);
 
   return rms;
 
 }
 
-void record(fs::FS &fs, const char * path, double duration){
+/*
+
+  conditionADCSamples() - Converts raw 12 bit built in ADC samples to signed 16 bit, with 2x gain and a DC blocking high-pass.
+
+  const uint16_t *raw - Samples from i2s_read() on I2S_NUM_0.
+  int16_t *out - Converted samples. May not be the same buffer as raw.
+  int numSamples - Number of samples.
+  float &prev - High-pass state. Keep one per capture stream, starting at 0.
+
+*/
+
+void conditionADCSamples(const uint16_t *raw, int16_t *out, int numSamples, float &prev){
+
+  // Decode and 2x gain are a pipeline, see sample_pipeline.h.
+
+  static const PipelineParams adcGain = {{2 << GAIN_SHIFT, 1 << GAIN_SHIFT}};
+
+  runPipeline<ADC12, 1, GainStage<0> >((const uint8_t *)raw, out, numSamples, adcGain);
+
+  // prev tracks the DC level with a one pole low-pass, about 35Hz at 44.1kHz, and is taken off each sample.
+
+  float alpha = 0.995;
+  for (int i = 0; i < numSamples; i++) {
+    float s = out[i];
+    prev = alpha * prev + (1.0 - alpha) * s;
+    float filtered = s - prev;
+
+    if (filtered > 32767) filtered = 32767;
+    if (filtered < -32768) filtered = -32768;
+
+    out[i] = (int16_t)filtered;
+  }
+
+}
+
+// Capture buffers of record(): raw ADC samples, conditioned samples, and denoised output. Denoised output takes a
+// block plus DENOISE_HOP from denoiseProcess(), and DENOISE_FFT_SIZE from denoiseFinish().
+
+#define RECORD_BUF_LEN 256
+#define RECORD_CLEAN_LEN (RECORD_BUF_LEN + DENOISE_HOP > DENOISE_FFT_SIZE ? RECORD_BUF_LEN + DENOISE_HOP : DENOISE_FFT_SIZE)
+#define RECORD_BUFFER_BYTES ((2 * RECORD_BUF_LEN + RECORD_CLEAN_LEN) * sizeof(int16_t))
+
+static uint8_t *captureBuffer = NULL;
+
+/*
+
+  recordInit() - Takes capture buffers for record() from the audio arena. Call once from setup(), before arenaSeal().
+  Taken for good rather than as a pool block, since they are a tenth of a block.
+
+  return - false if the arena has no room. record() then does nothing.
+
+*/
+
+bool recordInit(){
+
+  captureBuffer = (uint8_t *)arenaAlloc(RECORD_BUFFER_BYTES, "Record capture");
+
+  return captureBuffer != NULL;
+
+}
+
+// Sets record() options to a plain 44.1kHz recording, no trimming and no noise reduction.
+
+void recordDefaultOptions(RecordOptions &options){
+
+  options.sample_rate = SAMPLE_RATE;
+  options.trimSilence = false;
+  options.denoise = false;
+
+}
+
+/*
 
+  record() - Records from built in ADC on I2S_NUM_0 to a mono 16 bit WAV file.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of created file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  double duration - Capture time in seconds.
+  const RecordOptions &options - Rate, trimming and noise reduction, see RecordOptions in mono_file.h. With a lower
+  rate, filter cost per input sample is printed when done, see decimator.h. With noise reduction, the first half second
+  should be room noise only, it is used as the noise profile, and cycles per block are printed when done.
+
+  return - This function does not return. printMonoWAVData() can be used to check recorded length.
+
+*/
+
+void record(fs::FS &fs, const char * path, double duration, const RecordOptions &options){
+
+  uint32_t sample_rate = options.sample_rate;
+  bool trimSilence = options.trimSilence;
+  bool denoise = options.denoise;
+
+  static Decimator decimator;
+  uint32_t captureRate = decimatorCaptureRate(sample_rate);
+
+  if(!captureRate || !decimatorInit(decimator, captureRate, sample_rate)){
+
+    Serial.printf("Recording at %u Hz is not supported.\n", sample_rate);
+
+    return;
+
+  }
+
+  // Capture buffers come from the arena instead of the caller's stack, see recordInit().
+
+  const int BUF_LEN = RECORD_BUF_LEN;
+  uint8_t *block = captureBuffer;
+
+  if(!block){
+
+    Serial.println("No capture buffer in audio arena, see recordInit().");
+
+    return;
+
+  }
+
+  uint16_t *buffer = (uint16_t *)block;
+  int16_t *buffer16 = (int16_t *)(block + BUF_LEN * sizeof(uint16_t));
+  int16_t *cleaned = buffer16 + BUF_LEN; // RECORD_CLEAN_LEN samples.
+
+  static NoiseReducer reducer;
+
+  if(denoise) denoiseInit(reducer, sample_rate);
+
+  i2s_set_sample_rates(I2S_NUM_0, captureRate);
   i2s_set_adc_mode(ADC_UNIT_1, ADC1_CHANNEL_4); // for example, GPIO32 = ADC1_CH4
   i2s_adc_enable(I2S_NUM_0);
 
-  size_t bytesTotal = 0;
+  size_t samplesTotal = 0;
+  size_t samplesWritten = 0;
 
-  createMonoWAVFile(fs, path, 44100 * duration, 44100, 16);
+  AudioSink sink;
+  SilenceTrimmer trimmer;
 
-  File file = SD_MMC.open(path, FILE_WRITE);
+  if(!sinkOpenWAVFile(sink, fs, path, sample_rate)){
+
+    i2s_adc_disable(I2S_NUM_0);
+    i2s_set_sample_rates(I2S_NUM_0, SAMPLE_RATE);
+
+    return;
 
-  file.seek(44);
+  }
 
-  const int BUF_LEN = 256;
-  uint16_t buffer[BUF_LEN];
-  int16_t buffer16[BUF_LEN];
+  if(trimSilence) trimSilence = trimmerInit(trimmer, sink, sample_rate);
 
   size_t bytesRead;
 
-  while(bytesTotal < 44100 * 2 * duration){
+  while(samplesTotal < captureRate * duration){
 
-    i2s_read(I2S_NUM_0, (void*)buffer, sizeof(buffer), &bytesRead, portMAX_DELAY);
+    i2s_read(I2S_NUM_0, (void*)buffer, BUF_LEN * sizeof(uint16_t), &bytesRead, portMAX_DELAY);
 
-    int numSamples = bytesRead / 2;
+    int numSamples = bytesRead / sizeof(uint16_t);
 
-    for (int i = 0; i < numSamples; i++) {
+    static float prev = 0;
 
-      int16_t sample12 = buffer[i] & 0x0FFF;  
-      int16_t sample16 = ((int32_t)sample12 - 2048) << 4;
+    conditionADCSamples(buffer, buffer16, numSamples, prev);
 
-      int32_t amp = sample16 * 2.00;
+    samplesTotal += numSamples;
 
-      if (amp > 32767) amp = 32767;
-      if (amp < -32768) amp = -32768;
-      buffer16[i] = amp; 
+    // Decimated in place, output is never ahead of input.
 
-    }
+    numSamples = decimatorProcess(decimator, buffer16, buffer16, numSamples);
 
-    static float prev = 0;
-    float alpha = 0.995;
-    for (int i = 0; i < numSamples; i++) {
-      float s = buffer16[i];
-      float filtered = s - prev;
-      prev = alpha * s + (1.0 - alpha) * prev;
+    int16_t *samples = buffer16;
+
+    if(denoise){
 
-      if (filtered > 32767) filtered = 32767;
-      if (filtered < -32768) filtered = -32768;
+      numSamples = denoiseProcess(reducer, buffer16, cleaned, numSamples);
+      samples = cleaned;
 
-      buffer16[i] = (int16_t)filtered;
     }
 
-    // Write directly to SD
-    file.write((uint8_t*)buffer16, numSamples * 2);
+    // Silence is held back by trimmer, everything else goes directly to SD.
 
-    bytesTotal += numSamples * 2;
+    if(trimSilence) trimmerWrite(trimmer, samples, numSamples);
+    else sinkWrite(sink, (uint8_t*)samples, numSamples * sizeof(int16_t));
 
+    samplesWritten += numSamples;
 
   }
 
-  file.close();
+  i2s_adc_disable(I2S_NUM_0);
+  i2s_set_sample_rates(I2S_NUM_0, SAMPLE_RATE);
+
+  // Last frame of denoised audio is still in the reducer.
+
+  if(denoise){
+
+    size_t numSamples = denoiseFinish(reducer, cleaned);
+
+    if(trimSilence) trimmerWrite(trimmer, cleaned, numSamples);
+    else sinkWrite(sink, (uint8_t*)cleaned, numSamples * sizeof(int16_t));
+
+    samplesWritten += numSamples;
+
+  }
+
+  uint32_t length = trimSilence ? trimmerFinish(trimmer) : samplesWritten;
+
+  sinkClose(sink);
+
+  // Long trailing silence may already be on the card, so header length is set from trimmer.
+
+  if(length * sizeof(int16_t) < sink.bytesWritten) editMonoWAVHeader(fs, path, length, sample_rate, 16);
+
+  if(decimator.factor > 1) Serial.printf("Captured at %u Hz, decimated by %u. Filter: %.1f cycles per input sample.\n", captureRate, decimator.factor, decimatorCyclesPerSample(decimator));
 
-  editMonoWAVHeader(SD_MMC, path, 44100 * duration, 44100, 16);
+  if(denoise) denoiseReport(reducer);
 
   Serial.println("DONE.");
 
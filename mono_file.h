@@ -36,8 +36,12 @@
 */
 
 #include "sd_read_write.h"
+#include "audio_sink.h"
+#include "silence_trim.h"
 
+#ifndef M_PI
 #define M_PI (3.141592654)
+#endif
 
 #ifndef M_TWO_PI
 #define M_TWO_PI (2.00 * M_PI)
@@ -69,21 +73,57 @@ struct __attribute__((packed)) MonoWAVHeader {
 
 };
 
+// Fixed point gain used by applyGain(). Q12, so a gain of 1.0 is 4096 and leaves samples unchanged.
+
+#define GAIN_SHIFT 12
+
+// Data chunk alignment for files written on the card, see setMonoWAVAlignment(). tools/wav_align.py does the same on a host.
+// On the host model of FatFs, see bench align, aligned data halves card transfers for 1KB reads but saves BlockReader
+// only its first read, since its blocks are sector aligned either way. Card speeds have not been measured.
+
+#define WAV_DATA_ALIGN SECTOR_SIZE
+
+// Options for record(), set to defaults with recordDefaultOptions().
+//
+//   sample_rate - Rate of the file, 44100, 22050, 16000 or 8000. Lower rates are captured at 44.1 or 48kHz and decimated.
+//   trimSilence - Leading and trailing silence is left out of the file, see silence_trim.h.
+//   denoise - Noise is taken out before trimming, see denoise.h.
+
+struct RecordOptions {
+
+  uint32_t sample_rate;
+  bool trimSilence;
+  bool denoise;
+
+};
+
 // WAV specific functions.
 
-void createMonoWAVFile(fs::FS &fs, const char * path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample);
+bool readMonoWAVHeader(fs::FS &fs, const char * path, MonoWAVHeader &header, uint32_t &dataOffset);
+uint32_t monoWAVSamples(const MonoWAVHeader &header);
+
+void setMonoWAVAlignment(uint32_t align);
+uint32_t createMonoWAVFile(fs::FS &fs, const char * path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample);
 void writeSineWave(fs::FS &fs, const char * path, float freq, float duration);
 void editMonoWAVHeader(fs::FS &fs, const char * path, uint32_t num_samples, uint32_t sample_rate, uint16_t bits_per_sample);
 void normalizeMonoWAVFile(fs::FS &fs, const char * path, double normalization);
+bool alignMonoWAVFile(fs::FS &fs, const char * path, uint32_t align);
 std::vector<int> printMonoWAVData(fs::FS &fs, const char * path);
-void record(fs::FS &fs, const char * path, double duration);
+void conditionADCSamples(const uint16_t *raw, int16_t *out, int numSamples, float &prev);
+bool recordInit();
+void recordDefaultOptions(RecordOptions &options);
+void record(fs::FS &fs, const char * path, double duration, const RecordOptions &options);
 
 // Playback specific functions.
 
 void playMonoWAVFile(fs::FS &fs, const char * path);
+uint32_t renderMonoWAVFile(fs::FS &fs, const char * path, AudioSink &sink, float gain);
+uint32_t checkMonoWAVRender(fs::FS &fs, const char * path, const char * goldenPath, float gain);
+void applyGain(int16_t *samples, size_t sampleCount, float gain);
 
 // Helper functions.
 
 double rootMeanSquare(fs::FS &fs, const char * path);
+void benchmarkAlignment(fs::FS &fs, const char * path);
 
 #endif
\ No newline at end of file
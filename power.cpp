@@ -0,0 +1,108 @@
+#include "power.h"
+#include <atomic>
+
+static const uint32_t frequencies[POWER_LEVELS] = {80, 160, 240};
+
+static int level = POWER_LEVELS - 1;
+
+static std::atomic<uint32_t> busyMicros(0);
+static std::atomic<uint32_t> wakeups(0);
+static std::atomic<bool> playingNow(false);
+static uint32_t busyStart = 0;
+
+static unsigned long windowStart = 0;
+static PowerStats stats;
+
+// powerInit() - Starts first measurement window at full speed. Call once in setup().
+
+void powerInit(){
+
+  level = POWER_LEVELS - 1;
+  setCpuFrequencyMhz(frequencies[level]);
+
+  windowStart = millis();
+
+  stats.cpuMHz = frequencies[level];
+  stats.audioLoad = 0;
+  stats.wakeupsPerSecond = 0;
+
+}
+
+// Marks start and end of audio task work. Only the audio task may call these.
+
+void powerBusyBegin(){
+
+  busyStart = micros();
+
+}
+
+void powerBusyEnd(){
+
+  busyMicros.fetch_add(micros() - busyStart);
+
+}
+
+void powerCountWakeup(){
+
+  wakeups.fetch_add(1);
+
+}
+
+/*
+
+  powerUpdate() - Ends measurement window if it is due, and changes CPU frequency if needed.
+
+  unsigned long now - Current millis().
+  bool playing - true if audio is playing. CPU runs at lowest frequency when false.
+
+*/
+
+void powerUpdate(unsigned long now, bool playing){
+
+  playingNow = playing;
+
+  unsigned long elapsed = now - windowStart;
+
+  if(elapsed < POWER_WINDOW_MS) return;
+
+  uint32_t busy = busyMicros.exchange(0);
+  uint32_t count = wakeups.exchange(0);
+
+  windowStart = now;
+
+  stats.audioLoad = busy / (elapsed * 10);
+  stats.wakeupsPerSecond = count * 1000 / elapsed;
+
+  int target = level;
+
+  if(!playing) target = 0;
+  else if(stats.audioLoad > POWER_LOAD_UP && level < POWER_LEVELS - 1) target = level + 1;
+  else if(stats.audioLoad < POWER_LOAD_DOWN && level > 0) target = level - 1;
+
+  if(target != level){
+
+    level = target;
+
+    setCpuFrequencyMhz(frequencies[level]);
+
+    Serial.printf("CPU %uMHz, audio load %u%%, %u wakeups/s.\n", frequencies[level], stats.audioLoad, stats.wakeupsPerSecond);
+
+  }
+
+  stats.cpuMHz = frequencies[level];
+
+}
+
+PowerStats powerStats(){
+
+  return stats;
+
+}
+
+// Returns playing as passed to the last powerUpdate(). Lets work that would compete with the audio task back off.
+
+bool powerAudioPlaying(){
+
+  return playingNow;
+
+}
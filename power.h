@@ -0,0 +1,40 @@
+#ifndef _POWER_H
+#define _POWER_H
+
+/*
+
+  CPU load measurement and frequency scaling.
+
+  The audio task marks the time it spends working with powerBusyBegin() / powerBusyEnd(). Time blocked in
+  i2s_write() or waiting for a notification is idle. Tasks call powerCountWakeup() every time they wake.
+
+  powerUpdate() is called from loop(). Once every POWER_WINDOW_MS it computes audio core load and wakeups per
+  second, then picks a CPU frequency: lowest while idle, one step up when load is above POWER_LOAD_UP, one step
+  down when load is below POWER_LOAD_DOWN. Frequencies below 80MHz are not used since they change APB clock.
+
+*/
+
+#include <Arduino.h>
+
+#define POWER_WINDOW_MS 1000
+#define POWER_LOAD_UP 60
+#define POWER_LOAD_DOWN 25
+#define POWER_LEVELS 3
+
+struct PowerStats {
+
+  uint32_t cpuMHz;
+  uint32_t audioLoad;
+  uint32_t wakeupsPerSecond;
+
+};
+
+void powerInit();
+void powerBusyBegin();
+void powerBusyEnd();
+void powerCountWakeup();
+void powerUpdate(unsigned long now, bool playing);
+PowerStats powerStats();
+bool powerAudioPlaying();
+
+#endif
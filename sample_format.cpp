@@ -0,0 +1,187 @@
+#include "sample_format.h"
+
+// Conversions are pipelines without stages.
+
+static const PipelineParams noParams = {};
+
+void convertU8(const uint8_t *in, int16_t *out, size_t sampleCount){
+
+  runPipeline<PCM8, 1>(in, out, sampleCount, noParams);
+
+}
+
+void convertS24(const uint8_t *in, int16_t *out, size_t sampleCount){
+
+  runPipeline<PCM24, 1>(in, out, sampleCount, noParams);
+
+}
+
+void convertS32(const uint8_t *in, int16_t *out, size_t sampleCount){
+
+  runPipeline<int32_t, 1>(in, out, sampleCount, noParams);
+
+}
+
+void convertF32(const uint8_t *in, int16_t *out, size_t sampleCount){
+
+  runPipeline<float, 1>(in, out, sampleCount, noParams);
+
+}
+
+// Converts frames of any channel count to mono.
+
+template<typename Source, int Channels>
+static void convertFrames(const uint8_t *in, int16_t *out, size_t sampleCount){
+
+  runPipeline<Source, Channels>(in, out, sampleCount, noParams);
+
+}
+
+// Sets kernels for a source type and channel count. Stereo files get a kernel even at 16 bit, to mix them down.
+
+template<typename Source, int Channels>
+static bool setKernels(SampleFormat &format){
+
+  format.convert = convertFrames<Source, Channels>;
+  format.play = playbackPipeline<Source, Channels>;
+
+  return true;
+
+}
+
+template<int Channels>
+static bool selectKernels(const MonoWAVHeader &header, SampleFormat &format){
+
+  if(header.audio_format == WAV_FORMAT_PCM){
+
+    switch(header.bits_per_sample){
+
+      case 8: return setKernels<PCM8, Channels>(format);
+      case 16: return setKernels<int16_t, Channels>(format);
+      case 24: return setKernels<PCM24, Channels>(format);
+      case 32: return setKernels<int32_t, Channels>(format);
+
+    }
+
+  }
+
+  if(header.audio_format == WAV_FORMAT_FLOAT && header.bits_per_sample == 32) return setKernels<float, Channels>(format);
+
+  return false;
+
+}
+
+/*
+
+  selectSampleFormat() - Picks conversion kernel for a WAV header.
+
+  const MonoWAVHeader &header - Header from readMonoWAVHeader(). WAVE_FORMAT_EXTENSIBLE files must already have
+  their sub format in audio_format.
+  SampleFormat &format - Set to bytes per frame and kernels. convert is NULL for 16 bit mono PCM, play is always set.
+
+  return - false if format is not supported, i.e. more than two channels.
+
+*/
+
+bool selectSampleFormat(const MonoWAVHeader &header, SampleFormat &format){
+
+  format.bytesPerSample = header.bits_per_sample / 8 * header.num_channels;
+  format.convert = NULL;
+  format.play = NULL;
+
+  bool ok = false;
+
+  if(header.num_channels == 1) ok = selectKernels<1>(header, format);
+  if(header.num_channels == 2) ok = selectKernels<2>(header, format);
+
+  // 16 bit mono data is used straight from the read buffer.
+
+  if(ok && header.num_channels == 1 && header.audio_format == WAV_FORMAT_PCM && header.bits_per_sample == 16) format.convert = NULL;
+
+  return ok;
+
+}
+
+/*
+
+  benchmarkSampleFormats() - Checks each kernel against known values, then prints conversion speed in
+  samples per second and cycles per sample to serial monitor.
+
+  return - true if every kernel matched its expected output.
+
+*/
+
+bool benchmarkSampleFormats(){
+
+  const uint8_t u8[] = {0, 127, 128, 255};
+  const uint8_t s24[] = {0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x7F};
+  const uint8_t s32[] = {0x00, 0x00, 0x00, 0x80, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x7F};
+  const float f32[] = {-1.5f, -1.0f, -0.00002f, 0.0f, 0.5f, 1.0f, NAN, INFINITY, -INFINITY};
+
+  const int16_t u8Expected[] = {-32768, -256, 0, 32512};
+  const int16_t s24Expected[] = {-32768, -1, 0, 32767};
+  const int16_t s32Expected[] = {-32768, -1, 0, 32767};
+  const int16_t f32Expected[] = {-32768, -32768, 0, 0, 16384, 32767, 0, 32767, -32768};
+
+  int16_t out[9];
+  bool ok = true;
+
+  convertU8(u8, out, 4);
+  ok &= memcmp(out, u8Expected, sizeof(u8Expected)) == 0;
+
+  convertS24(s24, out, 4);
+  ok &= memcmp(out, s24Expected, sizeof(s24Expected)) == 0;
+
+  convertS32(s32, out, 4);
+  ok &= memcmp(out, s32Expected, sizeof(s32Expected)) == 0;
+
+  convertF32((const uint8_t *)f32, out, 9);
+  ok &= memcmp(out, f32Expected, sizeof(f32Expected)) == 0;
+
+  Serial.printf("Sample format kernels: %s\n", ok ? "exact" : "MISMATCH");
+
+  const size_t samples = 1024;
+  const int rounds = 64;
+  const char *names[] = {"8 bit", "24 bit", "32 bit", "float"};
+  const sampleKernel kernels[] = {convertU8, convertS24, convertS32, convertF32};
+
+  uint8_t *in = (uint8_t *)malloc(samples * 4);
+  int16_t *converted = (int16_t *)malloc(samples * sizeof(int16_t));
+
+  if(!in || !converted){
+
+    free(in);
+    free(converted);
+
+    return ok;
+
+  }
+
+  for(size_t i = 0; i < samples; i++){
+
+    float x = sinf(i * 0.01f) * 0.9f;
+
+    memcpy(in + i * 4, &x, 4);
+
+  }
+
+  for(int k = 0; k < 4; k++){
+
+    uint32_t start = ESP.getCycleCount();
+    unsigned long startMicros = micros();
+
+    for(int r = 0; r < rounds; r++) kernels[k](in, converted, samples);
+
+    uint32_t cycles = ESP.getCycleCount() - start;
+    unsigned long elapsed = micros() - startMicros;
+
+    Serial.printf("  %s: %.2f cycles/sample, %.1f Msamples/s\n", names[k], (double)cycles / (samples * rounds), elapsed ? (double)samples * rounds / elapsed : 0.0);
+
+  }
+
+  free(in);
+  free(converted);
+
+  return ok;
+
+}
@@ -0,0 +1,50 @@
+#ifndef _SAMPLE_FORMAT_H
+#define _SAMPLE_FORMAT_H
+
+/*
+
+  Sample format conversion.
+
+  Audio is processed as signed 16 bit mono internally. selectSampleFormat() looks at a WAV header once per track
+  and returns a block kernel that converts that file's samples to 16 bit, so the per-sample loop never checks
+  the format. 16 bit mono files have no kernel, and their data is used straight from the read buffer. Stereo files
+  are mixed down to mono by their kernel, one output sample per frame.
+
+    8 bit unsigned - (x - 128) << 8.
+    24 bit packed - Top 16 bits, low byte dropped.
+    32 bit integer - Top 16 bits.
+    32 bit float - x * 32768, truncated toward zero and clipped to 16 bit range. NaN is 0.
+
+  All conversions are exact and match what a host implementation of the same rules produces. Kernels are built
+  from the decoders in sample_pipeline.h. play is the same decoder fused with the playback gain stages, see
+  playbackPipeline().
+
+*/
+
+#include "mono_file.h"
+#include "sample_pipeline.h"
+
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+typedef void (*sampleKernel)(const uint8_t *in, int16_t *out, size_t sampleCount);
+
+// bytesPerSample is bytes per frame in the file, i.e. 4 for 16 bit stereo. Every frame gives one 16 bit sample.
+
+struct SampleFormat {
+
+  uint16_t bytesPerSample;
+  sampleKernel convert;
+  pipelineKernel play;
+
+};
+
+bool selectSampleFormat(const MonoWAVHeader &header, SampleFormat &format);
+void convertU8(const uint8_t *in, int16_t *out, size_t sampleCount);
+void convertS24(const uint8_t *in, int16_t *out, size_t sampleCount);
+void convertS32(const uint8_t *in, int16_t *out, size_t sampleCount);
+void convertF32(const uint8_t *in, int16_t *out, size_t sampleCount);
+bool benchmarkSampleFormats();
+
+#endif
@@ -0,0 +1,165 @@
+#include "sample_pipeline.h"
+#include "sample_format.h"
+#include "audio_arena.h"
+
+// Sets every gain to 1.0.
+
+void pipelineInitParams(PipelineParams &params){
+
+  for(int i = 0; i < PIPELINE_GAINS; i++) params.gain[i] = 1 << GAIN_SHIFT;
+
+}
+
+// Playback chain as audioTask() ran it before pipelines: convert kernel, then applyGain() per gain.
+
+static void chainedPlayback(const SampleFormat &format, const uint8_t *in, int16_t *out, size_t frames, float segmentGain, float volume){
+
+  if(format.convert) format.convert(in, out, frames);
+  else memcpy(out, in, frames * sizeof(int16_t));
+
+  applyGain(out, frames, segmentGain);
+  applyGain(out, frames, volume);
+
+}
+
+/*
+
+  benchmarkPipeline() - Runs the playback chain for every supported format two ways, the chained kernels audioTask()
+  used before, and the fused pipeline from selectSampleFormat(). Checks both give the same samples, then prints
+  cycles per sample for each and the speedup. The stereo 16 bit kernel is checked against an average of its
+  channels, and timed to show the cost of mixing down.
+
+  return - true if every pipeline matched the chained output.
+
+*/
+
+bool benchmarkPipeline(){
+
+  const size_t frames = CHUNK_SIZE / 2;
+  const int rounds = 64;
+  const float segmentGain = 0.8f;
+  const float volume = 0.4f * 2;
+
+  uint8_t *block = arenaTakeBlock();
+
+  if(!block){
+
+    Serial.println("No free benchmark buffer in audio arena.");
+
+    return false;
+
+  }
+
+  uint8_t *in = block;
+  int16_t *chained = (int16_t *)(block + frames * 8);
+  int16_t *fused = chained + frames;
+
+  struct { const char *name; uint16_t format; uint16_t bits; } formats[] = {
+
+    {"8 bit", WAV_FORMAT_PCM, 8},
+    {"16 bit", WAV_FORMAT_PCM, 16},
+    {"24 bit", WAV_FORMAT_PCM, 24},
+    {"32 bit", WAV_FORMAT_PCM, 32},
+    {"float", WAV_FORMAT_FLOAT, 32}
+
+  };
+
+  PipelineParams params;
+
+  params.gain[PIPELINE_SEGMENT_GAIN] = pipelineGain(segmentGain);
+  params.gain[PIPELINE_VOLUME] = pipelineGain(volume);
+
+  bool ok = true;
+
+  Serial.printf("Playback pipeline, %u samples per block:\n", frames);
+
+  for(int f = 0; f < 5; f++){
+
+    MonoWAVHeader header;
+    SampleFormat format;
+
+    header.audio_format = formats[f].format;
+    header.num_channels = 1;
+    header.bits_per_sample = formats[f].bits;
+
+    selectSampleFormat(header, format);
+
+    // Full scale sine, so gain clips some samples.
+
+    for(size_t i = 0; i < frames; i++){
+
+      float x = sinf(i * 0.05f) * 1.2f;
+      float c = x > 1.0f ? 1.0f : x < -1.0f ? -1.0f : x;
+      int32_t v = c * 2147483647.0;
+      uint8_t *p = in + i * format.bytesPerSample;
+
+      if(formats[f].format == WAV_FORMAT_FLOAT) memcpy(p, &c, 4);
+      else if(formats[f].bits == 8) p[0] = (v >> 24) + 128;
+      else for(int b = 0; b < format.bytesPerSample; b++) p[b] = v >> (32 - 8 * format.bytesPerSample + 8 * b);
+
+    }
+
+    uint32_t start = ESP.getCycleCount();
+
+    for(int r = 0; r < rounds; r++) chainedPlayback(format, in, chained, frames, segmentGain, volume);
+
+    uint32_t chainedCycles = ESP.getCycleCount() - start;
+
+    start = ESP.getCycleCount();
+
+    for(int r = 0; r < rounds; r++) format.play(in, fused, frames, params);
+
+    uint32_t fusedCycles = ESP.getCycleCount() - start;
+
+    bool match = memcmp(chained, fused, frames * sizeof(int16_t)) == 0;
+
+    ok &= match;
+
+    Serial.printf("  %s: chained %.2f, pipeline %.2f cycles/sample, %.1fx, %s\n", formats[f].name,
+                  (double)chainedCycles / (frames * rounds), (double)fusedCycles / (frames * rounds),
+                  fusedCycles ? (double)chainedCycles / fusedCycles : 0.0, match ? "exact" : "MISMATCH");
+
+  }
+
+  // Stereo goes through the kernel selectSampleFormat() picks for it, checked against an average of the channels
+  // followed by the chained gains.
+
+  MonoWAVHeader header;
+  SampleFormat format;
+
+  header.audio_format = WAV_FORMAT_PCM;
+  header.num_channels = 2;
+  header.bits_per_sample = 16;
+
+  ok &= selectSampleFormat(header, format);
+
+  int16_t *frame = (int16_t *)in;
+
+  for(size_t i = 0; i < frames; i++){
+
+    frame[2 * i] = sinf(i * 0.05f) * 32767;
+    frame[2 * i + 1] = sinf(i * 0.031f) * 32767;
+
+    chained[i] = (frame[2 * i] + frame[2 * i + 1]) / 2;
+
+  }
+
+  applyGain(chained, frames, segmentGain);
+  applyGain(chained, frames, volume);
+
+  uint32_t start = ESP.getCycleCount();
+
+  for(int r = 0; r < rounds; r++) format.play(in, fused, frames, params);
+
+  uint32_t cycles = ESP.getCycleCount() - start;
+  bool match = memcmp(chained, fused, frames * sizeof(int16_t)) == 0;
+
+  ok &= match;
+
+  Serial.printf("  16 bit stereo to mono: %.2f cycles/frame, %s\n", (double)cycles / (frames * rounds), match ? "exact" : "MISMATCH");
+
+  arenaGiveBlock(block);
+
+  return ok;
+
+}
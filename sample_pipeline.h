@@ -0,0 +1,226 @@
+#ifndef _SAMPLE_PIPELINE_H
+#define _SAMPLE_PIPELINE_H
+
+/*
+
+  Compile-time sample pipeline.
+
+  A pipeline is a source sample type, a channel count and a list of stages, all given as template parameters:
+
+    runPipeline<PCM24, 1, GainStage<0>, GainStage<1>>(in, out, frames, params);
+
+  Each frame is decoded to one 16 bit sample, passed through every stage in order and stored, all in one loop.
+  Everything is known at compile time, so the loop is fully inlined and has no format or stage checks.
+  selectSampleFormat() picks the instantiation for a track once from its header, and hands it out as a plain
+  pipelineKernel pointer.
+
+  Source types:
+
+    PCM8 - 8 bit unsigned, (x - 128) << 8.
+    int16_t - 16 bit signed.
+    PCM24 - 24 bit packed, top 16 bits.
+    int32_t - 32 bit signed, top 16 bits.
+    float - 32 bit float, x * 32768 truncated and clipped. NaN is 0.
+    ADC12 - Built in ADC word from i2s_read() on I2S_NUM_0, low 12 bits unsigned, (x - 2048) << 4.
+
+  Frames with more than one channel are averaged to mono, truncated toward zero. selectSampleFormat() takes mono
+  and stereo files, and picks the instantiation with the file's channel count.
+
+  Stages are structs with a static process(int32_t sample, const PipelineParams &params). Values that change
+  while playing, i.e. gain, are read from params, so changing them needs no new instantiation.
+
+  Decoding and gain give exactly the same results as the convert kernels and applyGain(), so pipelines can
+  replace them without changing output.
+
+*/
+
+#include "mono_file.h"
+
+#define PIPELINE_GAINS 2
+#define PIPELINE_SEGMENT_GAIN 0
+#define PIPELINE_VOLUME 1
+
+struct PCM8 {};
+struct PCM24 {};
+struct ADC12 {};
+
+struct PipelineParams {
+
+  int32_t gain[PIPELINE_GAINS];
+
+};
+
+typedef size_t (*pipelineKernel)(const uint8_t *in, int16_t *out, size_t frames, const PipelineParams &params);
+
+// Decode<Source>::sample() - Reads one sample as a 16 bit value. BYTES is its size in the file.
+
+template<typename Source> struct Decode;
+
+template<> struct Decode<PCM8> {
+
+  static const size_t BYTES = 1;
+
+  static inline int32_t sample(const uint8_t *p){ return ((int32_t)p[0] - 128) << 8; }
+
+};
+
+template<> struct Decode<int16_t> {
+
+  static const size_t BYTES = 2;
+
+  static inline int32_t sample(const uint8_t *p){ return *(const int16_t *)p; }
+
+};
+
+template<> struct Decode<PCM24> {
+
+  static const size_t BYTES = 3;
+
+  static inline int32_t sample(const uint8_t *p){ return (int16_t)(p[1] | (p[2] << 8)); }
+
+};
+
+template<> struct Decode<int32_t> {
+
+  static const size_t BYTES = 4;
+
+  static inline int32_t sample(const uint8_t *p){ return (int16_t)(p[2] | (p[3] << 8)); }
+
+};
+
+template<> struct Decode<float> {
+
+  static const size_t BYTES = 4;
+
+  static inline int32_t sample(const uint8_t *p){
+
+    float x;
+
+    memcpy(&x, p, 4);
+
+    // NaN fails both clip tests, and converting it to an integer is undefined.
+
+    float v = x == x ? x * 32768.0f : 0.0f;
+
+    v = v > 32767.0f ? 32767.0f : v;
+    v = v < -32768.0f ? -32768.0f : v;
+
+    return (int16_t)v;
+
+  }
+
+};
+
+template<> struct Decode<ADC12> {
+
+  static const size_t BYTES = 2;
+
+  static inline int32_t sample(const uint8_t *p){ return ((int32_t)(*(const uint16_t *)p & 0x0FFF) - 2048) << 4; }
+
+};
+
+// Sum of all channels of a frame, unrolled at compile time.
+
+template<typename Source, int Channels> struct FrameSum {
+
+  static inline int32_t sum(const uint8_t *p){
+
+    return Decode<Source>::sample(p) + FrameSum<Source, Channels - 1>::sum(p + Decode<Source>::BYTES);
+
+  }
+
+};
+
+template<typename Source> struct FrameSum<Source, 1> {
+
+  static inline int32_t sum(const uint8_t *p){ return Decode<Source>::sample(p); }
+
+};
+
+// GainStage<Index> - Q12 gain from params.gain[Index], clipped to 16 bit range. Same as applyGain().
+
+template<int Index> struct GainStage {
+
+  static inline int32_t process(int32_t s, const PipelineParams &params){
+
+    int32_t v = (s * params.gain[Index]) >> GAIN_SHIFT;
+
+    v = v > 32767 ? 32767 : v;
+
+    return v < -32768 ? -32768 : v;
+
+  }
+
+};
+
+// Runs stages in order.
+
+template<typename... Stages> struct StageList;
+
+template<> struct StageList<> {
+
+  static inline int32_t process(int32_t s, const PipelineParams &params){ return s; }
+
+};
+
+template<typename First, typename... Rest> struct StageList<First, Rest...> {
+
+  static inline int32_t process(int32_t s, const PipelineParams &params){
+
+    return StageList<Rest...>::process(First::process(s, params), params);
+
+  }
+
+};
+
+/*
+
+  runPipeline() - Decodes, processes and stores frames. in and out may be the same buffer for 16 bit mono sources.
+
+  const uint8_t *in - Source frames.
+  int16_t *out - One sample per frame.
+  size_t frames - Number of frames.
+  const PipelineParams &params - Values read by stages.
+
+  return - Number of samples stored.
+
+*/
+
+template<typename Source, int Channels, typename... Stages>
+size_t runPipeline(const uint8_t *in, int16_t *out, size_t frames, const PipelineParams &params){
+
+  const size_t frameBytes = Decode<Source>::BYTES * Channels;
+
+  for(size_t i = 0; i < frames; i++, in += frameBytes){
+
+    int32_t s = FrameSum<Source, Channels>::sum(in) / Channels;
+
+    out[i] = StageList<Stages...>::process(s, params);
+
+  }
+
+  return frames;
+
+}
+
+// Playback chain: decode, mix to mono, segment gain, then volume.
+
+template<typename Source, int Channels>
+size_t playbackPipeline(const uint8_t *in, int16_t *out, size_t frames, const PipelineParams &params){
+
+  return runPipeline<Source, Channels, GainStage<PIPELINE_SEGMENT_GAIN>, GainStage<PIPELINE_VOLUME> >(in, out, frames, params);
+
+}
+
+// Converts a gain to the Q12 value used by GainStage, rounded the same way as applyGain().
+
+inline int32_t pipelineGain(float gain){
+
+  return (int32_t)(gain * (1 << GAIN_SHIFT) + 0.5f);
+
+}
+
+void pipelineInitParams(PipelineParams &params);
+bool benchmarkPipeline();
+
+#endif
@@ -1,4 +1,7 @@
 #include "sd_read_write.h"
+#include "esp_heap_caps.h"
+#include "audio_arena.h"
+#include <algorithm>
 
 // Initialization function for SD card. This needs to be called before any other SD functions can be used. Should be caled in setup().
 
@@ -127,6 +130,475 @@ std::vector<String> getDirFilePaths(fs::FS &fs, const char * dirname){
 
 }
 
+/*
+
+  loadBlock() - Reads one block from the card into reader buffer, starting at a sector aligned file offset.
+
+  returns size_t - Bytes read. 0 at end of file.
+
+*/
+
+static size_t loadBlock(BlockReader &reader, uint32_t alignedOffset){
+
+  unsigned long start = micros();
+
+  if(reader.file.position() != alignedOffset) reader.file.seek(alignedOffset);
+
+  size_t n = reader.file.read(reader.buffer + READ_HEADROOM, reader.blockSize);
+
+  reader.readMicros += micros() - start;
+  reader.reads++;
+  reader.bytesRead += n;
+
+  reader.blockStart = alignedOffset;
+  reader.blockLen = n;
+
+  return n;
+
+}
+
+/*
+
+  blockReaderOpen() - Opens file for block reading, positioned at offset.
+
+  BlockReader &reader - Reader to open. Must be closed with blockReaderClose().
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * path - Name of file. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  uint32_t offset - First byte handed out, i.e. 44 to skip a WAV header.
+  uint8_t *buffer - Buffer to read into. If NULL, a block is taken from the audio arena pool and given back on close,
+  and bufferSize is limited to ARENA_BLOCK_BYTES.
+  size_t bufferSize - Size of buffer, see READ_BUFFER_BYTES(). Block size is rounded down to a multiple of SECTOR_SIZE.
+
+  return - true if file was opened.
+
+*/
+
+bool blockReaderOpen(BlockReader &reader, fs::FS &fs, const char * path, uint32_t offset, uint8_t *buffer, size_t bufferSize){
+
+  reader.buffer = NULL;
+  reader.ownsBuffer = false;
+  reader.head = NULL;
+  reader.avail = 0;
+
+  if(bufferSize < READ_BUFFER_BYTES(SECTOR_SIZE)) return false;
+
+  reader.file = fs.open(path, FILE_READ);
+
+  if(!reader.file){
+
+    Serial.printf("%s could not be opened.\n", path);
+
+    return false;
+
+  }
+
+  if(!buffer){
+
+    buffer = arenaTakeBlock();
+
+    if(bufferSize > ARENA_BLOCK_BYTES) bufferSize = ARENA_BLOCK_BYTES;
+
+    if(!buffer){
+
+      Serial.println("No free read buffer in audio arena.");
+
+      reader.file.close();
+
+      return false;
+
+    }
+
+    reader.ownsBuffer = true;
+
+  }
+
+  reader.buffer = buffer;
+  reader.blockSize = (bufferSize - READ_HEADROOM) & ~(size_t)(SECTOR_SIZE - 1);
+  reader.blockStart = 0;
+  reader.blockLen = 0;
+  reader.end = 0xFFFFFFFF;
+  reader.reads = 0;
+  reader.bytesRead = 0;
+  reader.readMicros = 0;
+
+  blockReaderSeek(reader, offset);
+
+  return true;
+
+}
+
+/*
+
+  blockReaderNext() - Returns a view of the next bytes in the file. Reads the next block when the current one is used up.
+
+  BlockReader &reader - Open reader.
+  uint8_t **data - Set to start of view. Valid until the next call on this reader.
+  size_t maxBytes - Maximum size of view.
+  size_t frameBytes - View size is always a multiple of this, i.e. 2 for 16 bit mono. Must not exceed READ_HEADROOM.
+
+  return - Size of view in bytes. 0 at end of file, or end set by blockReaderSetEnd().
+
+*/
+
+size_t blockReaderNext(BlockReader &reader, uint8_t **data, size_t maxBytes, size_t frameBytes){
+
+  if(!reader.buffer || reader.position >= reader.end) return 0;
+
+  if(reader.avail < frameBytes){
+
+    size_t carry = reader.avail;
+    uint8_t *block = reader.buffer + READ_HEADROOM;
+
+    memmove(block - carry, reader.head, carry);
+
+    loadBlock(reader, reader.blockStart + reader.blockLen);
+
+    reader.head = block - carry;
+    reader.avail = carry + reader.blockLen;
+
+    if(reader.avail < frameBytes) return 0;
+
+  }
+
+  size_t n = reader.avail < maxBytes ? reader.avail : maxBytes;
+
+  if(reader.end - reader.position < n) n = reader.end - reader.position;
+
+  n -= n % frameBytes;
+
+  *data = reader.head;
+
+  reader.head += n;
+  reader.avail -= n;
+  reader.position += n;
+
+  return n;
+
+}
+
+/*
+
+  blockReaderSeek() - Moves reader to offset. Seeks inside the current block do not touch the card.
+
+  return - false if offset is past end of file.
+
+*/
+
+bool blockReaderSeek(BlockReader &reader, uint32_t offset){
+
+  uint8_t *block = reader.buffer + READ_HEADROOM;
+
+  reader.position = offset;
+
+  if(reader.blockLen == 0 || offset < reader.blockStart || offset > reader.blockStart + reader.blockLen){
+
+    loadBlock(reader, offset & ~(uint32_t)(SECTOR_SIZE - 1));
+
+  }
+
+  uint32_t skip = offset - reader.blockStart;
+
+  if(skip > reader.blockLen){
+
+    reader.head = block + reader.blockLen;
+    reader.avail = 0;
+
+    return false;
+
+  }
+
+  reader.head = block + skip;
+  reader.avail = reader.blockLen - skip;
+
+  return true;
+
+}
+
+// Returns true if reader has more data before end of file or set end.
+
+bool blockReaderAvailable(BlockReader &reader){
+
+  if(!reader.buffer || reader.position >= reader.end) return false;
+
+  return reader.avail > 0 || reader.blockStart + reader.blockLen < reader.file.size();
+
+}
+
+// Limits reader to bytes before end, i.e. end of a WAV data chunk.
+
+void blockReaderSetEnd(BlockReader &reader, uint32_t end){
+
+  reader.end = end;
+
+}
+
+void blockReaderClose(BlockReader &reader){
+
+  if(reader.file) reader.file.close();
+
+  if(reader.ownsBuffer) arenaGiveBlock(reader.buffer);
+
+  reader.buffer = NULL;
+  reader.ownsBuffer = false;
+  reader.head = NULL;
+  reader.avail = 0;
+
+}
+
+/*
+
+  benchmarkRead() - Compares sequential read speed of 1KB reads starting at a WAV data offset, which is how files were read before
+  BlockReader, against BlockReader with an arena pool block. Results are printed to serial monitor in MB/s.
+
+  uint32_t offset - Where reading starts, 44 for a plain header. See benchmarkAlignment() for aligned files.
+
+*/
+
+void benchmarkRead(fs::FS &fs, const char * path, uint32_t offset){
+
+  uint8_t small[CHUNK_SIZE];
+  uint32_t total = 0;
+
+  // Both timings include opening the file, since blockReaderOpen() opens it too.
+
+  unsigned long start = micros();
+
+  File file = fs.open(path, FILE_READ);
+
+  if(!file){
+
+    Serial.printf("%s could not be opened.\n", path);
+
+    return;
+
+  }
+
+  file.seek(offset);
+
+  size_t n;
+
+  while((n = file.read(small, sizeof(small))) > 0) total += n;
+
+  unsigned long smallMicros = micros() - start;
+
+  file.close();
+
+  BlockReader reader;
+  uint8_t *data;
+  uint32_t blockTotal = 0;
+
+  start = micros();
+
+  if(!blockReaderOpen(reader, fs, path, offset)) return;
+
+  while((n = blockReaderNext(reader, &data, READ_BLOCK_SIZE)) > 0) blockTotal += n;
+
+  unsigned long blockMicros = micros() - start;
+
+  Serial.printf("%s: %u bytes from offset %u.\n", path, total, offset);
+  Serial.printf("  %d byte reads: %.2f MB/s\n", CHUNK_SIZE, total / (double)smallMicros);
+  Serial.printf("  %d byte aligned blocks: %.2f MB/s (%u reads)\n", (int)reader.blockSize, blockTotal / (double)blockMicros, reader.reads);
+
+  blockReaderClose(reader);
+
+}
+
+/*
+
+  libraryInit() - Allocates path pool and offset table for a LibraryIndex. Should be called once in setup(),
+  before scanLibrary(). PSRAM is used if available, otherwise internal RAM, where a pool of a quarter of poolSize is
+  taken if the full one does not fit.
+
+  LibraryIndex &index - Index to initialize.
+  uint32_t poolSize - Bytes reserved for path strings.
+  uint32_t maxFiles - Maximum number of files the index can hold.
+
+  return - true if both allocations succeeded.
+
+*/
+
+bool libraryInit(LibraryIndex &index, uint32_t poolSize, uint32_t maxFiles){
+
+  index.pool = (char *)heap_caps_malloc(poolSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if(!index.pool) index.pool = (char *)heap_caps_malloc(poolSize, MALLOC_CAP_8BIT);
+
+  if(!index.pool){
+
+    poolSize /= 4;
+    index.pool = (char *)heap_caps_malloc(poolSize, MALLOC_CAP_8BIT);
+
+    if(index.pool) Serial.printf("Library pool reduced to %u bytes, no PSRAM.\n", poolSize);
+
+  }
+
+  index.offsets = (uint32_t *)heap_caps_malloc(maxFiles * sizeof(uint32_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if(!index.offsets) index.offsets = (uint32_t *)heap_caps_malloc(maxFiles * sizeof(uint32_t), MALLOC_CAP_8BIT);
+
+  index.poolUsed = 0;
+  index.count = 0;
+  index.dropped = 0;
+
+  if(!index.pool || !index.offsets){
+
+    Serial.println("Library index could not be allocated.");
+
+    heap_caps_free(index.pool);
+    heap_caps_free(index.offsets);
+
+    index.pool = NULL;
+    index.offsets = NULL;
+    index.poolSize = 0;
+    index.maxFiles = 0;
+
+    return false;
+
+  }
+
+  index.poolSize = poolSize;
+  index.maxFiles = maxFiles;
+
+  return true;
+
+}
+
+// Returns true if name ends in ".wav", ignoring case.
+
+static bool isWAVFile(const char *name){
+
+  size_t len = strlen(name);
+
+  return len > 4 && strcasecmp(name + len - 4, ".wav") == 0;
+
+}
+
+// Appends every WAV file under dirname to the pool, descending at most levels subdirectories. Free heap is sampled
+// with every entry open, when the scan holds the most directory and file handles, and the lowest value is kept.
+
+static void scanLibraryDir(fs::FS &fs, const char *dirname, LibraryIndex &index, uint8_t levels, uint32_t &lowestHeap){
+
+  File root = fs.open(dirname);
+
+  if (!root || !root.isDirectory()) {
+
+    Serial.printf("Failed to open directory %s\n", dirname);
+    return;
+
+  }
+
+  File file = root.openNextFile();
+
+  while (file) {
+
+    const char *path = file.path();
+    uint32_t heap = ESP.getFreeHeap();
+
+    if (heap < lowestHeap) lowestHeap = heap;
+
+    if (file.isDirectory()) {
+
+      if (levels && file.name()[0] != '.') {
+
+        scanLibraryDir(fs, path, index, levels - 1, lowestHeap);
+
+      }
+
+    }
+
+    else if (isWAVFile(path)) {
+
+      uint32_t len = strlen(path) + 1;
+
+      if (index.count < index.maxFiles && index.poolUsed + len <= index.poolSize) {
+
+        memcpy(index.pool + index.poolUsed, path, len);
+        index.offsets[index.count++] = index.poolUsed;
+        index.poolUsed += len;
+
+      }
+
+      else {
+
+        index.dropped++;
+
+      }
+
+    }
+
+    file = root.openNextFile();
+
+  }
+
+}
+
+/*
+
+  scanLibrary() - Replaces getDirFilePaths() for playback. Recursively finds all WAV files under dirname and stores their
+  full paths in index, sorted by path so that navigation order is the same on every boot.
+
+  Prints scan time, pool usage and heap figures to serial monitor. Peak heap use is free heap before the scan minus the
+  lowest free heap seen during it, so it only counts what the scan itself allocates.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+  const char * dirname - Directory to scan, i.e. "/".
+  LibraryIndex &index - Index initialized with libraryInit(). Previous contents are discarded.
+  uint8_t levels - Maximum subdirectory depth.
+
+  return - Number of files in index. Files that did not fit in index are counted in index.dropped.
+
+*/
+
+uint32_t scanLibrary(fs::FS &fs, const char * dirname, LibraryIndex &index, uint8_t levels){
+
+  index.poolUsed = 0;
+  index.count = 0;
+  index.dropped = 0;
+
+  if(!index.pool) return 0;
+
+  uint32_t heapBefore = ESP.getFreeHeap();
+  uint32_t lowestHeap = heapBefore;
+  unsigned long start = micros();
+
+  scanLibraryDir(fs, dirname, index, levels, lowestHeap);
+
+  const char *pool = index.pool;
+
+  std::sort(index.offsets, index.offsets + index.count, [pool](uint32_t a, uint32_t b){
+
+    return strcmp(pool + a, pool + b) < 0;
+
+  });
+
+  unsigned long elapsed = micros() - start;
+
+  Serial.printf("Library: %u files (%u dropped) in %lu ms. Pool: %u / %u bytes.\n", index.count, index.dropped, elapsed / 1000, index.poolUsed, index.poolSize);
+  Serial.printf("Heap: %u free before scan, %u after, %u peak use during scan.\n", heapBefore, ESP.getFreeHeap(), heapBefore - lowestHeap);
+
+  if(index.dropped) Serial.printf("Warning: %u files did not fit in the library index and can not be played.\n", index.dropped);
+
+  return index.count;
+
+}
+
+// Returns full path of file i in index, i.e. "/music/test.wav".
+
+const char *libraryPath(const LibraryIndex &index, uint32_t i){
+
+  return index.pool + index.offsets[i];
+
+}
+
+// Returns file name of file i in index, without directories, i.e. "test.wav". Used for display.
+
+const char *libraryName(const LibraryIndex &index, uint32_t i){
+
+  const char *path = libraryPath(index, i);
+  const char *slash = strrchr(path, '/');
+
+  return slash ? slash + 1 : path;
+
+}
+
 // General file/dir IO functions.
 
 void createDir(fs::FS &fs, const char *path) {
@@ -138,6 +610,26 @@ void createDir(fs::FS &fs, const char *path) {
   }
 }
 
+static fileChangeHandler changeHandler = NULL;
+
+void setFileChangeHandler(fileChangeHandler handler){
+
+  changeHandler = handler;
+
+}
+
+void fileChangeBegin(const char * path){
+
+  if(changeHandler) changeHandler(path, false);
+
+}
+
+void fileChangeEnd(const char * path){
+
+  if(changeHandler) changeHandler(path, true);
+
+}
+
 void removeDir(fs::FS &fs, const char *path) {
   Serial.printf("Removing Dir: %s\n", path);
   if (fs.rmdir(path)) {
@@ -22,10 +22,109 @@
 
 #define CHUNK_SIZE 1024
 
+/*
+
+  LibraryIndex - Sorted list of every WAV file found under a directory, including subdirectories.
+
+  All paths are stored back to back in a single pool allocated once by libraryInit(), and are referenced
+  by byte offsets into that pool. Rescanning reuses the same memory, so no heap allocations happen per file
+  and the heap does not fragment on long running units. Stored paths are full paths, i.e. "/music/test.wav",
+  and can be passed straight to fs.open().
+
+  LIBRARY_POOL_SIZE - Bytes reserved for path strings, including null terminators. 64 bytes for each of
+  LIBRARY_MAX_FILES, which holds a full index of paths like "/artist/album/01 track name.wav".
+  LIBRARY_MAX_FILES - Maximum number of files the index can hold.
+  LIBRARY_MAX_DEPTH - Maximum subdirectory depth scanned.
+
+*/
+
+#define LIBRARY_MAX_FILES 4096
+#define LIBRARY_POOL_SIZE (LIBRARY_MAX_FILES * 64)
+#define LIBRARY_MAX_DEPTH 8
+
+struct LibraryIndex {
+
+  char *pool;
+  uint32_t *offsets;
+  uint32_t poolSize;
+  uint32_t poolUsed;
+  uint32_t maxFiles;
+  uint32_t count;
+  uint32_t dropped;
+
+};
+
 int SDInit();
 void SDInfo();
 void listDir(fs::FS &fs, const char * dirname, uint8_t levels);
 std::vector<String> getDirFilePaths(fs::FS &fs, const char * dirname);
+/*
+
+  BlockReader - Buffered reader that reads from the SD card in large blocks aligned to sector boundaries, and
+  hands out views into its buffer instead of copying. Views may be modified in place by the caller, i.e. to
+  apply gain before i2s_write().
+
+  Views always contain whole frames of frameBytes. If a frame straddles two blocks, the leftover bytes are moved
+  into headroom in front of the buffer before the next block is read, so reads from the card stay aligned.
+
+  READ_BLOCK_SIZE - Default block size. Should be a multiple of SECTOR_SIZE, 16 - 64KB works well.
+  READ_HEADROOM - Bytes reserved in front of each block for partial frames. Must be >= largest frame size.
+  READ_BUFFER_BYTES(block) - Size of buffer needed for a given block size when caller supplies its own buffer.
+
+*/
+
+#define SECTOR_SIZE 512
+#define READ_BLOCK_SIZE (32 * 1024)
+#define READ_HEADROOM 16
+#define READ_BUFFER_BYTES(block) ((block) + READ_HEADROOM)
+
+struct BlockReader {
+
+  File file;
+  uint8_t *buffer;
+  size_t blockSize;
+  bool ownsBuffer;
+
+  uint32_t blockStart;
+  size_t blockLen;
+
+  uint8_t *head;
+  size_t avail;
+  uint32_t position;
+  uint32_t end;
+
+  uint32_t reads;
+  uint32_t bytesRead;
+  uint32_t readMicros;
+
+};
+
+bool blockReaderOpen(BlockReader &reader, fs::FS &fs, const char * path, uint32_t offset, uint8_t *buffer = NULL, size_t bufferSize = READ_BUFFER_BYTES(READ_BLOCK_SIZE));
+size_t blockReaderNext(BlockReader &reader, uint8_t **data, size_t maxBytes, size_t frameBytes = 2);
+bool blockReaderSeek(BlockReader &reader, uint32_t offset);
+bool blockReaderAvailable(BlockReader &reader);
+void blockReaderSetEnd(BlockReader &reader, uint32_t end);
+void blockReaderClose(BlockReader &reader);
+void benchmarkRead(fs::FS &fs, const char * path, uint32_t offset = 44);
+
+/*
+
+  File changes. Code that rewrites or replaces a file that may be playing calls fileChangeBegin() before touching it
+  and fileChangeEnd() once done, so the player can let go of the file and pick it up again. The handler set with
+  setFileChangeHandler() is called with done false, then true, on the caller's task.
+
+*/
+
+typedef void (*fileChangeHandler)(const char * path, bool done);
+
+void setFileChangeHandler(fileChangeHandler handler);
+void fileChangeBegin(const char * path);
+void fileChangeEnd(const char * path);
+
+bool libraryInit(LibraryIndex &index, uint32_t poolSize = LIBRARY_POOL_SIZE, uint32_t maxFiles = LIBRARY_MAX_FILES);
+uint32_t scanLibrary(fs::FS &fs, const char * dirname, LibraryIndex &index, uint8_t levels = LIBRARY_MAX_DEPTH);
+const char *libraryPath(const LibraryIndex &index, uint32_t i);
+const char *libraryName(const LibraryIndex &index, uint32_t i);
 void createDir(fs::FS &fs, const char * path);
 void removeDir(fs::FS &fs, const char * path);
 void readFile(fs::FS &fs, const char * path);
@@ -0,0 +1,530 @@
+#include "serial_transfer.h"
+#include "audio_arena.h"
+#include "track_cache.h"
+
+static uint32_t crcTable[256];
+static uint32_t baudRate;
+
+// Frame being received. rxLength counts bytes so far, including sync bytes.
+
+static uint8_t rx[XFER_HEADER_BYTES + XFER_MAX_PAYLOAD + 4];
+static size_t rxLength = 0;
+
+// Open transfer.
+
+static bool open = false;
+static File file;
+static char path[XFER_MAX_PATH];
+static char partPath[XFER_MAX_PATH + 8];
+static uint32_t fileSize;
+static uint32_t expected;
+static uint32_t resumeOffset;
+static uint32_t crc;
+static uint8_t *block = NULL;
+static size_t blockUsed;
+static int framesSinceAck;
+static bool resendSent;
+static unsigned long lastFrame;
+static unsigned long startMillis;
+static uint32_t badFrames;
+static bool completed;
+
+/*
+
+  transferCRC() - Updates a zlib compatible CRC-32.
+
+  uint32_t crc - CRC so far. 0 to start.
+  const uint8_t *data - Bytes to add.
+  size_t n - Number of bytes.
+
+  return - Updated CRC.
+
+*/
+
+uint32_t transferCRC(uint32_t crc, const uint8_t *data, size_t n){
+
+  crc = ~crc;
+
+  for(size_t i = 0; i < n; i++) crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+  return ~crc;
+
+}
+
+static uint32_t readU32(const uint8_t *p){
+
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+}
+
+static void writeU32(uint8_t *p, uint32_t v){
+
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+
+}
+
+static void sendAck(uint16_t seq, uint8_t status, uint32_t offset){
+
+  uint8_t frame[XFER_HEADER_BYTES + 5 + 4] = {XFER_SYNC_0, XFER_SYNC_1, XFER_ACK, (uint8_t)seq, (uint8_t)(seq >> 8), 5, 0, status};
+
+  writeU32(frame + XFER_HEADER_BYTES + 1, offset);
+  writeU32(frame + XFER_HEADER_BYTES + 5, transferCRC(0, frame + 2, XFER_HEADER_BYTES - 2 + 5));
+
+  Serial.write(frame, sizeof(frame));
+
+}
+
+/*
+
+  transferInit() - Builds CRC table. Call from setup() after Serial.begin(), which must be preceded by
+  Serial.setRxBufferSize(XFER_RX_BUFFER).
+
+  uint32_t baud - Rate passed to Serial.begin(), used for throughput reports.
+
+*/
+
+void transferInit(uint32_t baud){
+
+  for(uint32_t i = 0; i < 256; i++){
+
+    uint32_t c = i;
+
+    for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+
+    crcTable[i] = c;
+
+  }
+
+  baudRate = baud;
+
+}
+
+// Writes buffered data to the .part file. Full blocks keep writes sector aligned.
+
+static bool flushBlock(){
+
+  if(blockUsed == 0) return true;
+
+  bool ok = file.write(block, blockUsed) == blockUsed;
+
+  blockUsed = 0;
+
+  if(!ok) Serial.printf("Write to %s failed.\n", partPath);
+
+  return ok;
+
+}
+
+// Ends transfer. The .part file is kept unless remove is set.
+
+static void closeTransfer(fs::FS &fs, bool remove){
+
+  if(!open) return;
+
+  flushBlock();
+
+  file.close();
+
+  arenaGiveBlock(block);
+
+  block = NULL;
+  open = false;
+
+  if(remove) fs.remove(partPath);
+
+}
+
+// Starts or resumes a transfer. Returns offset host must start from, or -1 on failure.
+
+static int64_t openTransfer(fs::FS &fs, const uint8_t *payload, size_t length){
+
+  closeTransfer(fs, false);
+
+  size_t pathLength = length - 4;
+
+  if(length < 6 || pathLength >= XFER_MAX_PATH || payload[4] != '/') return -1;
+
+  fileSize = readU32(payload);
+
+  memcpy(path, payload + 4, pathLength);
+  path[pathLength] = 0;
+
+  snprintf(partPath, sizeof(partPath), "%s.part", path);
+
+  // Parent directories are created as needed, i.e. for "/music/new/a.wav".
+
+  for(char *slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')){
+
+    *slash = 0;
+
+    if(!fs.exists(path)) fs.mkdir(path);
+
+    *slash = '/';
+
+  }
+
+  block = arenaTakeBlock();
+
+  if(!block){
+
+    Serial.println("No free transfer buffer in audio arena.");
+
+    return -1;
+
+  }
+
+  // Data already on the card is read back once, so the file CRC can still be checked on a resume.
+
+  resumeOffset = 0;
+  crc = 0;
+
+  if(fs.exists(partPath) && (file = fs.open(partPath, FILE_READ))){
+
+    size_t n;
+
+    while((n = file.read(block, XFER_WRITE_BLOCK)) > 0){
+
+      crc = transferCRC(crc, block, n);
+      resumeOffset += n;
+
+    }
+
+    file.close();
+
+  }
+
+  if(resumeOffset > fileSize){
+
+    fs.remove(partPath);
+
+    resumeOffset = 0;
+    crc = 0;
+
+  }
+
+  file = fs.open(partPath, resumeOffset ? FILE_APPEND : FILE_WRITE);
+
+  if(!file){
+
+    Serial.printf("%s could not be created.\n", partPath);
+
+    arenaGiveBlock(block);
+    block = NULL;
+
+    return -1;
+
+  }
+
+  open = true;
+  expected = resumeOffset;
+  blockUsed = 0;
+  framesSinceAck = 0;
+  resendSent = false;
+  startMillis = millis();
+
+  Serial.printf("Receiving %s, %u bytes, from %u.\n", path, fileSize, resumeOffset);
+
+  return resumeOffset;
+
+}
+
+// Adds in order data to the write block, flushing as it fills.
+
+static bool receiveData(const uint8_t *data, size_t n){
+
+  crc = transferCRC(crc, data, n);
+  expected += n;
+
+  while(n > 0){
+
+    size_t space = XFER_WRITE_BLOCK - blockUsed;
+    size_t take = n < space ? n : space;
+
+    memcpy(block + blockUsed, data, take);
+
+    blockUsed += take;
+    data += take;
+    n -= take;
+
+    if(blockUsed == XFER_WRITE_BLOCK && !flushBlock()) return false;
+
+  }
+
+  return true;
+
+}
+
+// Finishes transfer if all data arrived with the right CRC. Returns true once the file is in place.
+
+static bool finishTransfer(fs::FS &fs, uint32_t fileCRC){
+
+  if(expected != fileSize) return false;
+
+  if(!flushBlock()){
+
+    closeTransfer(fs, false);
+
+    return false;
+
+  }
+
+  bool match = crc == fileCRC;
+
+  closeTransfer(fs, !match);
+
+  if(!match){
+
+    Serial.printf("%s: CRC mismatch, transfer discarded.\n", path);
+
+    return false;
+
+  }
+
+  // An older copy of the file may be playing, so the player lets go of it while it is replaced.
+
+  fileChangeBegin(path);
+
+  if(fs.exists(path)) fs.remove(path);
+
+  bool renamed = fs.rename(partPath, path);
+
+  trackCacheInvalidate(path);
+  fileChangeEnd(path);
+
+  if(!renamed){
+
+    Serial.printf("%s could not be renamed to %s.\n", partPath, path);
+
+    return false;
+
+  }
+
+  // Line rate is 10 bits per byte with 8N1 framing.
+
+  unsigned long ms = millis() - startMillis;
+  uint32_t received = fileSize - resumeOffset;
+  double bytesPerSecond = ms ? received * 1000.0 / ms : 0;
+
+  Serial.printf("Received %s: %u bytes in %lu ms, %.1f KB/s, %.0f%% of %u baud. %u bad frames.\n", path, received, ms,
+                bytesPerSecond / 1024, 100.0 * bytesPerSecond / (baudRate / 10), baudRate, badFrames);
+
+  return true;
+
+}
+
+static void handleFrame(fs::FS &fs, uint8_t type, uint16_t seq, const uint8_t *payload, size_t length){
+
+  lastFrame = millis();
+
+  switch(type){
+
+    case XFER_OPEN: {
+
+      int64_t offset = openTransfer(fs, payload, length);
+
+      badFrames = 0;
+
+      sendAck(seq, offset < 0 ? XFER_FAILED : XFER_OK, offset < 0 ? 0 : offset);
+
+      break;
+
+    }
+
+    case XFER_DATA: {
+
+      if(!open || length < 4){
+
+        sendAck(seq, XFER_FAILED, 0);
+
+        break;
+
+      }
+
+      uint32_t offset = readU32(payload);
+      size_t n = length - 4;
+
+      // Only the next expected data is taken. One resend request per gap, frames already in flight are dropped.
+
+      if(offset != expected){
+
+        if(!resendSent) sendAck(seq, XFER_RESEND, expected);
+
+        resendSent = true;
+
+        break;
+
+      }
+
+      if(expected + n > fileSize || !receiveData(payload + 4, n)){
+
+        closeTransfer(fs, false);
+
+        sendAck(seq, XFER_FAILED, expected);
+
+        break;
+
+      }
+
+      resendSent = false;
+
+      if(++framesSinceAck >= XFER_ACK_INTERVAL || expected == fileSize){
+
+        framesSinceAck = 0;
+
+        sendAck(seq, XFER_OK, expected);
+
+      }
+
+      break;
+
+    }
+
+    case XFER_END: {
+
+      uint32_t offset = expected;
+      bool ok = open && length == 4 && finishTransfer(fs, readU32(payload));
+
+      if(ok) completed = true;
+
+      sendAck(seq, ok ? XFER_OK : XFER_FAILED, ok ? fileSize : offset);
+
+      break;
+
+    }
+
+    case XFER_ABORT:
+
+      closeTransfer(fs, false);
+
+      sendAck(seq, XFER_OK, expected);
+
+      break;
+
+    case XFER_BAUD:
+
+      if(length != 4){
+
+        sendAck(seq, XFER_FAILED, baudRate);
+
+        break;
+
+      }
+
+      sendAck(seq, XFER_OK, readU32(payload));
+
+      Serial.flush();
+
+      baudRate = readU32(payload);
+
+      Serial.updateBaudRate(baudRate);
+
+      break;
+
+  }
+
+}
+
+// Adds one received byte to the frame being assembled. Bytes before a sync pair, i.e. stray text, are skipped.
+
+static void receiveByte(fs::FS &fs, uint8_t b){
+
+  if(rxLength == 0){
+
+    if(b == XFER_SYNC_0) rx[rxLength++] = b;
+
+    return;
+
+  }
+
+  if(rxLength == 1){
+
+    if(b == XFER_SYNC_1) rx[rxLength++] = b;
+    else rxLength = b == XFER_SYNC_0 ? 1 : 0;
+
+    return;
+
+  }
+
+  rx[rxLength++] = b;
+
+  if(rxLength < XFER_HEADER_BYTES) return;
+
+  size_t length = rx[5] | (rx[6] << 8);
+
+  if(length > XFER_MAX_PAYLOAD){
+
+    rxLength = 0;
+    badFrames++;
+
+    return;
+
+  }
+
+  if(rxLength < XFER_HEADER_BYTES + length + 4) return;
+
+  rxLength = 0;
+
+  if(transferCRC(0, rx + 2, XFER_HEADER_BYTES - 2 + length) != readU32(rx + XFER_HEADER_BYTES + length)){
+
+    badFrames++;
+
+    if(open && !resendSent) sendAck(rx[3] | (rx[4] << 8), XFER_RESEND, expected);
+
+    resendSent = open;
+
+    return;
+
+  }
+
+  handleFrame(fs, rx[2], rx[3] | (rx[4] << 8), rx + XFER_HEADER_BYTES, length);
+
+}
+
+/*
+
+  transferService() - Handles received serial data. Call from loop() often, at least every few ms while
+  transferActive() is true.
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+
+  return - true when a file has just been completed, so the library should be rescanned.
+
+*/
+
+bool transferService(fs::FS &fs){
+
+  uint8_t buffer[256];
+  int available;
+
+  completed = false;
+
+  while((available = Serial.available()) > 0){
+
+    size_t n = Serial.readBytes(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+
+    for(size_t i = 0; i < n; i++) receiveByte(fs, buffer[i]);
+
+  }
+
+  if(open && millis() - lastFrame > XFER_TIMEOUT_MS){
+
+    Serial.printf("Transfer of %s timed out at %u bytes. Send it again to resume.\n", path, expected);
+
+    closeTransfer(fs, false);
+
+  }
+
+  return completed;
+
+}
+
+// Returns true while a transfer is open, so loop() can poll faster.
+
+bool transferActive(){
+
+  return open;
+
+}
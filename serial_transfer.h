@@ -0,0 +1,76 @@
+#ifndef _SERIAL_TRANSFER_H
+#define _SERIAL_TRANSFER_H
+
+/*
+
+  Serial file transfer.
+
+  Loads files onto the SD card over the USB serial port, so tracks can be added without pulling the card. Debug
+  prints share the port, and are skipped by the host since they never contain the sync bytes. The host side is
+  tools/send_wav.py.
+
+  Every message is a frame:
+
+    0xA5 0x5A | type (1) | seq (2) | length (2) | payload (length) | CRC-32 (4)
+
+  Numbers are little endian. The CRC is the zlib CRC-32 of type, seq, length and payload. Frames with a bad CRC
+  are dropped.
+
+  Host to device:
+
+    XFER_OPEN - uint32 file size, then path. Reply offset is where the host must start, non zero when resuming.
+    XFER_DATA - uint32 offset, then up to XFER_MAX_DATA bytes of file data.
+    XFER_END - uint32 CRC-32 of the whole file. Reply is XFER_OK once the file is in place.
+    XFER_ABORT - Stops the transfer, keeping received data for a resume.
+    XFER_BAUD - uint32 baud rate. Device replies at the old rate, then switches.
+
+  Device to host, XFER_ACK only: uint8 status, uint32 offset. Data is acknowledged cumulatively every
+  XFER_ACK_INTERVAL frames, so the host keeps a window of frames in flight. A frame at the wrong offset, or a bad
+  frame, gets one XFER_RESEND with the offset the device expects next, and the host goes back to it.
+
+  Data goes to "path.part" in XFER_WRITE_BLOCK writes from an arena pool block, and is renamed to path once the
+  CRC matches. An interrupted transfer, or one idle for XFER_TIMEOUT_MS, leaves the .part file, and sending the
+  same file again resumes after it.
+
+  XFER_RX_BUFFER - Serial receive buffer, set before Serial.begin(). Must hold a full window of frames.
+
+*/
+
+#include "sd_read_write.h"
+
+#define XFER_SYNC_0 0xA5
+#define XFER_SYNC_1 0x5A
+#define XFER_HEADER_BYTES 7
+#define XFER_MAX_DATA 1024
+#define XFER_MAX_PAYLOAD (XFER_MAX_DATA + 4)
+#define XFER_MAX_PATH 128
+#define XFER_ACK_INTERVAL 4
+#define XFER_WRITE_BLOCK (16 * 1024)
+#define XFER_TIMEOUT_MS 5000
+#define XFER_RX_BUFFER (16 * 1024)
+
+typedef enum{
+
+  XFER_OPEN = 1,
+  XFER_DATA,
+  XFER_END,
+  XFER_ABORT,
+  XFER_BAUD,
+  XFER_ACK = 0x80
+
+} transferFrame;
+
+typedef enum{
+
+  XFER_OK = 0,
+  XFER_RESEND,
+  XFER_FAILED
+
+} transferStatus;
+
+void transferInit(uint32_t baud);
+bool transferService(fs::FS &fs);
+bool transferActive();
+uint32_t transferCRC(uint32_t crc, const uint8_t *data, size_t n);
+
+#endif
@@ -0,0 +1,217 @@
+#include "silence_trim.h"
+#include "audio_arena.h"
+
+/*
+
+  trimmerInit() - Sets up trimmer in front of sink and allocates its ring buffer.
+
+  SilenceTrimmer &trimmer - Trimmer to initialize. Must be finished with trimmerFinish().
+  AudioSink &sink - Destination for kept audio.
+  uint32_t sample_rate - Sample rate of recording, used to convert times to samples.
+  int16_t threshold - Peak level below which a block is silence.
+  uint32_t preRollMs - Audio kept before first loud block.
+  uint32_t hangMs - Audio kept after last loud block.
+
+  return - false if ring buffer could not be allocated.
+
+*/
+
+bool trimmerInit(SilenceTrimmer &trimmer, AudioSink &sink, uint32_t sample_rate, int16_t threshold, uint32_t preRollMs, uint32_t hangMs){
+
+  trimmer.sink = &sink;
+  trimmer.threshold = threshold;
+  trimmer.preRoll = sample_rate * preRollMs / 1000;
+  trimmer.hang = sample_rate * hangMs / 1000;
+
+  size_t bytes = sample_rate * TRIM_BUFFER_SECONDS * sizeof(int16_t);
+
+  trimmer.ring = (int16_t *)arenaTakeBuffer(bytes, TRIM_FALLBACK_SAMPLES * sizeof(int16_t));
+  trimmer.capacity = bytes / sizeof(int16_t);
+
+  trimmer.start = 0;
+  trimmer.count = 0;
+  trimmer.committed = 0;
+  trimmer.started = false;
+  trimmer.written = 0;
+  trimmer.lastLoudEnd = 0;
+  trimmer.samplesIn = 0;
+  trimmer.blocks = 0;
+  trimmer.cycles = 0;
+
+  if(!trimmer.ring){
+
+    Serial.println("Silence trimmer buffer could not be allocated.");
+
+    return false;
+
+  }
+
+  if(trimmer.preRoll > trimmer.capacity) trimmer.preRoll = trimmer.capacity;
+
+  return true;
+
+}
+
+// Discards oldest n held samples.
+
+static void ringDrop(SilenceTrimmer &trimmer, uint32_t n){
+
+  trimmer.start = (trimmer.start + n) % trimmer.capacity;
+  trimmer.count -= n;
+
+}
+
+// Writes oldest n held samples to sink, then discards them. Written samples no longer count as committed.
+
+static void ringFlush(SilenceTrimmer &trimmer, uint32_t n){
+
+  uint32_t first = trimmer.capacity - trimmer.start;
+
+  if(first > n) first = n;
+
+  sinkWrite(*trimmer.sink, (const uint8_t *)(trimmer.ring + trimmer.start), first * sizeof(int16_t));
+
+  if(n > first) sinkWrite(*trimmer.sink, (const uint8_t *)trimmer.ring, (n - first) * sizeof(int16_t));
+
+  trimmer.written += n;
+  trimmer.committed = trimmer.committed > n ? trimmer.committed - n : 0;
+
+  ringDrop(trimmer, n);
+
+}
+
+// Holds samples, making room by dropping (before first loud block) or writing (after it) the oldest held samples.
+
+static void ringPush(SilenceTrimmer &trimmer, const int16_t *samples, uint32_t n){
+
+  if(n > trimmer.capacity){
+
+    if(trimmer.started) ringFlush(trimmer, trimmer.count);
+    else ringDrop(trimmer, trimmer.count);
+
+    if(trimmer.started){
+
+      sinkWrite(*trimmer.sink, (const uint8_t *)samples, (n - trimmer.capacity) * sizeof(int16_t));
+      trimmer.written += n - trimmer.capacity;
+
+    }
+
+    samples += n - trimmer.capacity;
+    n = trimmer.capacity;
+
+  }
+
+  if(trimmer.count + n > trimmer.capacity){
+
+    uint32_t excess = trimmer.count + n - trimmer.capacity;
+
+    if(trimmer.started) ringFlush(trimmer, excess);
+    else ringDrop(trimmer, excess);
+
+  }
+
+  uint32_t end = (trimmer.start + trimmer.count) % trimmer.capacity;
+
+  for(uint32_t i = 0; i < n; i++){
+
+    trimmer.ring[end] = samples[i];
+
+    if(++end == trimmer.capacity) end = 0;
+
+  }
+
+  trimmer.count += n;
+
+}
+
+/*
+
+  trimmerWrite() - Passes one captured block through the silence detector.
+
+  const int16_t *samples - Captured samples, after any conditioning.
+  size_t sampleCount - Number of samples. Blocks of a few hundred samples work best.
+
+*/
+
+void trimmerWrite(SilenceTrimmer &trimmer, const int16_t *samples, size_t sampleCount){
+
+  uint32_t startCycles = ESP.getCycleCount();
+
+  int32_t peak = 0;
+
+  for(size_t i = 0; i < sampleCount; i++){
+
+    int32_t v = samples[i] < 0 ? -(int32_t)samples[i] : samples[i];
+
+    if(v > peak) peak = v;
+
+  }
+
+  bool loud = peak >= trimmer.threshold;
+
+  ringPush(trimmer, samples, sampleCount);
+
+  if(!trimmer.started && trimmer.count > trimmer.preRoll + sampleCount) ringDrop(trimmer, trimmer.count - trimmer.preRoll - sampleCount);
+
+  // Everything held up to a loud block will be written, a bounded part of it now.
+
+  if(loud){
+
+    trimmer.started = true;
+    trimmer.committed = trimmer.count;
+    trimmer.lastLoudEnd = trimmer.written + trimmer.count;
+
+  }
+
+  uint32_t flush = sampleCount * TRIM_FLUSH_BLOCKS;
+
+  if(trimmer.committed) ringFlush(trimmer, trimmer.committed < flush ? trimmer.committed : flush);
+
+  trimmer.samplesIn += sampleCount;
+  trimmer.blocks++;
+  trimmer.cycles += ESP.getCycleCount() - startCycles;
+
+}
+
+/*
+
+  trimmerFinish() - Writes the rest of the backlog and the kept part of held silence, frees ring buffer, and prints
+  savings and CPU cost. Bytes saved are samples never written to the card, which is less than samples trimmed if
+  trailing silence longer than the ring buffer was written before it turned out to be trailing.
+
+  Sink is not closed, but if audio past the end of the recording was already written, the caller must set the
+  WAV header to the returned length after closing it.
+
+  return - Number of samples in trimmed recording.
+
+*/
+
+uint32_t trimmerFinish(SilenceTrimmer &trimmer){
+
+  uint32_t length = 0;
+
+  if(trimmer.started){
+
+    length = trimmer.lastLoudEnd + trimmer.hang;
+
+    if(length > trimmer.written){
+
+      uint32_t keep = length - trimmer.written;
+
+      ringFlush(trimmer, keep < trimmer.count ? keep : trimmer.count);
+
+    }
+
+    if(length > trimmer.written) length = trimmer.written;
+
+  }
+
+  arenaGiveBuffer(trimmer.ring);
+  trimmer.ring = NULL;
+  trimmer.count = 0;
+
+  Serial.printf("Trimmed %u of %u samples, %u bytes saved. %llu cycles per block.\n", trimmer.samplesIn - length, trimmer.samplesIn, (trimmer.samplesIn - trimmer.written) * 2, trimmer.blocks ? trimmer.cycles / trimmer.blocks : 0);
+
+  return length;
+
+}
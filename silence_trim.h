@@ -0,0 +1,68 @@
+#ifndef _SILENCE_TRIM_H
+#define _SILENCE_TRIM_H
+
+/*
+
+  Streaming silence trimmer for recordings.
+
+  Captured blocks are passed to trimmerWrite() instead of straight to the sink. Blocks whose peak is below
+  threshold are held in a RAM ring buffer, and only written once a louder block arrives after them. Before the
+  first loud block, only the last preRoll samples are kept so the start of speech is not cut off. On
+  trimmerFinish(), held silence past hang samples after the last loud block is discarded.
+
+  Pauses longer than the ring buffer are written out as they happen. If one of those turns out to be trailing
+  silence, the WAV header is set to end hang samples after the last loud block.
+
+  Held silence that a loud block proves to be a pause is not written all at once, since a full ring is up to
+  TRIM_BUFFER_SECONDS of audio and the caller is capturing. Loud blocks go into the ring behind it, and each
+  trimmerWrite() writes at most TRIM_FLUSH_BLOCKS times its own block size of this backlog.
+
+  TRIM_BUFFER_SECONDS - Size of ring buffer. Taken from PSRAM if present, otherwise TRIM_FALLBACK_SAMPLES from an
+  audio arena pool block, see arenaTakeBuffer(), so it must fit ARENA_BLOCK_BYTES.
+  TRIM_THRESHOLD - Default peak level, out of 32767, below which a block is silence. 1000 is -30dBFS, about 31 LSB of
+  the built in ADC after conditionADCSamples(). ADC noise with a standard deviation of 5 LSB peaks at 500 - 770.
+  TRIM_PREROLL_MS - Default audio kept before first loud block.
+  TRIM_HANG_MS - Default audio kept after last loud block.
+  TRIM_FLUSH_BLOCKS - Backlog written per trimmerWrite(), in blocks of the size passed. Must be more than 1 so the
+  backlog shrinks while audio stays loud.
+
+*/
+
+#include "audio_sink.h"
+
+#define TRIM_BUFFER_SECONDS 10
+#define TRIM_FALLBACK_SAMPLES 8192
+#define TRIM_THRESHOLD 1000
+#define TRIM_PREROLL_MS 100
+#define TRIM_HANG_MS 250
+#define TRIM_FLUSH_BLOCKS 4
+
+struct SilenceTrimmer {
+
+  AudioSink *sink;
+
+  int16_t threshold;
+  uint32_t preRoll;
+  uint32_t hang;
+
+  int16_t *ring;
+  uint32_t capacity;
+  uint32_t start;
+  uint32_t count;
+  uint32_t committed;
+
+  bool started;
+  uint32_t written;
+  uint32_t lastLoudEnd;
+
+  uint32_t samplesIn;
+  uint32_t blocks;
+  uint64_t cycles;
+
+};
+
+bool trimmerInit(SilenceTrimmer &trimmer, AudioSink &sink, uint32_t sample_rate, int16_t threshold = TRIM_THRESHOLD, uint32_t preRollMs = TRIM_PREROLL_MS, uint32_t hangMs = TRIM_HANG_MS);
+void trimmerWrite(SilenceTrimmer &trimmer, const int16_t *samples, size_t sampleCount);
+uint32_t trimmerFinish(SilenceTrimmer &trimmer);
+
+#endif
@@ -0,0 +1,265 @@
+#include "spectrum.h"
+#include "fft.h"
+#include <atomic>
+
+// Tap ring buffer. Written only by audio task, read only by UI.
+
+static int16_t tap[SPECTRUM_TAP_SIZE];
+static std::atomic<uint32_t> tapHead(0);
+static std::atomic<uint32_t> tapTail(0);
+static std::atomic<uint32_t> tapDropped(0);
+
+// Q15 twiddle and window tables, and FFT work buffers.
+
+static int16_t cosTable[SPECTRUM_MAX_FFT / 2];
+static int16_t sinTable[SPECTRUM_MAX_FFT / 2];
+static int16_t window[SPECTRUM_MAX_FFT];
+
+static int16_t history[SPECTRUM_MAX_FFT];
+static int16_t re[SPECTRUM_MAX_FFT];
+static int16_t im[SPECTRUM_MAX_FFT];
+
+static uint16_t bandEdges[SPECTRUM_MAX_BANDS + 1];
+static uint8_t levels[SPECTRUM_MAX_BANDS];
+static uint8_t vu;
+
+static int fftSize;
+static int bandCount;
+static int frameMs;
+static unsigned long lastFrame;
+
+static uint32_t frames;
+static uint64_t totalCycles;
+static uint32_t maxCycles;
+
+/*
+
+  spectrumInit() - Builds tables for given FFT size and band count.
+
+  int fftSize - Power of 2 between 16 and SPECTRUM_MAX_FFT.
+  int bands - Number of bands, up to SPECTRUM_MAX_BANDS and at most fftSize / 4.
+  int frameMs - Minimum time between analysis frames.
+
+  return - false if arguments are out of range.
+
+*/
+
+bool spectrumInit(int size, int bands, int ms){
+
+  if(size < 16 || size > SPECTRUM_MAX_FFT || (size & (size - 1)) || bands < 1 || bands > SPECTRUM_MAX_BANDS || bands > size / 4){
+
+    Serial.println("Invalid spectrum configuration.");
+
+    return false;
+
+  }
+
+  fftSize = size;
+  bandCount = bands;
+  frameMs = ms;
+
+  fftTables(cosTable, sinTable, fftSize);
+
+  for(int i = 0; i < fftSize; i++){
+
+    window[i] = (int16_t)((0.5 - 0.5 * cos(2.0 * M_PI * i / (fftSize - 1))) * 32767);
+
+  }
+
+  // Log spaced band edges from bin 1 to fftSize / 2, at least one bin per band.
+
+  int half = fftSize / 2;
+
+  bandEdges[0] = 1;
+
+  for(int b = 1; b <= bandCount; b++){
+
+    int edge = (int)(pow((double)half, (double)b / bandCount) + 0.5);
+
+    if(edge <= bandEdges[b - 1]) edge = bandEdges[b - 1] + 1;
+    if(edge > half) edge = half;
+
+    bandEdges[b] = edge;
+
+  }
+
+  bandEdges[bandCount] = half;
+
+  memset(history, 0, sizeof(history));
+  memset(levels, 0, sizeof(levels));
+  vu = 0;
+
+  frames = 0;
+  totalCycles = 0;
+  maxCycles = 0;
+
+  return true;
+
+}
+
+/*
+
+  spectrumTapWrite() - Copies samples into tap. Called by audio task after gain is applied.
+  If there is not enough room the whole block is dropped and counted.
+
+*/
+
+void spectrumTapWrite(const int16_t *samples, size_t sampleCount){
+
+  uint32_t head = tapHead.load(std::memory_order_relaxed);
+  uint32_t tail = tapTail.load(std::memory_order_acquire);
+
+  if(SPECTRUM_TAP_SIZE - (head - tail) < sampleCount){
+
+    tapDropped.fetch_add(1, std::memory_order_relaxed);
+
+    return;
+
+  }
+
+  for(size_t i = 0; i < sampleCount; i++){
+
+    tap[(head + i) & (SPECTRUM_TAP_SIZE - 1)] = samples[i];
+
+  }
+
+  tapHead.store(head + sampleCount, std::memory_order_release);
+
+}
+
+// Discards tap contents and current levels, i.e. when a new track starts. Call from UI only.
+
+void spectrumTapClear(){
+
+  tapTail.store(tapHead.load(std::memory_order_acquire), std::memory_order_release);
+
+  memset(history, 0, sizeof(history));
+
+}
+
+// Maps power to a 0 - 255 level over a 54dB range. Powers of 2^topBits and above read as 255.
+
+static uint8_t powerLevel(uint32_t power, int topBits){
+
+  int level = (log2x8(power) - (topBits - 18) * 8) * 255 / (18 * 8);
+
+  if(level < 0) level = 0;
+  if(level > 255) level = 255;
+
+  return level;
+
+}
+
+/*
+
+  spectrumUpdate() - Drains tap and, if a frame is due, recomputes band and VU levels.
+
+  unsigned long now - Current millis().
+
+  return - true if levels changed and display should be redrawn.
+
+*/
+
+bool spectrumUpdate(unsigned long now){
+
+  if(!fftSize || now - lastFrame < (unsigned long)frameMs) return false;
+
+  lastFrame = now;
+
+  uint32_t tail = tapTail.load(std::memory_order_relaxed);
+  uint32_t head = tapHead.load(std::memory_order_acquire);
+  uint32_t avail = head - tail;
+
+  // Only the newest fftSize samples are needed.
+
+  if(avail > (uint32_t)fftSize){
+
+    tail = head - fftSize;
+    avail = fftSize;
+
+  }
+
+  memmove(history, history + avail, (fftSize - avail) * sizeof(int16_t));
+
+  for(uint32_t i = 0; i < avail; i++){
+
+    history[fftSize - avail + i] = tap[(tail + i) & (SPECTRUM_TAP_SIZE - 1)];
+
+  }
+
+  tapTail.store(head, std::memory_order_release);
+
+  uint32_t start = ESP.getCycleCount();
+
+  uint64_t sumSquares = 0;
+
+  for(int i = 0; i < fftSize; i++){
+
+    sumSquares += (int32_t)history[i] * history[i];
+
+    re[i] = ((int32_t)history[i] * window[i]) >> 15;
+    im[i] = 0;
+
+  }
+
+  fftQ15(re, im, fftSize, cosTable, sinTable, 0);
+
+  for(int b = 0; b < bandCount; b++){
+
+    uint32_t peak = 0;
+
+    for(int k = bandEdges[b]; k < bandEdges[b + 1]; k++){
+
+      uint32_t power = (uint32_t)((int32_t)re[k] * re[k]) + (uint32_t)((int32_t)im[k] * im[k]);
+
+      if(power > peak) peak = power;
+
+    }
+
+    // FFT output is scaled by 1/fftSize, so a full scale sine peaks near 2^26 whatever the FFT size.
+
+    uint8_t level = powerLevel(peak, 26);
+
+    levels[b] = level >= levels[b] ? level : (levels[b] > level + SPECTRUM_DECAY ? levels[b] - SPECTRUM_DECAY : level);
+
+  }
+
+  uint8_t level = powerLevel((uint32_t)(sumSquares / fftSize), 29);
+
+  vu = level >= vu ? level : (vu > level + SPECTRUM_DECAY ? vu - SPECTRUM_DECAY : level);
+
+  uint32_t cycles = ESP.getCycleCount() - start;
+
+  frames++;
+  totalCycles += cycles;
+  if(cycles > maxCycles) maxCycles = cycles;
+
+  return true;
+
+}
+
+int spectrumBandCount(){
+
+  return bandCount;
+
+}
+
+uint8_t spectrumBand(int band){
+
+  return levels[band];
+
+}
+
+uint8_t spectrumVU(){
+
+  return vu;
+
+}
+
+// Prints analysis cost per frame and tap drops to serial monitor.
+
+void spectrumReport(){
+
+  Serial.printf("Spectrum: %d point FFT, %d bands. %u frames, %llu avg / %u max cycles per frame, %u tap blocks dropped.\n", fftSize, bandCount, frames, frames ? totalCycles / frames : 0, maxCycles, tapDropped.load());
+
+}
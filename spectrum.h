@@ -0,0 +1,41 @@
+#ifndef _SPECTRUM_H
+#define _SPECTRUM_H
+
+/*
+
+  Spectrum analyzer and VU meter for the display.
+
+  The audio task copies played samples into a lock-free single producer / single consumer tap with
+  spectrumTapWrite(). If the tap is full the block is dropped, so the audio task never waits on the UI.
+
+  The UI calls spectrumUpdate() from loop(). At most once every frameMs it takes the newest fftSize samples from
+  the tap, applies a Hann window, runs fftQ15() with every stage halved and reduces the bins to log spaced bands.
+  Band and VU levels are 0 - 255, roughly 3dB per 8 steps, with a falloff so bars decay smoothly.
+
+  SPECTRUM_MAX_FFT - Largest FFT size, sets size of twiddle and window tables.
+  SPECTRUM_MAX_BANDS - Largest number of bands.
+  SPECTRUM_TAP_SIZE - Samples held by tap. Must be a power of 2 and at least SPECTRUM_MAX_FFT.
+
+*/
+
+#include <Arduino.h>
+
+#define SPECTRUM_MAX_FFT 1024
+#define SPECTRUM_MAX_BANDS 32
+#define SPECTRUM_TAP_SIZE 4096
+
+#define SPECTRUM_FFT_SIZE 256
+#define SPECTRUM_BANDS 16
+#define SPECTRUM_FRAME_MS 50
+#define SPECTRUM_DECAY 12
+
+bool spectrumInit(int fftSize = SPECTRUM_FFT_SIZE, int bands = SPECTRUM_BANDS, int frameMs = SPECTRUM_FRAME_MS);
+void spectrumTapWrite(const int16_t *samples, size_t sampleCount);
+void spectrumTapClear();
+bool spectrumUpdate(unsigned long now);
+int spectrumBandCount();
+uint8_t spectrumBand(int band);
+uint8_t spectrumVU();
+void spectrumReport();
+
+#endif
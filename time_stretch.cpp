@@ -0,0 +1,444 @@
+#include "time_stretch.h"
+
+// Periodic Hann window, 1.0 = 32768. Second half is 32768 minus first half so overlapping windows add to exactly 1.0.
+
+static int32_t window[STRETCH_FRAME];
+static bool windowReady = false;
+
+static void buildWindow(){
+
+  for(int i = 0; i < STRETCH_HOP; i++){
+
+    window[i] = (int32_t)((0.5 - 0.5 * cos(2.0 * M_PI * i / STRETCH_FRAME)) * 32768.0 + 0.5);
+    window[i + STRETCH_HOP] = 32768 - window[i];
+
+  }
+
+  windowReady = true;
+
+}
+
+/*
+
+  stretchReset() - Clears buffered input and overlap. Call when starting a track. The first frame fades in from
+  silence, see stretchContinue() for switching stretching on mid-track. Speed is kept.
+
+*/
+
+void stretchReset(TimeStretch &stretch){
+
+  if(!windowReady) buildWindow();
+
+  stretch.base = 0;
+  stretch.length = 0;
+  stretch.position = 0;
+  stretch.next = 0;
+  stretch.first = true;
+  stretch.continuing = false;
+  stretch.ending = false;
+  stretch.end = 0;
+  stretch.sourceSamples = 0;
+  stretch.active = false;
+
+  memset(stretch.overlap, 0, sizeof(stretch.overlap));
+
+  if(stretch.pendingHop.load() == 0) stretch.pendingHop = STRETCH_HOP;
+
+  stretch.hop = stretch.pendingHop;
+
+}
+
+// Carries on from input at stretch.next, as if a frame had started STRETCH_HOP before it. That frame's start is
+// in output already, so the next frame is searched from there on, but not before stretch.next.
+
+static void continueFromNext(TimeStretch &stretch){
+
+  uint32_t hop = stretch.pendingHop.load();
+
+  stretch.first = false;
+  stretch.continuing = true;
+  stretch.position = stretch.next + (hop > STRETCH_HOP ? hop - STRETCH_HOP : 0);
+
+}
+
+/*
+
+  stretchContinue() - Clears buffered input like stretchReset(), for switching stretching on in the middle of a
+  track. Input pushed next must follow on from the last unstretched sample output. The first frame is then
+  overlap-added with that input's natural continuation instead of with silence, so output carries on without a gap.
+
+*/
+
+void stretchContinue(TimeStretch &stretch){
+
+  stretchReset(stretch);
+
+  continueFromNext(stretch);
+
+}
+
+// stretchSetSpeed() - Sets playback speed, clamped to 0.5 - 2.0. Safe to call from any task.
+
+void stretchSetSpeed(TimeStretch &stretch, float speed){
+
+  if(speed < STRETCH_MIN_SPEED) speed = STRETCH_MIN_SPEED;
+  if(speed > STRETCH_MAX_SPEED) speed = STRETCH_MAX_SPEED;
+
+  stretch.pendingHop = (uint32_t)(speed * STRETCH_HOP + 0.5f);
+
+}
+
+float stretchGetSpeed(TimeStretch &stretch){
+
+  uint32_t hop = stretch.pendingHop.load();
+
+  return hop ? (float)hop / STRETCH_HOP : 1.0f;
+
+}
+
+// Drops input that no future frame can use.
+
+static void compact(TimeStretch &stretch){
+
+  uint32_t keep = stretch.position > STRETCH_SEARCH ? stretch.position - STRETCH_SEARCH : 0;
+
+  if(!stretch.first && stretch.next < keep) keep = stretch.next;
+
+  if(keep <= stretch.base) return;
+
+  uint32_t drop = keep - stretch.base;
+
+  if(drop > stretch.length) drop = stretch.length;
+
+  memmove(stretch.buffer, stretch.buffer + drop, (stretch.length - drop) * sizeof(int16_t));
+
+  stretch.base += drop;
+  stretch.length -= drop;
+
+}
+
+// Returns how many samples stretchPush() will accept.
+
+size_t stretchSpace(TimeStretch &stretch){
+
+  compact(stretch);
+
+  return STRETCH_BUFFER - stretch.length;
+
+}
+
+/*
+
+  stretchPush() - Adds input samples.
+
+  return - Samples accepted. Call stretchPull() until it returns 0 to make room.
+
+*/
+
+size_t stretchPush(TimeStretch &stretch, const int16_t *samples, size_t sampleCount){
+
+  size_t space = stretchSpace(stretch);
+
+  if(sampleCount > space) sampleCount = space;
+
+  memcpy(stretch.buffer + stretch.length, samples, sampleCount * sizeof(int16_t));
+
+  stretch.length += sampleCount;
+
+  return sampleCount;
+
+}
+
+/*
+
+  stretchPull() - Produces next output frame if enough input is buffered.
+
+  int16_t *out - Receives STRETCH_HOP samples.
+
+  return - STRETCH_HOP, or 0 if more input is needed.
+
+*/
+
+size_t stretchPull(TimeStretch &stretch, int16_t *out){
+
+  uint32_t end = stretch.position + STRETCH_SEARCH + STRETCH_FRAME;
+
+  if(stretch.base + stretch.length < end) return 0;
+
+  uint32_t startCycles = ESP.getCycleCount();
+
+  uint32_t start = stretch.position;
+
+  // Overlap of the frame stretchContinue() stands in for is the unstretched input, fading out.
+
+  if(stretch.continuing){
+
+    for(int i = 0; i < STRETCH_HOP; i++) stretch.overlap[i] = stretch.buffer[stretch.next - stretch.base + i] * window[i + STRETCH_HOP];
+
+    stretch.continuing = false;
+
+  }
+
+  if(!stretch.first){
+
+    // Search for frame start whose first half best matches the natural continuation of the last frame.
+
+    const int16_t *target = stretch.buffer + (stretch.next - stretch.base);
+
+    uint32_t low = stretch.position > stretch.base + STRETCH_SEARCH ? stretch.position - STRETCH_SEARCH : stretch.base;
+    uint32_t high = stretch.position + STRETCH_SEARCH;
+
+    int64_t best = INT64_MIN;
+
+    for(uint32_t candidate = low; candidate <= high; candidate += 2){
+
+      const int16_t *source = stretch.buffer + (candidate - stretch.base);
+      int64_t sum = 0;
+
+      for(int i = 0; i < STRETCH_HOP; i += STRETCH_DECIMATE) sum += (int32_t)target[i] * source[i];
+
+      if(sum > best){
+
+        best = sum;
+        start = candidate;
+
+      }
+
+    }
+
+  }
+
+  const int16_t *frame = stretch.buffer + (start - stretch.base);
+
+  for(int i = 0; i < STRETCH_HOP; i++){
+
+    int32_t v = (stretch.overlap[i] + frame[i] * window[i]) >> 15;
+
+    if(v > 32767) v = 32767;
+    if(v < -32768) v = -32768;
+
+    out[i] = v;
+
+    stretch.overlap[i] = frame[i + STRETCH_HOP] * window[i + STRETCH_HOP];
+
+  }
+
+  stretch.next = start + STRETCH_HOP;
+  stretch.first = false;
+
+  // Speed changes apply between frames.
+
+  stretch.hop = stretch.pendingHop;
+  stretch.position += stretch.hop;
+  stretch.sourceSamples += stretch.hop;
+
+  stretch.frames++;
+  stretch.cycles += ESP.getCycleCount() - startCycles;
+
+  return STRETCH_HOP;
+
+}
+
+/*
+
+  stretchDrain() - Takes held input back out unstretched, for switching stretching off. Window halves add to
+  exactly 1.0, so the last frame's overlap added to input from stretch.next on is that input itself, and it can
+  follow the last frame without a crossfade. Call until it returns 0, then read input directly. Pulling frames
+  again after a partial drain carries on like stretchContinue().
+
+  int16_t *out - Receives up to maxSamples samples.
+
+  return - Samples copied, 0 once nothing is held.
+
+*/
+
+size_t stretchDrain(TimeStretch &stretch, int16_t *out, size_t maxSamples){
+
+  uint32_t held = stretch.base + stretch.length - stretch.next;
+
+  if(maxSamples > held) maxSamples = held;
+
+  memcpy(out, stretch.buffer + (stretch.next - stretch.base), maxSamples * sizeof(int16_t));
+
+  stretch.next += maxSamples;
+  stretch.sourceSamples += maxSamples;
+
+  continueFromNext(stretch);
+  compact(stretch);
+
+  return maxSamples;
+
+}
+
+/*
+
+  stretchFinish() - Pads input with silence and produces the next frame, for the end of input. Call after the last
+  stretchPush() until it returns 0.
+
+  int16_t *out - Receives STRETCH_HOP samples.
+
+  return - STRETCH_HOP, or 0 once output covers all input.
+
+*/
+
+size_t stretchFinish(TimeStretch &stretch, int16_t *out){
+
+  static const int16_t silence[STRETCH_HOP] = {0};
+
+  if(!stretch.ending){
+
+    stretch.ending = true;
+    stretch.end = stretch.base + stretch.length;
+
+  }
+
+  // Output covers input up to next, and only the last frame's second half, starting at next, is still in overlap.
+
+  if(stretch.first ? stretch.length == 0 : stretch.next >= stretch.end) return 0;
+
+  size_t n;
+
+  while((n = stretchPull(stretch, out)) == 0) stretchPush(stretch, silence, STRETCH_HOP);
+
+  return n;
+
+}
+
+/*
+
+  stretchNext() - Produces the next block of playback at the current speed. At 1.0x the track is read directly, once
+  input held by the stretcher has been drained. At other speeds the stretcher is fed from the track until a frame is
+  ready, and padded out at the end of the track.
+
+  const StretchReader &reader - Track input.
+  int16_t *frame - Receives stretched and drained output, STRETCH_HOP samples.
+  const int16_t **samples - Set to the block, in frame or in the reader's buffer.
+  uint32_t &sourceCount - Set to the track samples the block covers, which differs from its length when stretching.
+
+  return - Samples in the block, 0 at the end of the track.
+
+*/
+
+size_t stretchNext(TimeStretch &stretch, const StretchReader &reader, int16_t *frame, const int16_t **samples, uint32_t &sourceCount){
+
+  float speed = stretchGetSpeed(stretch);
+  size_t sampleCount = 0;
+
+  *samples = frame;
+  sourceCount = 0;
+
+  // Input the stretcher holds goes out unstretched before the track is read directly again.
+
+  if(speed == 1.0f && stretch.active){
+
+    sampleCount = stretchDrain(stretch, frame, STRETCH_HOP);
+    sourceCount = sampleCount;
+
+    stretch.active = sampleCount > 0;
+
+  }
+
+  if(speed == 1.0f && !stretch.active){
+
+    uint8_t *data;
+
+    sampleCount = reader.next(reader.context, &data, reader.blockBytes) / sizeof(int16_t);
+    sourceCount = sampleCount;
+
+    *samples = (const int16_t *)data;
+
+  }
+
+  else if(speed != 1.0f){
+
+    // Carries on from the last unstretched block, see stretchContinue().
+
+    if(!stretch.active){
+
+      stretchContinue(stretch);
+
+      stretch.active = true;
+
+    }
+
+    uint32_t sourceBefore = stretch.sourceSamples;
+
+    // Feed stretcher until it has a frame ready.
+
+    while((sampleCount = stretchPull(stretch, frame)) == 0){
+
+      uint8_t *data;
+      size_t space = stretchSpace(stretch) * sizeof(int16_t);
+      size_t n = reader.next(reader.context, &data, space < reader.blockBytes ? space : reader.blockBytes);
+
+      // End of track. The last frames are padded out with silence, then stretching is done.
+
+      if(n == 0){
+
+        sampleCount = stretchFinish(stretch, frame);
+
+        stretch.active = sampleCount > 0;
+
+        break;
+
+      }
+
+      stretchPush(stretch, (const int16_t *)data, n / sizeof(int16_t));
+
+    }
+
+    sourceCount = stretch.sourceSamples - sourceBefore;
+
+  }
+
+  return sampleCount;
+
+}
+
+/*
+
+  benchmarkTimeStretch() - Stretches a synthetic voice-like signal at several speeds and prints cycles per output
+  sample to serial monitor. Real time at 44.1kHz needs less than CPU MHz * 1000000 / 44100 cycles per sample.
+
+*/
+
+void benchmarkTimeStretch(){
+
+  static TimeStretch stretch;
+  static int16_t input[STRETCH_HOP];
+  int16_t output[STRETCH_HOP];
+
+  const float speeds[] = {0.5f, 0.75f, 1.0f, 1.25f, 1.5f, 2.0f};
+  uint32_t phase = 0;
+
+  for(float speed : speeds){
+
+    stretchSetSpeed(stretch, speed);
+    stretchReset(stretch);
+
+    stretch.frames = 0;
+    stretch.cycles = 0;
+
+    uint32_t produced = 0;
+
+    while(produced < 44100 * 2){
+
+      for(int i = 0; i < STRETCH_HOP; i++, phase++){
+
+        float t = phase / 44100.0f;
+
+        input[i] = (int16_t)(8000 * sinf(2 * M_PI * 140 * t) + 4000 * sinf(2 * M_PI * 280 * t) + 2000 * sinf(2 * M_PI * 1100 * t));
+
+      }
+
+      stretchPush(stretch, input, STRETCH_HOP);
+
+      while(stretchPull(stretch, output)) produced += STRETCH_HOP;
+
+    }
+
+    Serial.printf("Time stretch %.2fx: %.1f cycles/sample over %u frames.\n", speed, stretch.frames ? (double)stretch.cycles / (stretch.frames * STRETCH_HOP) : 0.0, stretch.frames);
+
+  }
+
+}
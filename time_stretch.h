@@ -0,0 +1,92 @@
+#ifndef _TIME_STRETCH_H
+#define _TIME_STRETCH_H
+
+/*
+
+  Fixed point WSOLA time stretching, for 0.5x - 2x playback without changing pitch.
+
+  Input is pushed in with stretchPush() and output is pulled a frame at a time with stretchPull(). Each output
+  frame is STRETCH_FRAME samples of input, Hann windowed and overlap-added at STRETCH_HOP intervals. The
+  nominal input position moves by speed * STRETCH_HOP per frame. The actual frame start is searched within
+  STRETCH_SEARCH samples of it, for the best cross-correlation with the natural continuation of the last frame,
+  so waveforms line up and pitch is kept.
+
+  Speed changes set with stretchSetSpeed() take effect at the next frame. sourceSamples counts input samples
+  advanced, so callers can show track position in source time.
+
+  Callers bypass the stretcher at 1.0x. Switching over loses nothing: stretchContinue() starts stretching with
+  a frame that crossfades from the unstretched audio before it, and stretchDrain() hands back held input from
+  where the last frame's overlap ends, which joins it exactly. At the end of input, stretchFinish() pads with
+  silence until the last input sample has been output.
+
+  stretchNext() does all of this for a player. It reads a track through a StretchReader and returns the next block
+  to output, read directly at 1.0x and stretched otherwise. active stays true after a switch to 1.0x until held
+  input is drained, and at the end of a track until its last frame is out.
+
+  Correlation is computed on every STRETCH_DECIMATE'th sample and every second candidate to keep cost low.
+
+*/
+
+#include <Arduino.h>
+#include <atomic>
+
+#define STRETCH_FRAME 1024
+#define STRETCH_HOP (STRETCH_FRAME / 2)
+#define STRETCH_SEARCH 256
+#define STRETCH_DECIMATE 4
+#define STRETCH_BUFFER 4096
+
+#define STRETCH_MIN_SPEED 0.5f
+#define STRETCH_MAX_SPEED 2.0f
+
+struct TimeStretch {
+
+  int16_t buffer[STRETCH_BUFFER];
+  uint32_t base;
+  uint32_t length;
+
+  int32_t overlap[STRETCH_HOP];
+
+  uint32_t position;
+  uint32_t next;
+  bool first;
+  bool continuing;
+
+  bool ending;
+  uint32_t end;
+
+  std::atomic<uint32_t> pendingHop;
+  uint32_t hop;
+
+  uint32_t sourceSamples;
+  uint32_t frames;
+  uint64_t cycles;
+
+  bool active;
+
+};
+
+// Track input for stretchNext(). next() hands out up to maxBytes of 16 bit mono samples, like editPlayerNext(), and
+// returns 0 at the end of the track. blockBytes is the most read for a block at 1.0x.
+
+struct StretchReader {
+
+  size_t (*next)(void *context, uint8_t **data, size_t maxBytes);
+  void *context;
+  size_t blockBytes;
+
+};
+
+void stretchReset(TimeStretch &stretch);
+void stretchContinue(TimeStretch &stretch);
+void stretchSetSpeed(TimeStretch &stretch, float speed);
+float stretchGetSpeed(TimeStretch &stretch);
+size_t stretchSpace(TimeStretch &stretch);
+size_t stretchPush(TimeStretch &stretch, const int16_t *samples, size_t sampleCount);
+size_t stretchPull(TimeStretch &stretch, int16_t *out);
+size_t stretchDrain(TimeStretch &stretch, int16_t *out, size_t maxSamples);
+size_t stretchFinish(TimeStretch &stretch, int16_t *out);
+size_t stretchNext(TimeStretch &stretch, const StretchReader &reader, int16_t *frame, const int16_t **samples, uint32_t &sourceCount);
+void benchmarkTimeStretch();
+
+#endif
@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+"""
+Sends files to the ESP32 audio player's SD card over serial. Protocol is described in serial_transfer.h.
+
+  python3 tools/send_wav.py /dev/ttyUSB0 song.wav other.wav --dest /music
+  python3 tools/send_wav.py /dev/ttyUSB0 song.wav --baud-list 115200,460800,921600
+
+Interrupted transfers resume where they stopped when the same file is sent again. Debug prints from the device
+are passed through to stdout. --baud-list sends the file once per rate and prints effective throughput for each.
+
+Needs pyserial.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+SYNC = b"\xa5\x5a"
+
+XFER_OPEN, XFER_DATA, XFER_END, XFER_ABORT, XFER_BAUD, XFER_ACK = 1, 2, 3, 4, 5, 0x80
+XFER_OK, XFER_RESEND, XFER_FAILED = 0, 1, 2
+
+MAX_DATA = 1024
+
+
+def frame(kind, seq, payload):
+    body = struct.pack("<BHH", kind, seq & 0xFFFF, len(payload)) + payload
+    return SYNC + body + struct.pack("<I", zlib.crc32(body))
+
+
+class Link:
+
+    def __init__(self, port):
+        self.port = port
+        self.rx = bytearray()
+        self.seq = 0
+
+    def send(self, kind, payload):
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.port.write(frame(kind, self.seq, payload))
+        return self.seq
+
+    def echo(self, text):
+        if text:
+            sys.stdout.write(text.decode("ascii", errors="replace"))
+            sys.stdout.flush()
+
+    def ack(self, timeout):
+        """Returns (seq, status, offset) of the next ack, or None on timeout. Text before it is echoed."""
+        deadline = time.monotonic() + timeout
+        while True:
+            start = self.rx.find(SYNC)
+            if start < 0:
+                # Keep a trailing first sync byte, it may be the start of a frame.
+                keep = 1 if self.rx.endswith(SYNC[:1]) else 0
+                self.echo(bytes(self.rx[:len(self.rx) - keep]))
+                del self.rx[:len(self.rx) - keep]
+            elif len(self.rx) >= start + 7:
+                kind, seq, length = struct.unpack_from("<BHH", self.rx, start + 2)
+                end = start + 7 + length + 4
+                if length > MAX_DATA + 4:
+                    self.echo(bytes(self.rx[:start + 1]))
+                    del self.rx[:start + 1]
+                    continue
+                if len(self.rx) >= end:
+                    body = bytes(self.rx[start + 2:start + 7 + length])
+                    (crc,) = struct.unpack_from("<I", self.rx, start + 7 + length)
+                    self.echo(bytes(self.rx[:start]))
+                    del self.rx[:end]
+                    if kind == XFER_ACK and length == 5 and zlib.crc32(body) == crc:
+                        status, offset = struct.unpack_from("<BI", body, 5)
+                        return seq, status, offset
+                    continue
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            self.port.timeout = min(remaining, 0.05)
+            self.rx += self.port.read(max(self.port.in_waiting, 1))
+
+    def request(self, kind, payload, timeout=2.0, retries=5):
+        """Sends a control frame and waits for the ack carrying its seq."""
+        for _ in range(retries):
+            seq = self.send(kind, payload)
+            deadline = time.monotonic() + timeout
+            while True:
+                reply = self.ack(max(deadline - time.monotonic(), 0))
+                if reply is None:
+                    break
+                if reply[0] == seq:
+                    return reply[1], reply[2]
+        raise IOError("no reply from device")
+
+
+def send_file(link, path, dest, window, baud):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    size = len(data)
+    status, offset = link.request(XFER_OPEN, struct.pack("<I", size) + dest.encode())
+
+    if status != XFER_OK:
+        raise IOError("device refused %s" % dest)
+
+    start = time.monotonic()
+    resumed = offset
+    base = offset
+    sent = offset
+
+    # Go-back-N: keep window frames in flight, restart from the device's offset on a resend request or timeout.
+    # A lost last frame gets no resend request, so the timeout is a few windows of line time, not seconds.
+
+    ack_timeout = max(0.2, 4 * window * (MAX_DATA + 15) * 10 / baud)
+
+    while base < size:
+        while sent < size and sent - base < window * MAX_DATA:
+            chunk = data[sent:sent + MAX_DATA]
+            link.send(XFER_DATA, struct.pack("<I", sent) + chunk)
+            sent += len(chunk)
+
+        reply = link.ack(ack_timeout)
+
+        if reply is None:
+            sent = base
+            continue
+
+        _, status, offset = reply
+
+        if status == XFER_FAILED:
+            raise IOError("device failed at offset %d" % offset)
+
+        if status == XFER_RESEND:
+            sent = offset
+
+        base = max(base, offset) if status == XFER_OK else offset
+
+    status, offset = link.request(XFER_END, struct.pack("<I", zlib.crc32(data)), timeout=10.0)
+
+    if status != XFER_OK:
+        raise IOError("device rejected %s at offset %d" % (dest, offset))
+
+    elapsed = time.monotonic() - start
+    rate = (size - resumed) / elapsed if elapsed > 0 else 0
+
+    print("%s -> %s: %d bytes (resumed at %d), %.1f KB/s, %.0f%% of %d baud" %
+          (path, dest, size - resumed, resumed, rate / 1024, 100 * rate / (baud / 10), baud))
+
+    return rate
+
+
+def set_baud(link, baud):
+    status, _ = link.request(XFER_BAUD, struct.pack("<I", baud))
+
+    if status != XFER_OK:
+        raise IOError("device refused %d baud" % baud)
+
+    time.sleep(0.05)
+    link.port.baudrate = baud
+    link.rx.clear()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Send files to the ESP32 audio player over serial.")
+    parser.add_argument("port")
+    parser.add_argument("files", nargs="+")
+    parser.add_argument("--dest", default="/", help="directory on the SD card")
+    parser.add_argument("--baud", type=int, default=115200, help="rate the device is running at")
+    parser.add_argument("--baud-list", help="comma separated rates to measure throughput at")
+    parser.add_argument("--window", type=int, default=8, help="data frames in flight")
+    args = parser.parse_args()
+
+    port = serial.Serial(args.port, args.baud, timeout=0.05)
+    link = Link(port)
+    rates = [int(b) for b in args.baud_list.split(",")] if args.baud_list else [args.baud]
+    results = []
+
+    try:
+        for baud in rates:
+            if baud != port.baudrate:
+                set_baud(link, baud)
+
+            for path in args.files:
+                dest = args.dest.rstrip("/") + "/" + os.path.basename(path)
+                results.append((baud, send_file(link, path, dest, args.window, baud)))
+
+        if len(rates) > 1:
+            print("\nbaud      KB/s   efficiency")
+            for baud, rate in results:
+                print("%-9d %6.1f %5.0f%%" % (baud, rate / 1024, 100 * rate / (baud / 10)))
+
+    finally:
+        if port.baudrate != args.baud:
+            set_baud(link, args.baud)
+        port.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""
+Packs WAV files for the ESP32 audio player so sample data starts on a sector boundary. A JUNK chunk is inserted in
+front of the data chunk, the same layout createMonoWAVFile() writes after setMonoWAVAlignment(). Run it on the card's
+mount point to convert a library in place, one pass per file, or with --out to write packed copies.
+
+  python3 tools/wav_align.py /media/sdcard
+  python3 tools/wav_align.py music/ --out packed/ --align 32768
+  python3 tools/wav_align.py /media/sdcard --check
+  python3 tools/wav_align.py --bench /media/sdcard/song.wav
+
+Files that are already aligned are skipped, so running it again only touches new files. --bench copies one file with
+the plain 44 byte header and with aligned data, and prints read speed of the data chunk for both.
+
+In place conversion rewrites the file, so do not pull the card while it runs.
+"""
+
+import argparse
+import os
+import shutil
+import struct
+import sys
+import time
+
+SECTOR_SIZE = 512
+COPY_BLOCK = 64 * 1024
+READ_BLOCK = 32 * 1024
+
+
+def find_data(f):
+    """Returns file offset of the first sample, or None if f is not a WAV file with a data chunk."""
+    f.seek(0)
+    head = f.read(12)
+    if len(head) < 12 or head[:4] != b"RIFF" or head[8:12] != b"WAVE":
+        return None
+    position = 12
+    while True:
+        f.seek(position)
+        chunk = f.read(8)
+        if len(chunk) < 8:
+            return None
+        ident, size = struct.unpack("<4sI", chunk)
+        position += 8
+        if ident == b"data":
+            return position
+        # Chunks are padded to even length.
+        position += size + (size & 1)
+
+
+def junk_padding(chunk_start, align):
+    """Returns JUNK payload size that moves a data chunk header at chunk_start onto an align boundary."""
+    data_offset = chunk_start + 8 + 8
+    data_offset = (data_offset + align - 1) & ~(align - 1)
+    return data_offset - chunk_start - 8 - 8
+
+
+def junk_chunk(size):
+    return b"JUNK" + struct.pack("<I", size) + bytes(size)
+
+
+def align_in_place(path, align):
+    """Moves everything from the data chunk on up by a JUNK chunk, working back from the end of the file.
+    Returns (old, new) data offsets, or None if path is not a WAV file."""
+    with open(path, "r+b") as f:
+        offset = find_data(f)
+        if offset is None:
+            return None
+        if offset % align == 0:
+            return offset, offset
+        chunk_start = offset - 8
+        junk = junk_padding(chunk_start, align)
+        shift = 8 + junk
+        size = f.seek(0, os.SEEK_END)
+        end = size
+        while end > chunk_start:
+            # Cut so every write after the first ends on a block boundary of the new layout.
+            n = (end + shift) % COPY_BLOCK or COPY_BLOCK
+            n = min(n, end - chunk_start)
+            end -= n
+            f.seek(end)
+            block = f.read(n)
+            f.seek(end + shift)
+            f.write(block)
+        f.seek(chunk_start)
+        f.write(junk_chunk(junk))
+        f.seek(4)
+        f.write(struct.pack("<I", size + shift - 8))
+    return offset, offset + shift
+
+
+def align_copy(path, out, align):
+    """Writes an aligned copy of path to out, or a plain 44 byte layout if align is 0. Returns (old, new) offsets."""
+    with open(path, "rb") as f:
+        offset = find_data(f)
+        if offset is None:
+            return None
+        chunk_start = offset - 8
+        f.seek(0)
+        head = bytearray(f.read(chunk_start))
+        if align == 0:
+            # Only RIFF and fmt chunks are kept, so data lands at 44 for a 16 byte fmt chunk.
+            fmt = head.find(b"fmt ")
+            (fmt_size,) = struct.unpack_from("<I", head, fmt + 4)
+            head = head[:12] + head[fmt:fmt + 8 + fmt_size]
+            pad = b""
+        else:
+            pad = b"" if offset % align == 0 else junk_chunk(junk_padding(len(head), align))
+        f.seek(0, os.SEEK_END)
+        tail = f.tell() - chunk_start
+        struct.pack_into("<I", head, 4, len(head) + len(pad) + tail - 8)
+        f.seek(chunk_start)
+        with open(out, "wb") as o:
+            o.write(head)
+            o.write(pad)
+            shutil.copyfileobj(f, o, COPY_BLOCK)
+    return offset, len(head) + len(pad) + 8
+
+
+def wav_files(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for root, dirs, files in os.walk(path):
+                dirs.sort()
+                for name in sorted(files):
+                    if name.lower().endswith(".wav") and not name.startswith("."):
+                        yield os.path.join(root, name)
+        else:
+            yield path
+
+
+def read_speed(path):
+    """Reads the data chunk in READ_BLOCK reads from the data offset, with the file dropped from the page cache
+    first. Returns MB/s."""
+    with open(path, "rb") as f:
+        offset = find_data(f)
+        os.fsync(f.fileno())
+        os.posix_fadvise(f.fileno(), 0, 0, os.POSIX_FADV_DONTNEED)
+        f.seek(offset)
+        total = 0
+        start = time.perf_counter()
+        while True:
+            block = f.read(READ_BLOCK)
+            if not block:
+                break
+            total += len(block)
+        seconds = time.perf_counter() - start
+    return total / seconds / 1e6, offset
+
+
+def bench(path, align, runs):
+    base = os.path.join(os.path.dirname(os.path.abspath(path)), ".align_bench")
+    copies = [(base + "_44.wav", 0), (base + "_aligned.wav", align)]
+    try:
+        for copy, a in copies:
+            align_copy(path, copy, a)
+        results = {}
+        for _ in range(runs):
+            for copy, a in copies:
+                speed, offset = read_speed(copy)
+                results.setdefault(offset, []).append(speed)
+        for offset, speeds in results.items():
+            speeds.sort()
+            print("data at %6d: median %.1f MB/s, best %.1f MB/s over %d runs" % (offset, speeds[len(speeds) // 2], speeds[-1], len(speeds)))
+    finally:
+        for copy, _ in copies:
+            if os.path.exists(copy):
+                os.remove(copy)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Align WAV data chunks to sector boundaries for the ESP32 audio player.")
+    parser.add_argument("paths", nargs="*", help="files or directories, searched recursively")
+    parser.add_argument("--align", type=int, default=SECTOR_SIZE, help="alignment in bytes, a power of two")
+    parser.add_argument("--out", help="write packed copies to this directory instead of converting in place")
+    parser.add_argument("--check", action="store_true", help="only list files that are not aligned")
+    parser.add_argument("--bench", metavar="WAV", help="compare read speed of plain and aligned copies of a file")
+    parser.add_argument("--runs", type=int, default=5, help="runs per layout for --bench")
+    args = parser.parse_args()
+
+    if args.align <= 0 or args.align & (args.align - 1):
+        parser.error("--align must be a power of two")
+
+    if args.bench:
+        bench(args.bench, args.align, args.runs)
+        return 0
+
+    if not args.paths:
+        parser.error("no files given")
+
+    converted = skipped = failed = 0
+    for path in wav_files(args.paths):
+        try:
+            if args.check:
+                with open(path, "rb") as f:
+                    offset = find_data(f)
+                if offset is not None and offset % args.align:
+                    print("%s: data at %d" % (path, offset))
+                    converted += 1
+                continue
+            if args.out:
+                rel = os.path.relpath(path, args.paths[0]) if os.path.isdir(args.paths[0]) else os.path.basename(path)
+                out = os.path.join(args.out, rel)
+                os.makedirs(os.path.dirname(out) or ".", exist_ok=True)
+                result = align_copy(path, out, args.align)
+            else:
+                result = align_in_place(path, args.align)
+        except OSError as e:
+            print("%s: %s" % (path, e), file=sys.stderr)
+            failed += 1
+            continue
+        if result is None:
+            print("%s: not a WAV file, skipped" % path, file=sys.stderr)
+            failed += 1
+        elif result[0] == result[1] and not args.out:
+            skipped += 1
+        else:
+            print("%s: data moved from %d to %d" % (path, result[0], result[1]))
+            converted += 1
+
+    if args.check:
+        print("%d files not aligned to %d bytes" % (converted, args.align))
+    else:
+        print("%d converted, %d already aligned, %d failed" % (converted, skipped, failed))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
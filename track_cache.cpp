@@ -0,0 +1,591 @@
+#include "track_cache.h"
+#include "sample_format.h"
+#include "audio_arena.h"
+#include "esp_heap_caps.h"
+
+// Cached range of one track. Samples from start to start + filled are loaded, in blocks listed in order. A stale entry
+// was invalidated while pinned, and is freed on its last release.
+
+struct CacheEntry {
+
+  bool used;
+  bool stale;
+  uint64_t key;
+  uint32_t start;
+  uint32_t end;
+  uint32_t filled;
+  uint32_t lastUse;
+  uint8_t pins;
+  uint8_t blockCount;
+  uint8_t blocks[TRACK_CACHE_MAX_BLOCKS];
+
+};
+
+struct CacheRequest {
+
+  char path[128];
+  uint32_t start;
+  uint32_t end;
+
+};
+
+static int16_t *pool = NULL;
+static uint32_t blockCount = 0;
+static bool blockUsed[TRACK_CACHE_MAX_BLOCKS];
+static CacheEntry entries[TRACK_CACHE_ENTRIES];
+static uint32_t useClock = 0;
+
+static CacheRequest queue[TRACK_CACHE_QUEUE];
+static int queueCount = 0;
+
+// Entry being filled by trackCacheService(), and its reader. Never evicted while loading.
+
+static int loading = -1;
+static BlockReader loader;
+static uint8_t *loaderBuffer = NULL;
+static SampleFormat loaderFormat;
+
+// Entries and blocks are shared between loop() and audioTask. Loading from the card happens outside the lock.
+
+static SemaphoreHandle_t cacheMutex = NULL;
+
+static uint32_t lookups = 0;
+static uint32_t hits = 0;
+static uint32_t evictions = 0;
+static uint32_t loadedSamples = 0;
+static uint64_t servedSamples = 0;
+
+// FNV-1a hash of path. Entries are keyed by hash only, 64 bits make collisions within a library negligible.
+
+static uint64_t pathKey(const char * path){
+
+  uint64_t hash = 14695981039346656037ULL;
+
+  while(*path){
+
+    hash ^= (uint8_t)*path++;
+    hash *= 1099511628211ULL;
+
+  }
+
+  return hash;
+
+}
+
+static void freeEntry(CacheEntry &entry){
+
+  for(int i = 0; i < entry.blockCount; i++) blockUsed[entry.blocks[i]] = false;
+
+  entry.used = false;
+  entry.blockCount = 0;
+
+}
+
+// Frees least recently used entry that is not pinned or loading. Must hold cacheMutex. Returns false if none.
+
+static bool evictOldest(){
+
+  int oldest = -1;
+
+  for(int i = 0; i < TRACK_CACHE_ENTRIES; i++){
+
+    if(!entries[i].used || entries[i].pins || i == loading) continue;
+
+    if(oldest < 0 || entries[i].lastUse < entries[oldest].lastUse) oldest = i;
+
+  }
+
+  if(oldest < 0) return false;
+
+  freeEntry(entries[oldest]);
+  evictions++;
+
+  return true;
+
+}
+
+// Returns a free block, evicting entries as needed. Must hold cacheMutex. Returns -1 if every block is pinned.
+
+static int allocateBlock(){
+
+  do{
+
+    for(uint32_t i = 0; i < blockCount; i++){
+
+      if(!blockUsed[i]){
+
+        blockUsed[i] = true;
+
+        return i;
+
+      }
+
+    }
+
+  } while(evictOldest());
+
+  return -1;
+
+}
+
+/*
+
+  trackCacheInit() - Allocates cache memory. Call once from setup(), before arenaSeal().
+
+  size_t bytes - Cache size, rounded down to whole blocks. Limited to TRACK_CACHE_BYTES.
+
+  return - false if no memory could be allocated. Playback still works, always reading from the card.
+
+*/
+
+bool trackCacheInit(size_t bytes){
+
+  if(bytes > TRACK_CACHE_BYTES) bytes = TRACK_CACHE_BYTES;
+
+  pool = (int16_t *)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+
+  if(!pool){
+
+    bytes = TRACK_CACHE_FALLBACK_BYTES;
+    pool = (int16_t *)heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+
+  }
+
+  // Loader buffer is only taken once there is a pool, since arena buffers can not be given back.
+
+  if(pool && !cacheMutex) cacheMutex = xSemaphoreCreateMutex();
+  if(pool && cacheMutex) loaderBuffer = (uint8_t *)arenaAlloc(READ_BUFFER_BYTES(TRACK_CACHE_READ_BLOCK), "Track cache loader");
+
+  if(!pool || !cacheMutex || !loaderBuffer){
+
+    Serial.println("Track cache could not be allocated.");
+
+    heap_caps_free(pool);
+
+    pool = NULL;
+    blockCount = 0;
+
+    return false;
+
+  }
+
+  blockCount = bytes / (TRACK_CACHE_BLOCK_SAMPLES * sizeof(int16_t));
+
+  for(uint32_t i = 0; i < blockCount; i++) blockUsed[i] = false;
+  for(int i = 0; i < TRACK_CACHE_ENTRIES; i++) entries[i].used = false;
+
+  Serial.printf("Track cache: %u blocks, %u KB.\n", blockCount, blockCount * TRACK_CACHE_BLOCK_SAMPLES * 2 / 1024);
+
+  return true;
+
+}
+
+/*
+
+  trackCacheRequest() - Queues a range of a track for loading. Ranges already cached are only marked as recently used.
+
+  const char * path - Track. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+  uint32_t start - First sample.
+  uint32_t end - Sample after last sample. Clamped to track length, 0 means end of track.
+
+*/
+
+void trackCacheRequest(const char * path, uint32_t start, uint32_t end){
+
+  if(!blockCount || strlen(path) >= sizeof(queue[0].path)) return;
+
+  uint64_t key = pathKey(path);
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  for(int i = 0; i < TRACK_CACHE_ENTRIES; i++){
+
+    CacheEntry &entry = entries[i];
+
+    if(entry.used && !entry.stale && entry.key == key && entry.start == start && (end == 0 || entry.end >= end)){
+
+      entry.lastUse = ++useClock;
+
+      xSemaphoreGive(cacheMutex);
+
+      return;
+
+    }
+
+  }
+
+  xSemaphoreGive(cacheMutex);
+
+  for(int i = 0; i < queueCount; i++){
+
+    if(queue[i].start == start && queue[i].end == end && strcmp(queue[i].path, path) == 0) return;
+
+  }
+
+  // Newest requests matter most, so a full queue drops its oldest entry that is not being loaded.
+
+  if(queueCount == TRACK_CACHE_QUEUE){
+
+    int first = loading >= 0 ? 1 : 0;
+
+    memmove(&queue[first], &queue[first + 1], (TRACK_CACHE_QUEUE - first - 1) * sizeof(CacheRequest));
+    queueCount--;
+
+  }
+
+  CacheRequest &request = queue[queueCount++];
+
+  strcpy(request.path, path);
+  request.start = start;
+  request.end = end;
+
+}
+
+// Ends load of first queued request and removes it from the queue.
+
+static void finishLoad(){
+
+  if(loading >= 0) blockReaderClose(loader);
+
+  loading = -1;
+
+  memmove(&queue[0], &queue[1], (queueCount - 1) * sizeof(CacheRequest));
+  queueCount--;
+
+}
+
+// Opens first queued request and gives it an entry. Returns false if request was dropped.
+
+static bool startLoad(fs::FS &fs){
+
+  CacheRequest &request = queue[0];
+
+  MonoWAVHeader header;
+  uint32_t dataOffset;
+
+  if(!readMonoWAVHeader(fs, request.path, header, dataOffset) || !selectSampleFormat(header, loaderFormat)) return false;
+
+  uint32_t samples = monoWAVSamples(header);
+
+  if(request.end == 0 || request.end > samples) request.end = samples;
+
+  if(request.start >= request.end) return false;
+
+  uint32_t bytesPerSample = loaderFormat.bytesPerSample;
+
+  if(!blockReaderOpen(loader, fs, request.path, dataOffset + request.start * bytesPerSample, loaderBuffer, READ_BUFFER_BYTES(TRACK_CACHE_READ_BLOCK))) return false;
+
+  blockReaderSetEnd(loader, dataOffset + request.end * bytesPerSample);
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  int free = -1;
+
+  for(int i = 0; i < TRACK_CACHE_ENTRIES && free < 0; i++) if(!entries[i].used) free = i;
+
+  if(free < 0 && evictOldest()){
+
+    for(int i = 0; i < TRACK_CACHE_ENTRIES && free < 0; i++) if(!entries[i].used) free = i;
+
+  }
+
+  if(free >= 0){
+
+    CacheEntry &entry = entries[free];
+
+    entry.used = true;
+    entry.stale = false;
+    entry.key = pathKey(request.path);
+    entry.start = request.start;
+    entry.end = request.end;
+    entry.filled = 0;
+    entry.lastUse = ++useClock;
+    entry.pins = 0;
+    entry.blockCount = 0;
+
+    loading = free;
+
+  }
+
+  xSemaphoreGive(cacheMutex);
+
+  if(free < 0){
+
+    blockReaderClose(loader);
+
+    return false;
+
+  }
+
+  return true;
+
+}
+
+/*
+
+  trackCacheService() - Loads up to one block of the oldest queued request. Call regularly from loop().
+
+  fs::FS &fs - File system. Since we are using on-board SD card using SD_MMC.h, it should always be SD_MMC.
+
+  return - true if work was done, false if queue is empty.
+
+*/
+
+bool trackCacheService(fs::FS &fs){
+
+  if(queueCount == 0) return false;
+
+  if(loading < 0 && !startLoad(fs)){
+
+    finishLoad();
+
+    return true;
+
+  }
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  int block = allocateBlock();
+
+  xSemaphoreGive(cacheMutex);
+
+  // Cache full of pinned entries, keep what was loaded.
+
+  if(block < 0){
+
+    finishLoad();
+
+    return true;
+
+  }
+
+  CacheEntry &entry = entries[loading];
+  int16_t *out = pool + block * TRACK_CACHE_BLOCK_SAMPLES;
+  uint32_t want = entry.end - entry.start - entry.filled;
+  uint32_t count = 0;
+
+  if(want > TRACK_CACHE_BLOCK_SAMPLES) want = TRACK_CACHE_BLOCK_SAMPLES;
+
+  while(count < want){
+
+    uint32_t bytesPerSample = loaderFormat.bytesPerSample;
+    uint8_t *data;
+    size_t n = blockReaderNext(loader, &data, (want - count) * bytesPerSample, bytesPerSample);
+
+    if(n == 0) break;
+
+    n /= bytesPerSample;
+
+    if(loaderFormat.convert) loaderFormat.convert(data, out + count, n);
+    else memcpy(out + count, data, n * sizeof(int16_t));
+
+    count += n;
+
+  }
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  if(count > 0){
+
+    entry.blocks[entry.blockCount++] = block;
+    entry.filled += count;
+
+  }
+
+  else blockUsed[block] = false;
+
+  xSemaphoreGive(cacheMutex);
+
+  loadedSamples += count;
+
+  if(count < want || entry.filled >= entry.end - entry.start){
+
+    if(count < want) entry.end = entry.start + entry.filled;
+
+    finishLoad();
+
+  }
+
+  return true;
+
+}
+
+/*
+
+  trackCacheAcquire() - Looks up a cached range containing sample, and pins it so it is not evicted while in use.
+  Every call counts as a cache lookup in trackCacheReport().
+
+  const char * path - Track.
+  uint32_t sample - Sample that must be loaded.
+
+  return - Entry to pass to trackCacheRead() and trackCacheRelease(). -1 on a miss.
+
+*/
+
+int trackCacheAcquire(const char * path, uint32_t sample){
+
+  if(!blockCount) return -1;
+
+  uint64_t key = pathKey(path);
+  int found = -1;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  for(int i = 0; i < TRACK_CACHE_ENTRIES && found < 0; i++){
+
+    CacheEntry &entry = entries[i];
+
+    if(entry.used && !entry.stale && entry.key == key && sample >= entry.start && sample < entry.start + entry.filled) found = i;
+
+  }
+
+  lookups++;
+
+  if(found >= 0){
+
+    entries[found].pins++;
+    entries[found].lastUse = ++useClock;
+    hits++;
+
+  }
+
+  xSemaphoreGive(cacheMutex);
+
+  return found;
+
+}
+
+/*
+
+  trackCacheRead() - Returns a view of cached samples. Views never cross blocks, so may be shorter than asked.
+
+  int entry - Entry from trackCacheAcquire().
+  uint32_t sample - First sample, as a sample number in the track.
+  const int16_t **data - Set to start of view. Valid until entry is released.
+  size_t maxSamples - Maximum size of view.
+
+  return - Number of samples in view. 0 if sample is not loaded.
+
+*/
+
+size_t trackCacheRead(int entry, uint32_t sample, const int16_t **data, size_t maxSamples){
+
+  if(entry < 0) return 0;
+
+  CacheEntry &cached = entries[entry];
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  uint32_t filled = cached.filled;
+
+  xSemaphoreGive(cacheMutex);
+
+  if(sample < cached.start || sample >= cached.start + filled) return 0;
+
+  uint32_t offset = sample - cached.start;
+  uint32_t inBlock = offset % TRACK_CACHE_BLOCK_SAMPLES;
+  size_t n = TRACK_CACHE_BLOCK_SAMPLES - inBlock;
+
+  if(n > filled - offset) n = filled - offset;
+  if(n > maxSamples) n = maxSamples;
+
+  *data = pool + cached.blocks[offset / TRACK_CACHE_BLOCK_SAMPLES] * TRACK_CACHE_BLOCK_SAMPLES + inBlock;
+
+  servedSamples += n;
+
+  return n;
+
+}
+
+void trackCacheRelease(int entry){
+
+  if(entry < 0) return;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  if(entries[entry].pins) entries[entry].pins--;
+
+  if(entries[entry].stale && !entries[entry].pins) freeEntry(entries[entry]);
+
+  xSemaphoreGive(cacheMutex);
+
+}
+
+/*
+
+  trackCacheInvalidate() - Drops everything cached or queued for a track. Call after the file has been changed.
+  A load in progress is stopped, and entries pinned by playback are freed once released.
+
+  const char * path - Track. Root directory MUST be included, i.e. "/test.wav" and not "test.wav".
+
+*/
+
+void trackCacheInvalidate(const char * path){
+
+  if(!blockCount) return;
+
+  uint64_t key = pathKey(path);
+
+  if(loading >= 0 && strcmp(queue[0].path, path) == 0){
+
+    blockReaderClose(loader);
+
+    loading = -1;
+
+  }
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  for(int i = 0; i < TRACK_CACHE_ENTRIES; i++){
+
+    CacheEntry &entry = entries[i];
+
+    if(!entry.used || entry.key != key) continue;
+
+    if(entry.pins) entry.stale = true;
+    else freeEntry(entry);
+
+  }
+
+  xSemaphoreGive(cacheMutex);
+
+  int kept = 0;
+
+  for(int i = 0; i < queueCount; i++){
+
+    if(strcmp(queue[i].path, path) != 0) queue[kept++] = queue[i];
+
+  }
+
+  queueCount = kept;
+
+}
+
+// Prints hit rate and memory used.
+
+void trackCacheReport(){
+
+  if(!blockCount){
+
+    Serial.println("Track cache disabled.");
+
+    return;
+
+  }
+
+  uint32_t used = 0;
+  int entryCount = 0;
+
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+
+  for(uint32_t i = 0; i < blockCount; i++) used += blockUsed[i];
+  for(int i = 0; i < TRACK_CACHE_ENTRIES; i++) entryCount += entries[i].used;
+
+  xSemaphoreGive(cacheMutex);
+
+  Serial.printf("Track cache: %u/%u lookups hit (%.1f%%), %llu samples played from cache, %u loaded, %u evictions.\n",
+                hits, lookups, lookups ? 100.0 * hits / lookups : 0.0, servedSamples, loadedSamples, evictions);
+  Serial.printf("Track cache: %d entries, %u/%u blocks, %u/%u KB used, %d loads queued.\n", entryCount, used, blockCount,
+                used * TRACK_CACHE_BLOCK_SAMPLES * 2 / 1024, blockCount * TRACK_CACHE_BLOCK_SAMPLES * 2 / 1024, queueCount);
+
+}
@@ -0,0 +1,50 @@
+#ifndef _TRACK_CACHE_H
+#define _TRACK_CACHE_H
+
+/*
+
+  PSRAM cache of decoded track audio.
+
+  The cache holds ranges of tracks as 16 bit samples, i.e. the first few seconds of recently played and adjacent
+  tracks, or an A-B loop region. Playback reads cached ranges from RAM instead of the SD card, so track switches
+  start instantly and loops never touch the card.
+
+  Memory is one allocation of TRACK_CACHE_BYTES made by trackCacheInit(), split into TRACK_CACHE_BLOCK_SAMPLES
+  blocks. An entry uses as many blocks as its range needs, and blocks of least recently used entries are reused
+  when space runs out. Entries in use by playback are pinned with trackCacheAcquire() and never evicted.
+
+  Loads are queued with trackCacheRequest() and done one block at a time by trackCacheService(), which loop()
+  calls between frames, so the UI never stalls on a large load. Samples become readable as soon as their block
+  is loaded. trackCacheRequest(), trackCacheService() and trackCacheInvalidate() must be called from the same task,
+  the other functions may be called from any task.
+
+  Anything that rewrites, replaces or deletes a track calls trackCacheInvalidate() when done, so stale samples are
+  never played. Entries pinned at that point stay readable until released, but are never handed out again.
+
+  TRACK_CACHE_BYTES - Total cache size. Taken from PSRAM, or TRACK_CACHE_FALLBACK_BYTES of internal RAM without it.
+  TRACK_CACHE_HEAD_SECONDS - Length cached from the start of recent and adjacent tracks.
+  TRACK_CACHE_READ_BLOCK - Read block size of the loader. Its buffer is taken from the audio arena.
+
+*/
+
+#include "mono_file.h"
+
+#define TRACK_CACHE_BYTES (2 * 1024 * 1024)
+#define TRACK_CACHE_FALLBACK_BYTES (64 * 1024)
+#define TRACK_CACHE_BLOCK_SAMPLES 16384
+#define TRACK_CACHE_MAX_BLOCKS (TRACK_CACHE_BYTES / (TRACK_CACHE_BLOCK_SAMPLES * 2))
+#define TRACK_CACHE_ENTRIES 16
+#define TRACK_CACHE_QUEUE 8
+#define TRACK_CACHE_HEAD_SECONDS 3
+#define TRACK_CACHE_READ_BLOCK (8 * 1024)
+
+bool trackCacheInit(size_t bytes = TRACK_CACHE_BYTES);
+void trackCacheRequest(const char * path, uint32_t start, uint32_t end);
+bool trackCacheService(fs::FS &fs);
+int trackCacheAcquire(const char * path, uint32_t sample);
+size_t trackCacheRead(int entry, uint32_t sample, const int16_t **data, size_t maxSamples);
+void trackCacheRelease(int entry);
+void trackCacheInvalidate(const char * path);
+void trackCacheReport();
+
+#endif